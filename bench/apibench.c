@@ -0,0 +1,130 @@
+/*
+** apibench.c
+** Bulk C API benchmark
+** See Copyright Notice in cscript.h
+**
+** Moves an array of a million numbers (or first argument in thousands)
+** between C and an array value, one element per call ('cs_set_index',
+** 'cs_get_index') and with the bulk functions, and fills a table with
+** the same number of fields one at a time and with 'cs_set_fields'.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "cauxlib.h"
+
+
+#define REPEAT      5
+
+/* number of fields set by each call to 'cs_set_fields' */
+#define BATCH       64
+
+
+static double seconds(clock_t start) {
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+
+static void report(const char *what, int n, double single, double bulk) {
+    printf("%-10s %10d elements  single %8.3f s  bulk %8.3f s  (%.1fx)\n",
+           what, n, single, bulk, (bulk > 0) ? single / bulk : 0.0);
+}
+
+
+static int fail(const char *what) {
+    fprintf(stderr, "apibench: %s does not match\n", what);
+    return EXIT_FAILURE;
+}
+
+
+int main(int argc, char **argv) {
+    int n = ((argc > 1) ? atoi(argv[1]) : 1000) * 1000;
+    cs_Number *nums = malloc(sizeof(cs_Number) * (size_t)(n > 0 ? n : 1));
+    cs_Integer *ints = malloc(sizeof(cs_Integer) * (size_t)(n > 0 ? n : 1));
+    cs_State *C = csL_newstate();
+    double tsingle = 0, tbulk = 0;
+    clock_t start;
+    if (nums == NULL || ints == NULL || C == NULL) {
+        fprintf(stderr, "apibench: not enough memory\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < n; i++)
+        nums[i] = i * 0.5;
+    /* C -> array */
+    for (int r = 0; r < REPEAT; r++) {
+        cs_push_array(C, 0);
+        start = clock();
+        for (int i = 0; i < n; i++) {
+            cs_push_number(C, nums[i]);
+            cs_set_index(C, -2, i);
+        }
+        tsingle += seconds(start);
+        cs_pop(C, 1);
+        cs_push_array(C, 0);
+        start = clock();
+        cs_set_array_numbers(C, -1, nums, n);
+        tbulk += seconds(start);
+        if (r < REPEAT - 1) cs_pop(C, 1);
+    }
+    report("set", n, tsingle, tbulk);
+    /* array -> C (array is on top) */
+    tsingle = tbulk = 0;
+    for (int r = 0; r < REPEAT; r++) {
+        start = clock();
+        for (int i = 0; i < n; i++) {
+            cs_get_index(C, -1, i);
+            ints[i] = cs_to_integer(C, -1); /* (discard fraction) */
+            cs_pop(C, 1);
+        }
+        tsingle += seconds(start);
+        start = clock();
+        if (cs_get_array_numbers(C, -1, nums, n) != n) return fail("get");
+        tbulk += seconds(start);
+    }
+    report("get", n, tsingle, tbulk);
+    for (int i = 0; i < n; i++)
+        if (nums[i] != i * 0.5) return fail("get");
+    if (n > 1 && cs_get_array_integers(C, -1, ints, n) != 1)
+        return fail("integer get"); /* stops at 0.5 */
+    for (int i = 0; i < n; i++)
+        ints[i] = (cs_Integer)i * 3;
+    cs_set_array_integers(C, -1, ints, n);
+    if (cs_get_array_integers(C, -1, ints, n) != n) return fail("integer get");
+    for (int i = 0; i < n; i++)
+        if (ints[i] != (cs_Integer)i * 3) return fail("integer get");
+    cs_pop(C, 1);
+    /* C -> table fields */
+    tsingle = tbulk = 0;
+    csL_check_stack(C, 2 * BATCH + 1, "too many fields");
+    for (int r = 0; r < REPEAT; r++) {
+        cs_push_table(C, 0);
+        start = clock();
+        for (int i = 0; i < n; i++) {
+            cs_push_number(C, nums[i]);
+            cs_set_fieldint(C, -2, i);
+        }
+        tsingle += seconds(start);
+        cs_pop(C, 1);
+        cs_push_table(C, 0);
+        start = clock();
+        for (int i = 0; i < n; i += BATCH) {
+            int nf = (n - i < BATCH) ? n - i : BATCH;
+            for (int j = i; j < i + nf; j++) {
+                cs_push_integer(C, j);
+                cs_push_number(C, nums[j]);
+            }
+            cs_set_fields(C, -(2 * nf + 1), nf);
+        }
+        tbulk += seconds(start);
+        if (cs_len(C, -1) != (cs_Unsigned)n) return fail("table");
+        cs_pop(C, 1);
+    }
+    report("fields", n, tsingle, tbulk);
+    cs_close(C);
+    free(nums);
+    free(ints);
+    return EXIT_SUCCESS;
+}
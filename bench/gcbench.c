@@ -0,0 +1,75 @@
+/*
+** gcbench.c
+** Garbage collector benchmark
+** See Copyright Notice in cscript.h
+**
+** Builds a heap with an array of a million numbers (or first argument
+** in thousands), an array of as many short strings and a table with as
+** many fields referring to small tables, and times full collections
+** that keep all of it alive and one that frees it. Build with
+** 'CSI_POOLLIMIT' set to 0 to compare sweeping without object pools.
+*/
+
+
+#define _POSIX_C_SOURCE     199309L /* 'clock_gettime' (wall time) */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "cauxlib.h"
+
+
+#define REPEAT      5
+
+
+static double seconds(struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) +
+           (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+static double collect(cs_State *C) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    cs_gc(C, CS_GCCOLLECT);
+    return seconds(&start);
+}
+
+
+int main(int argc, char **argv) {
+    int n = ((argc > 1) ? atoi(argv[1]) : 1000) * 1000;
+    cs_State *C = csL_newstate();
+    double tlive = 0, tfree;
+    if (C == NULL || n <= 0) {
+        fprintf(stderr, "gcbench: cannot create state\n");
+        return EXIT_FAILURE;
+    }
+    cs_gc(C, CS_GCSTOP); /* collect only when asked */
+    cs_push_array(C, 0);
+    for (int i = 0; i < n; i++) {
+        cs_push_number(C, i * 0.5);
+        cs_set_index(C, -2, i);
+    }
+    cs_push_array(C, 0);
+    for (int i = 0; i < n; i++) {
+        cs_push_fstring(C, "s%d", i);
+        cs_set_index(C, -2, i);
+    }
+    cs_push_table(C, 0);
+    for (int i = 0; i < n; i++) {
+        cs_push_table(C, 0);
+        cs_set_fieldint(C, -2, i);
+    }
+    printf("heap: %d KB\n", cs_gc(C, CS_GCCOUNT));
+    for (int r = 0; r < REPEAT; r++)
+        tlive += collect(C);
+    cs_pop(C, 3);
+    tfree = collect(C);
+    printf("full collection: %8.2f ms (live)  %8.2f ms (all dead)\n",
+           tlive * 1e3 / REPEAT, tfree * 1e3);
+    cs_close(C);
+    return EXIT_SUCCESS;
+}
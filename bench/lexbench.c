@@ -0,0 +1,157 @@
+/*
+** lexbench.c
+** Scanner throughput benchmark
+** See Copyright Notice in cscript.h
+**
+** Generates a large source (default 8 MB, or first argument in MB) and
+** reports how fast it is tokenized by the scanner alone and how fast
+** it is compiled by 'cs_load'.
+*/
+
+
+#define CS_CORE
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cauxlib.h"
+#include "cgc.h"
+#include "clexer.h"
+#include "cparser.h"
+#include "cprotected.h"
+#include "cstate.h"
+#include "cstring.h"
+#include "ctable.h"
+
+
+#define REPEAT      5
+
+
+static const char *const snippet =
+    "# generated function number %d\n"
+    "fn compute_%d(alpha, beta_value, _gamma) {\n"
+    "    local total = 0;\n"
+    "    local index = %d;\n"
+    "    for (local i = 0; i < 1024; i = i + 1) {\n"
+    "        if (alpha[i] != nil and beta_value >= 0x1F) {\n"
+    "            total = total + alpha[i] * 3.25e2 - _gamma / 7;\n"
+    "        } else {\n"
+    "            total = total .. \"item \" .. index; // concat\n"
+    "        }\n"
+    "    }\n"
+    "    /* a block comment spanning\n"
+    "       two lines */\n"
+    "    return total, index << 2, 1_000_000;\n"
+    "}\n";
+
+
+static char *gensource(size_t size, size_t *len) {
+    char *src = malloc(size + 1024);
+    size_t n = 0;
+    int i = 0;
+    if (src == NULL) return NULL;
+    while (n < size) {
+        n += sprintf(src + n, snippet, i, i, i * 7);
+        i++;
+    }
+    *len = n;
+    return src;
+}
+
+
+typedef struct LoadStr {
+    const char *s;
+    size_t len;
+} LoadStr;
+
+
+static const char *strreader(cs_State *C, void *ud, size_t *sz) {
+    LoadStr *ls = (LoadStr *)ud;
+    (void)C;
+    if (ls->len == 0) return NULL;
+    *sz = ls->len;
+    ls->len = 0;
+    return ls->s;
+}
+
+
+typedef struct LexData {
+    LoadStr ls;
+    size_t ntokens;
+} LexData;
+
+
+/* run scanner over whole source (in protected mode) */
+static void lexall(cs_State *C, void *ud) {
+    LexData *ld = (LexData *)ud;
+    BuffReader br;
+    Buffer buff;
+    ParserState ps;
+    Lexer lx;
+    memset(&ps, 0, sizeof(ps));
+    csR_buffinit(&buff);
+    csR_init(C, &br, strreader, &ld->ls);
+    lx.tab = csH_new(C);
+    settval2s(C, C->sp.p, lx.tab); /* anchor scanner table */
+    csT_incsp(C);
+    lx.ps = &ps;
+    lx.buff = &buff;
+    csY_setinput(C, &lx, &br, csS_newlit(C, "lexbench"));
+    do {
+        csY_scan(&lx);
+        ld->ntokens++;
+    } while (lx.t.tk != TK_EOS);
+    C->sp.p--; /* remove scanner table */
+    csR_freebuffer(C, &buff);
+}
+
+
+static double seconds(clock_t start) {
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+
+int main(int argc, char **argv) {
+    size_t mb = (argc > 1) ? (size_t)atoi(argv[1]) : 8;
+    size_t len;
+    char *src = gensource(mb * 1024 * 1024, &len);
+    cs_State *C = csL_newstate();
+    double tlex = 0, tload = 0;
+    size_t ntokens = 0;
+    if (src == NULL || C == NULL) {
+        fprintf(stderr, "lexbench: not enough memory\n");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < REPEAT; i++) {
+        LexData ld;
+        clock_t start;
+        ld.ls.s = src; ld.ls.len = len;
+        ld.ntokens = 0;
+        start = clock();
+        if (csPR_rawcall(C, lexall, &ld) != CS_OK) {
+            fprintf(stderr, "lexbench: %s\n", cs_to_string(C, -1));
+            return EXIT_FAILURE;
+        }
+        tlex += seconds(start);
+        ntokens = ld.ntokens;
+        ld.ls.s = src; ld.ls.len = len;
+        start = clock();
+        if (cs_load(C, strreader, &ld.ls, "lexbench", NULL) != CS_OK) {
+            fprintf(stderr, "lexbench: %s\n", cs_to_string(C, -1));
+            return EXIT_FAILURE;
+        }
+        tload += seconds(start);
+        cs_pop(C, 1);
+        cs_gc(C, CS_GCCOLLECT);
+    }
+    printf("source: %.2f MB, %zu tokens\n", len / 1048576.0, ntokens);
+    printf("scan:   %8.2f MB/s %10.0f tokens/s\n",
+           (len / 1048576.0) * REPEAT / tlex, (double)ntokens * REPEAT / tlex);
+    printf("load:   %8.2f MB/s\n", (len / 1048576.0) * REPEAT / tload);
+    cs_close(C);
+    free(src);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,94 @@
+/*
+** refbench.c
+** Reference system benchmark
+** See Copyright Notice in cscript.h
+**
+** Creates and drops a million references (or first argument in
+** thousands) in the registry with 'csL_ref'/'csL_unref', both with all
+** references alive at once and as short-lived references that are
+** dropped as soon as they are created.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "cauxlib.h"
+
+
+static double seconds(clock_t start) {
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+
+static void report(const char *what, int n, double t) {
+    printf("%-10s %10d refs %8.3f s %12.0f refs/s\n", what, n, t,
+           (t > 0) ? n / t : 0.0);
+}
+
+
+/* create 'n' live references, storing them in 'refs' */
+static double refall(cs_State *C, int *refs, int n) {
+    clock_t start = clock();
+    for (int i = 0; i < n; i++) {
+        cs_push_integer(C, i);
+        refs[i] = csL_ref(C, CS_REGISTRYINDEX);
+    }
+    return seconds(start);
+}
+
+
+/* drop all references in 'refs' */
+static double unrefall(cs_State *C, int *refs, int n) {
+    clock_t start = clock();
+    for (int i = 0; i < n; i++)
+        csL_unref(C, CS_REGISTRYINDEX, refs[i]);
+    return seconds(start);
+}
+
+
+/* check that each reference in 'refs' still refers to its value */
+static int checkrefs(cs_State *C, int *refs, int n) {
+    for (int i = 0; i < n; i++) {
+        int ok = (cs_get_index(C, CS_REGISTRYINDEX, refs[i]) == CS_TNUMBER &&
+                  cs_to_integer(C, -1) == i);
+        cs_pop(C, 1);
+        if (!ok) return 0;
+    }
+    return 1;
+}
+
+
+int main(int argc, char **argv) {
+    int n = ((argc > 1) ? atoi(argv[1]) : 1000) * 1000;
+    int *refs = malloc(sizeof(int) * (size_t)(n > 0 ? n : 1));
+    cs_State *C = csL_newstate();
+    clock_t start;
+    double t;
+    if (refs == NULL || C == NULL) {
+        fprintf(stderr, "refbench: not enough memory\n");
+        return EXIT_FAILURE;
+    }
+    report("ref", n, refall(C, refs, n));
+    if (!checkrefs(C, refs, n)) goto bad;
+    report("unref", n, unrefall(C, refs, n));
+    report("reuse", n, refall(C, refs, n)); /* from the free list */
+    if (!checkrefs(C, refs, n)) goto bad;
+    unrefall(C, refs, n);
+    start = clock(); /* short-lived references */
+    for (int i = 0; i < n; i++) {
+        int ref;
+        cs_push_integer(C, i);
+        ref = csL_ref(C, CS_REGISTRYINDEX);
+        csL_unref(C, CS_REGISTRYINDEX, ref);
+    }
+    t = seconds(start);
+    report("ref+unref", n, t);
+    cs_close(C);
+    free(refs);
+    return EXIT_SUCCESS;
+bad:
+    fprintf(stderr, "refbench: reference does not match its value\n");
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,176 @@
+/*
+** tablebench.c
+** Hash table benchmark
+** See Copyright Notice in cscript.h
+**
+** Inserts a million keys (or first argument in thousands) into a table
+** and looks each of them up again, followed by as many lookups of keys
+** that are not in the table, for string keys, integer keys and a mix of
+** integer, float and string keys, and times growing the full table to
+** twice its size. The slowest batch of BATCH insertions shows the
+** longest stall caused by growing the table. Build with and without
+** 'CSI_SWISSTABLE' to compare the table engines.
+*/
+
+
+#define CS_CORE
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "cauxlib.h"
+#include "cdebug.h"
+#include "cgc.h"
+#include "cprotected.h"
+#include "cstate.h"
+#include "cstring.h"
+#include "ctable.h"
+
+
+#define REPEAT      5
+
+/* number of insertions timed together */
+#define BATCH       64
+
+
+typedef struct Workload {
+    const char *name;
+    int n; /* number of keys */
+    TValue *keys; /* keys inserted into the table */
+    TValue *misses; /* keys not in the table */
+    Table *anchor; /* keeps string keys alive */
+    double tinsert, thit, tmiss, tresize;
+    double worst; /* slowest batch of insertions */
+} Workload;
+
+
+static double seconds(clock_t start) {
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+
+/* make key number 'i' of kind 'kind' ('s' string, 'i' integer, 'm' mix) */
+static void makekey(cs_State *C, Workload *w, TValue *k, int i, int kind,
+                    const char *prefix) {
+    if (kind == 'm') /* cycle through the three kinds */
+        kind = "isf"[i % 3];
+    switch (kind) {
+        case 's': {
+            char buff[32];
+            TValue aux;
+            snprintf(buff, sizeof(buff), "%s%d", prefix, i);
+            setstrval(C, k, csS_new(C, buff));
+            setival(&aux, w->n * (*prefix == 'k') + i);
+            csH_set(C, w->anchor, &aux, k);
+            break;
+        }
+        case 'i': /* spread keys out; misses are negative */
+            setival(k, (*prefix == 'k') ? (cs_Integer)i * 7919
+                                        : -(cs_Integer)i * 7919 - 1);
+            break;
+        default: /* floats with a fraction are not normalized */
+            setfval(k, i + (*prefix == 'k' ? 0.5 : 0.25));
+            break;
+    }
+}
+
+
+static void genkeys(cs_State *C, void *ud) {
+    Workload *w = (Workload *)ud;
+    int kind = w->name[0];
+    for (int i = 0; i < w->n; i++) {
+        makekey(C, w, &w->keys[i], i, kind, "key");
+        makekey(C, w, &w->misses[i], i, kind, "miss");
+    }
+}
+
+
+static void run(cs_State *C, void *ud) {
+    Workload *w = (Workload *)ud;
+    Table *ht = csH_new(C);
+    clock_t start;
+    int found = 0;
+    TValue v;
+    settval2s(C, C->sp.p, ht); /* anchor table */
+    csT_incsp(C);
+    for (int i = 0; i < w->n; i += BATCH) {
+        int last = (w->n - i < BATCH) ? w->n : i + BATCH;
+        double t;
+        start = clock();
+        for (int j = i; j < last; j++) {
+            setival(&v, j);
+            csH_set(C, ht, &w->keys[j], &v);
+        }
+        t = seconds(start);
+        w->tinsert += t;
+        if (t > w->worst) w->worst = t;
+    }
+    start = clock();
+    for (int i = 0; i < w->n; i++)
+        found += !isempty(csH_get(ht, &w->keys[i]));
+    w->thit += seconds(start);
+    start = clock();
+    for (int i = 0; i < w->n; i++)
+        found += !isempty(csH_get(ht, &w->misses[i]));
+    w->tmiss += seconds(start);
+    start = clock();
+    csH_resize(C, ht, cast_uint(w->n) * 2);
+    w->tresize += seconds(start);
+    C->sp.p--; /* remove table */
+    if (found != w->n)
+        csD_runerror(C, "wrong number of keys found");
+}
+
+
+static void report(Workload *w) {
+    double n = (double)w->n * REPEAT / 1e6;
+    printf("%-8s %8d keys  insert %7.2f  hit %7.2f  miss %7.2f  Mops/s"
+           "  resize %7.2f ms  worst batch %7.2f ms\n", w->name, w->n,
+           n / w->tinsert, n / w->thit, n / w->tmiss,
+           w->tresize * 1e3 / REPEAT, w->worst * 1e3);
+}
+
+
+int main(int argc, char **argv) {
+    static const char *const names[] = {"string", "integer", "mixed"};
+    int n = ((argc > 1) ? atoi(argv[1]) : 1000) * 1000;
+    cs_State *C = csL_newstate();
+    if (C == NULL || n <= 0) {
+        fprintf(stderr, "tablebench: cannot create state\n");
+        return EXIT_FAILURE;
+    }
+    printf("engine: %s\n", CSI_SWISSTABLE ? "swiss" : "chained");
+    for (int i = 0; i < 3; i++) {
+        Workload w;
+        w.name = names[i];
+        w.n = n;
+        w.keys = malloc(sizeof(TValue) * (size_t)n);
+        w.misses = malloc(sizeof(TValue) * (size_t)n);
+        if (w.keys == NULL || w.misses == NULL) {
+            fprintf(stderr, "tablebench: not enough memory\n");
+            return EXIT_FAILURE;
+        }
+        w.tinsert = w.thit = w.tmiss = w.tresize = w.worst = 0;
+        w.anchor = csH_new(C);
+        settval2s(C, C->sp.p, w.anchor); /* anchor string keys */
+        csT_incsp(C);
+        if (csPR_rawcall(C, genkeys, &w) != CS_OK)
+            goto error;
+        for (int r = 0; r < REPEAT; r++) {
+            if (csPR_rawcall(C, run, &w) != CS_OK)
+                goto error;
+            cs_gc(C, CS_GCCOLLECT);
+        }
+        report(&w);
+        cs_pop(C, 1); /* remove anchor */
+        free(w.keys);
+        free(w.misses);
+    }
+    cs_close(C);
+    return EXIT_SUCCESS;
+error:
+    fprintf(stderr, "tablebench: %s\n", cs_to_string(C, -1));
+    return EXIT_FAILURE;
+}
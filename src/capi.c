@@ -8,6 +8,8 @@
 #define CS_CORE
 
 
+#include <string.h>
+
 #include "carray.h"
 #include "cdebug.h"
 #include "cfunction.h"
@@ -25,6 +27,7 @@
 #include "cobject.h"
 #include "cstate.h"
 #include "cstring.h"
+#include "cundump.h"
 #include "cvm.h"
 #include "stdarg.h"
 #include "capi.h"
@@ -50,7 +53,7 @@ static TValue *index2value(const cs_State *C, int index) {
     CallFrame *cf = C->cf;
     if (index >= 0) { /* absolute index? */
         SPtr o = (cf->func.p + 1) + index;
-        api_check(C, index < C->sp.p - (cf->func.p + 1), "index too large");
+        api_check(C, index < cf->top.p - (cf->func.p + 1), "index too large");
         if (o >= C->sp.p) return &G(C)->nil;
         else return s2v(o);
     } else if (!ispseudo(index)) { /* negative index? */
@@ -59,11 +62,12 @@ static TValue *index2value(const cs_State *C, int index) {
     } else if (index == CS_REGISTRYINDEX) {
         return &G(C)->c_registry;
     } else { /* upvalues */
-        index = CS_REGISTRYINDEX - index;
+        index = CS_REGISTRYINDEX - index - 1;
         api_check(C, index < MAXUPVAL, "upvalue index too large");
         if (c_likely(ttisCclosure(s2v(cf->func.p)))) { /* C closure? */
             CClosure *ccl = clCval(s2v(cf->func.p));
-            return &ccl->upvals[index];
+            return (index < ccl->nupvalues) ? &ccl->upvals[index]
+                                            : &G(C)->nil;
         } else { /* CScript function (invalid) */
             api_check(C, 0, "caller not a C closure");
             return &G(C)->nil; /* no upvalues */
@@ -349,7 +353,12 @@ c_sinline TValue *getvmt(cs_State *C, int index) {
 */
 CS_API int cs_type(cs_State *C, int index) {
     const TValue *o = index2value(C, index);
-    return (isvalid(C, o) ? ttype(o) : CS_TNONE);
+    if (!isvalid(C, o))
+        return CS_TNONE;
+    else if (ttislightuserdata(o)) /* light userdata is a variant */
+        return CS_TLIGHTUSERDATA;
+    else
+        return ttype(o);
 }
 
 
@@ -360,7 +369,7 @@ CS_API int cs_type(cs_State *C, int index) {
 */
 CS_API const char *cs_typename(cs_State *C, int type) {
     UNUSED(C);
-    api_check(C, 0 <= type && type < CS_NUM_TYPES, "invalid type");
+    api_check(C, CS_TNONE <= type && type < CS_NUM_TYPES, "invalid type");
     return typename(type);
 }
 
@@ -585,6 +594,30 @@ CS_API const char *cs_push_lstring(cs_State *C, const char *str, size_t len) {
 }
 
 
+/*
+** Push a new (long) string of length 'len' and return a pointer to its
+** contents, which are uninitialized; the caller must fill all 'len'
+** bytes before the string is used in any way (long strings are hashed
+** only on demand). This lets readers produce strings without an extra
+** copy. Short strings are internalized by contents, so for 'len' that
+** would make a short string nothing is pushed and NULL is returned.
+*/
+CS_API char *cs_push_newlstring(cs_State *C, size_t len) {
+    OString *s;
+    if (len <= CSI_MAXSHORTLEN)
+        return NULL;
+    cs_lock(C);
+    if (c_unlikely(len*sizeof(char) >= (MAXSIZE - sizeof(OString))))
+        csM_toobig(C);
+    s = csS_newlngstrobj(C, len);
+    setstrval2s(C, C->sp.p, s);
+    api_inctop(C);
+    csG_checkGC(C);
+    cs_unlock(C);
+    return getlngstr(s);
+}
+
+
 /* Push null terminated string value on top of the stack. */
 CS_API const char *cs_push_string(cs_State *C, const char *str) {
     cs_lock(C);
@@ -695,6 +728,18 @@ CS_API void cs_push_lightuserdata(cs_State *C, void *p) {
 }
 
 
+/*
+** Push the generic 'next' iterator on top of the stack. Generic loops
+** using this function iterate tables and instances without calling it.
+*/
+CS_API void cs_push_next(cs_State *C) {
+    cs_lock(C);
+    setcfval(C, s2v(C->sp.p), csV_next);
+    api_inctop(C);
+    cs_unlock(C);
+}
+
+
 /* Push array on top of the stack. */
 CS_API void cs_push_array(cs_State *C, int sz) {
     Array *arr;
@@ -713,11 +758,9 @@ CS_API void cs_push_array(cs_State *C, int sz) {
 CS_API void cs_push_table(cs_State *C, int sz) {
     Table *ht;
     cs_lock(C);
-    ht = csH_new(C);
+    ht = csH_newsz(C, (sz > 0) ? sz : 0); /* allocate its nodes only once */
     settval2s(C, C->sp.p, ht);
     api_inctop(C);
-    if (sz > 0)
-        csH_resize(C, ht, sz);
     csG_checkGC(C);
     cs_unlock(C);
 }
@@ -919,6 +962,71 @@ CS_API int cs_get_index(cs_State *C, int index, cs_Integer i) {
 }
 
 
+/*
+** Copy up to 'n' elements of the array at 'index' (starting at its first
+** element) into 'v' as numbers. Copying stops at the end of the array or
+** at the first element that is not a number; returns the number of
+** elements copied.
+*/
+CS_API int cs_get_array_numbers(cs_State *C, int index, cs_Number *v,
+                                int n) {
+    Array *arr;
+    int i;
+    cs_lock(C);
+    api_check(C, n >= 0, "invalid 'n'");
+    arr = getarray(C, index);
+    if (cast_uint(n) > arr->n) n = cast_int(arr->n);
+    for (i = 0; i < n; i++) {
+        if (!tonumber(&arr->b[i], v[i]))
+            break;
+    }
+    cs_unlock(C);
+    return i;
+}
+
+
+/*
+** Same as 'cs_get_array_numbers' but elements are converted to integers;
+** copying stops at the first element without an exact integer value.
+*/
+CS_API int cs_get_array_integers(cs_State *C, int index, cs_Integer *v,
+                                 int n) {
+    Array *arr;
+    int i;
+    cs_lock(C);
+    api_check(C, n >= 0, "invalid 'n'");
+    arr = getarray(C, index);
+    if (cast_uint(n) > arr->n) n = cast_int(arr->n);
+    for (i = 0; i < n; i++) {
+        if (!tointeger(&arr->b[i], &v[i]))
+            break;
+    }
+    cs_unlock(C);
+    return i;
+}
+
+
+/*
+** Remove element at position 'i' from the array at 'index', shifting
+** the following elements down, and push it on the stack. Pushes nil if
+** 'i' is out of bounds.
+*/
+CS_API int cs_remove_index(cs_State *C, int index, cs_Integer i) {
+    Array *arr;
+    cs_lock(C);
+    api_check(C, i >= 0, "invalid `index`");
+    arr = getarray(C, index);
+    if (c_castS2U(i) < arr->n) {
+        setobj2s(C, C->sp.p, &arr->b[i]);
+        csA_remove(arr, cast_int(i));
+    } else
+        setnilval(s2v(C->sp.p));
+    api_inctop(C);
+    cs_unlock(C);
+    return ttype(s2v(C->sp.p - 1));
+}
+
+
 CS_API int cs_get_nilindex(cs_State *C, int index, int begin, int end) {
     Array *arr = getarray(C, index);
     uint len = (arr->n <= (uint)end ? arr->n : (uint)end + 1);
@@ -1058,9 +1166,8 @@ CS_API void *cs_newuserdata(cs_State *C, size_t sz, int nuv) {
     api_checknelems(C, nuv);
     ud = csMM_newuserdata(C, sz, nuv);
     C->sp.p -= nuv;
-    while (nuv--)
-        setobj(C, &ud->uv[nuv].val, s2v(C->sp.p + nuv));
-    ud->nuv = nuv;
+    for (int i = 0; i < nuv; i++)
+        setobj(C, &ud->uv[i].val, s2v(C->sp.p + i));
     setuval2s(C, C->sp.p, ud);
     api_inctop(C);
     cs_unlock(C);
@@ -1108,7 +1215,7 @@ CS_API int cs_get_uservalue(cs_State *C, int udobj, int n) {
         tt = CS_TNONE;
     } else {
         setobj2s(C, C->sp.p, &ud->uv[n - 1].val);
-        tt = ttype(s2v(C->sp.p - 1));
+        tt = ttype(s2v(C->sp.p));
     }
     api_inctop(C);
     cs_unlock(C);
@@ -1147,6 +1254,25 @@ CS_API void  cs_set_raw(cs_State *C, int obj) {
 }
 
 
+/*
+** Insert value on top of the stack at position 'i' of the array at
+** 'index', shifting the elements at 'i' and above one position up.
+*/
+CS_API void cs_insert_index(cs_State *C, int index, cs_Integer i) {
+    Array *arr;
+    TValue *slot;
+    cs_lock(C);
+    api_checknelems(C, 1); /* value */
+    api_check(C, 0 <= i && i < ARRAYLIMIT, "`index` out of bounds");
+    arr = getarray(C, index);
+    slot = csA_insert(C, arr, cast_int(i));
+    setobj(C, slot, s2v(C->sp.p - 1));
+    csG_barrierback(C, obj2gco(arr), s2v(C->sp.p - 1));
+    C->sp.p--; /* remove value */
+    cs_unlock(C);
+}
+
+
 CS_API void cs_set_index(cs_State *C, int index, cs_Integer i) {
     Array *arr;
     cs_lock(C);
@@ -1161,6 +1287,41 @@ CS_API void cs_set_index(cs_State *C, int index, cs_Integer i) {
 }
 
 
+/*
+** Set the first 'n' elements of the array at 'index' to the numbers
+** in 'v', growing the array if needed.
+*/
+CS_API void cs_set_array_numbers(cs_State *C, int index, const cs_Number *v,
+                                 int n) {
+    Array *arr;
+    cs_lock(C);
+    api_check(C, 0 <= n && n <= ARRAYLIMIT, "invalid 'n'");
+    arr = getarray(C, index);
+    if (n > 0) {
+        csA_ensure(C, arr, n - 1);
+        for (int i = 0; i < n; i++)
+            setfval(&arr->b[i], v[i]);
+    }
+    cs_unlock(C);
+}
+
+
+/* same as 'cs_set_array_numbers' but for integers */
+CS_API void cs_set_array_integers(cs_State *C, int index, const cs_Integer *v,
+                                  int n) {
+    Array *arr;
+    cs_lock(C);
+    api_check(C, 0 <= n && n <= ARRAYLIMIT, "invalid 'n'");
+    arr = getarray(C, index);
+    if (n > 0) {
+        csA_ensure(C, arr, n - 1);
+        for (int i = 0; i < n; i++)
+            setival(&arr->b[i], v[i]);
+    }
+    cs_unlock(C);
+}
+
+
 c_sinline void auxrawsetfield(cs_State *C, int obj, TValue *key, int n) {
     Table *ht;
     cs_lock(C);
@@ -1178,6 +1339,25 @@ CS_API void cs_set_field(cs_State *C, int obj) {
 }
 
 
+/*
+** Set fields of the table or instance at 'index' from the 'n' key-value
+** pairs on top of the stack (key below its value, first pair deepest)
+** and pop them. A table too small for 'n' keys is resized once up front.
+*/
+CS_API void cs_set_fields(cs_State *C, int index, int n) {
+    Table *ht;
+    SPtr first;
+    cs_lock(C);
+    api_check(C, n >= 0, "invalid 'n'");
+    api_checknelems(C, 2 * n);
+    ht = gettable(C, index);
+    first = C->sp.p - 2 * n;
+    csH_setpairs(C, ht, first, n);
+    C->sp.p = first;
+    cs_unlock(C);
+}
+
+
 CS_API void cs_set_fieldstr(cs_State *C, int index, const char *field) {
     Table *ht;
     cs_lock(C);
@@ -1208,6 +1388,29 @@ CS_API void  cs_set_fieldflt(cs_State *C, int obj, cs_Number field) {
 }
 
 
+/*
+** Set which references of the table at 'index' are weak: keys if 'mode'
+** contains 'k', values if it contains 'v' (NULL or "" makes both of
+** them strong). Entries whose weak key or value gets collected are
+** removed from the table; a table with weak keys keeps a value alive
+** only as long as its key is reachable (ephemeron).
+*/
+CS_API void cs_set_mode(cs_State *C, int index, const char *mode) {
+    const TValue *o;
+    Table *ht;
+    cs_lock(C);
+    o = index2value(C, index);
+    api_check(C, ttishtab(o), "expect table");
+    ht = tval(o);
+    ht->mode = 0;
+    if (mode != NULL) {
+        if (strchr(mode, 'k')) setbit(ht->mode, WEAKKEYBIT);
+        if (strchr(mode, 'v')) setbit(ht->mode, WEAKVALBIT);
+    }
+    cs_unlock(C);
+}
+
+
 CS_API void cs_set_uservmt(cs_State *C, int udobj, const cs_VMT *vmt) {
     UserData *ud;
     cs_lock(C);
@@ -1236,8 +1439,8 @@ CS_API int cs_set_uservalue(cs_State *C, int index, int n) {
     cs_lock(C);
     api_checknelems(C, 1); /* value */
     ud = getuserdata(C, index);
-    if (!(cast_uint(n) <= cast_uint(ud->nuv))) {
-        res = 0; /* `n` not in [0, ud->nuv) */
+    if (!(cast_uint(n) - 1u < cast_uint(ud->nuv))) {
+        res = 0; /* `n` not in [1, ud->nuv] */
     } else {
         setobj(C, &ud->uv[n - 1].val, s2v(C->sp.p - 1));
         csG_barrierback(C, obj2gco(ud), s2v(C->sp.p - 1));
@@ -1347,14 +1550,42 @@ CS_API int cs_pcall(cs_State *C, int nargs, int nresults, int absmsgh) {
 }
 
 
+/*
+** Load a chunk. 'mode' (can be NULL) is a string of options:
+** 'b'/'t' accept only binary/text chunks (both by default), 'l' only
+** pre-parses function bodies, compiling each of them when its closure
+** is first created; 's' strips debug information.
+*/
 CS_API int cs_load(cs_State *C, cs_Reader reader, void *userdata,
-                    const char *source) {
+                    const char *source, const char *mode) {
     BuffReader br;
     int status;
     cs_lock(C);
     if (!source) source = "?";
     csR_init(C, &br, reader, userdata);
-    status = csPR_parse(C, &br, source);
+    status = csPR_parse(C, &br, source, mode);
+    if (status == CS_OK && mode != NULL && strchr(mode, 's') != NULL)
+        csF_stripdebug(C, clCSval(s2v(C->sp.p - 1))->p);
+    cs_unlock(C);
+    return status;
+}
+
+
+/*
+** Dump CScript function on top of the stack as a binary chunk that
+** 'cs_load' accepts; returns the error code of the last call to
+** 'writer' (non-zero if the value on top is not a CScript function).
+*/
+CS_API int cs_dump(cs_State *C, cs_Writer writer, void *data, int strip) {
+    int status;
+    const TValue *o;
+    cs_lock(C);
+    api_checknelems(C, 1);
+    o = s2v(C->sp.p - 1);
+    if (ttisCSclosure(o))
+        status = csU_dump(C, clCSval(o)->p, writer, data, strip);
+    else
+        status = 1;
     cs_unlock(C);
     return status;
 }
@@ -1501,6 +1732,20 @@ CS_API int cs_next(cs_State *C, int obj) {
 }
 
 
+/*
+** Sort array at 'index' in place by the raw order of its elements.
+** Only arrays whose elements are all numbers or all strings are sorted;
+** for anything else nothing is done and 0 is returned.
+*/
+CS_API int cs_sortarray(cs_State *C, int index) {
+    int res;
+    cs_lock(C);
+    res = csA_sort(C, getarray(C, index));
+    cs_unlock(C);
+    return res;
+}
+
+
 CS_API void cs_concat(cs_State *C, int n) {
     cs_lock(C);
     api_checknelems(C, n);
@@ -1653,3 +1898,19 @@ CS_API const char *cs_setupvalue(cs_State *C, int index, int n) {
     cs_unlock(C);
     return name;
 }
+
+
+/*
+** Strip line and local variable information from the CScript function
+** at 'index' and all functions nested in it. Errors then report no
+** line numbers, but function names (which are found by inspecting the
+** calling instruction) are still available.
+*/
+CS_API void cs_stripdebug(cs_State *C, int index) {
+    const TValue *o;
+    cs_lock(C);
+    o = index2value(C, index);
+    api_check(C, ttisCSclosure(o), "CScript function expected");
+    csF_stripdebug(C, clCSval(o)->p);
+    cs_unlock(C);
+}
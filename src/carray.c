@@ -8,12 +8,16 @@
 #define CS_CORE
 
 
+#include <string.h>
+
 #include "cdebug.h"
 #include "carray.h"
 #include "cgc.h"
 #include "climits.h"
 #include "cmem.h"
 #include "cobject.h"
+#include "cstring.h"
+#include "cvm.h"
 
 
 Array *csA_new(cs_State *C) {
@@ -48,7 +52,183 @@ void csA_ensure(cs_State *C, Array *arr, int index) {
 }
 
 
+/*
+** Open a slot at 'index' by shifting elements in [index, n) one position
+** up and return it; the caller must fill the slot. If 'index' is past
+** the end, the array grows as in 'csA_ensure'.
+*/
+TValue *csA_insert(cs_State *C, Array *arr, int index) {
+    uint cindex = cast_uint(index);
+    cs_assert(index >= 0);
+    if (cindex >= arr->n) { /* insert past the end? */
+        csA_ensure(C, arr, index);
+    } else {
+        csM_ensurearray(C, arr->b, arr->sz, arr->n, 1, ARRAYLIMIT,
+                        "array elements", TValue);
+        memmove(&arr->b[cindex + 1], &arr->b[cindex],
+                (arr->n - cindex) * sizeof(TValue));
+        arr->n++;
+    }
+    return &arr->b[cindex];
+}
+
+
+/*
+** Remove element at 'index' by shifting elements in (index, n) one
+** position down.
+*/
+void csA_remove(Array *arr, int index) {
+    uint cindex = cast_uint(index);
+    cs_assert(index >= 0 && cindex < arr->n);
+    memmove(&arr->b[cindex], &arr->b[cindex + 1],
+            (arr->n - cindex - 1) * sizeof(TValue));
+    arr->n--;
+}
+
+
+
+/* {======================================================================
+** Sorting (fast path for arrays of only numbers or only strings)
+** ======================================================================= */
+
+/* subarrays smaller than this are sorted with insertion sort */
+#define SORTTHRESHOLD       16
+
+
+typedef int (*SortLT)(cs_State *C, const TValue *v1, const TValue *v2);
+
+
+static int intlt(cs_State *C, const TValue *v1, const TValue *v2) {
+    UNUSED(C);
+    return ival(v1) < ival(v2);
+}
+
+
+static int strlt(cs_State *C, const TValue *v1, const TValue *v2) {
+    UNUSED(C);
+    return csS_cmp(strval(v1), strval(v2)) < 0;
+}
+
+
+/* numbers (mixed integers and floats) never invoke metamethods */
+#define numlt       csV_orderlt
+
+
+c_sinline void swapvals(TValue *a, int i, int j) {
+    TValue temp;
+    setobj(cast(cs_State *, NULL), &temp, &a[i]);
+    setobj(cast(cs_State *, NULL), &a[i], &a[j]);
+    setobj(cast(cs_State *, NULL), &a[j], &temp);
+}
+
+
+static void insertionsort(cs_State *C, TValue *a, int lo, int up,
+                          SortLT lt) {
+    for (int i = lo + 1; i <= up; i++) {
+        for (int j = i; j > lo && lt(C, &a[j], &a[j - 1]); j--)
+            swapvals(a, j, j - 1);
+    }
+}
+
+
+/* sift down element at 'i' in the heap 'a[lo..up]' */
+static void siftdown(cs_State *C, TValue *a, int lo, int i, int up,
+                     SortLT lt) {
+    for (;;) {
+        int child = lo + 2*(i - lo) + 1;
+        if (child > up) break;
+        if (child < up && lt(C, &a[child], &a[child + 1]))
+            child++; /* larger child */
+        if (!lt(C, &a[i], &a[child])) break;
+        swapvals(a, i, child);
+        i = child;
+    }
+}
+
+
+static void heapsort(cs_State *C, TValue *a, int lo, int up, SortLT lt) {
+    for (int i = lo + (up - lo - 1)/2; i >= lo; i--)
+        siftdown(C, a, lo, i, up, lt);
+    for (int i = up; i > lo; i--) {
+        swapvals(a, lo, i);
+        siftdown(C, a, lo, lo, i - 1, lt);
+    }
+}
+
+
+/*
+** Hoare partition around median of 'a[lo]', 'a[mid]' and 'a[up]'.
+** Scans are bounded, so an inconsistent order (NaN) cannot run
+** out of the subarray.
+*/
+static int partition(cs_State *C, TValue *a, int lo, int up, SortLT lt) {
+    int mid = lo + (up - lo)/2;
+    int i = lo, j = up - 1;
+    if (lt(C, &a[mid], &a[lo])) swapvals(a, mid, lo);
+    if (lt(C, &a[up], &a[mid])) {
+        swapvals(a, up, mid);
+        if (lt(C, &a[mid], &a[lo])) swapvals(a, mid, lo);
+    }
+    swapvals(a, mid, up - 1); /* pivot in 'a[up - 1]' */
+    for (;;) {
+        while (i < up - 1 && lt(C, &a[++i], &a[up - 1])) ;
+        while (j > lo && lt(C, &a[up - 1], &a[--j])) ;
+        if (j <= i) break;
+        swapvals(a, i, j);
+    }
+    swapvals(a, i, up - 1); /* put pivot in its final position */
+    return i;
+}
+
+
+static void introsort(cs_State *C, TValue *a, int lo, int up, int depth,
+                      SortLT lt) {
+    while (up - lo >= SORTTHRESHOLD) {
+        int p;
+        if (depth-- == 0) { /* too many bad partitions? */
+            heapsort(C, a, lo, up, lt);
+            return;
+        }
+        p = partition(C, a, lo, up, lt);
+        if (p - lo < up - p) { /* recurse into smaller half */
+            introsort(C, a, lo, p - 1, depth, lt);
+            lo = p + 1;
+        } else {
+            introsort(C, a, p + 1, up, depth, lt);
+            up = p - 1;
+        }
+    }
+    insertionsort(C, a, lo, up, lt);
+}
+
+
+/*
+** Sort 'arr' in place if all of its elements are numbers or all are
+** strings, using their raw order. Returns 0 (leaving 'arr' untouched)
+** if elements are of mixed or other types; those need the generic
+** sort that can call metamethods or a comparator.
+*/
+int csA_sort(cs_State *C, Array *arr) {
+    SortLT lt;
+    int allint = 1, allnum = 1, allstr = 1;
+    for (uint i = 0; i < arr->n; i++) {
+        const TValue *v = &arr->b[i];
+        allint &= ttisint(v);
+        allnum &= ttisnum(v);
+        allstr &= ttisstring(v);
+        if (!(allnum | allstr)) return 0; /* not homogeneous */
+    }
+    if (arr->n < 2) return 1; /* already sorted */
+    lt = (allint ? intlt : allnum ? numlt : strlt);
+    introsort(C, arr->b, 0, cast_int(arr->n) - 1,
+              2 * csO_ceillog2(arr->n), lt);
+    return 1;
+}
+
+/* }====================================================================== */
+
+
 void csA_free(cs_State *C, Array *arr) {
     csM_freearray(C, arr->b, arr->sz);
-    csM_free(C, arr);
+    csM_freeobj(C, arr, sizeof(*arr));
 }
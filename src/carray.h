@@ -20,6 +20,9 @@
 CSI_FUNC Array *csA_new(cs_State *C);
 CSI_FUNC void csA_shrink(cs_State *C, Array *arr);
 CSI_FUNC void csA_ensure(cs_State *C, Array *arr, int index);
+CSI_FUNC TValue *csA_insert(cs_State *C, Array *arr, int index);
+CSI_FUNC void csA_remove(Array *arr, int index);
+CSI_FUNC int csA_sort(cs_State *C, Array *arr);
 CSI_FUNC void csA_free(cs_State *C, Array *arr);
 
 #endif
@@ -8,10 +8,38 @@
 #define CS_LIB
 
 
+/*
+** @CS_USE_MMAP controls whether 'csL_loadfile' maps regular files
+** into memory (POSIX 'mmap') and hands the whole mapping to the
+** reader as a single block; without it files are always read in
+** 'BUFSIZ' chunks. A mapped file that is truncated by another process
+** while it is being loaded raises SIGBUS on access past its new end;
+** hosts that cannot tolerate that should build with 'CS_USE_MMAP' 0.
+*/
+#if !defined(CS_USE_MMAP)
+#if defined(__unix__) || defined(__APPLE__)
+#define CS_USE_MMAP     1
+#else
+#define CS_USE_MMAP     0
+#endif
+#endif
+
+
+#if CS_USE_MMAP && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE     200809L /* 'fileno', 'fstat' and 'mmap' */
+#endif
+
+
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if CS_USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include "cauxlib.h"
 #include "csconf.h"
 #include "cscript.h"
@@ -221,6 +249,8 @@ CSLIB_API const char *csL_opt_lstring(cs_State *C, int index, const char *dfl,
 typedef struct LoadFile {
     int n; /* number of pre-read characters */
     FILE *fp; /* file being read */
+    const char *map; /* mapped file contents (if any) */
+    size_t mapsz; /* size of 'map' */
     char buffer[BUFSIZ];
 } LoadFile;
 
@@ -228,7 +258,12 @@ typedef struct LoadFile {
 static const char *filereader(cs_State *C, void *data, size_t *szread) {
     LoadFile *fr = (LoadFile *)data;
     (void)C; /* unused */
-    if (fr->n > 0) { /* have pre-read characters ? */
+    if (fr->map != NULL) { /* whole file is mapped ? */
+        if (fr->n < 0) return NULL; /* already handed out */
+        fr->n = -1; /* mark it as consumed */
+        *szread = fr->mapsz;
+        return fr->map;
+    } else if (fr->n > 0) { /* have pre-read characters ? */
         *szread = fr->n;
         fr->n = 0;
     } else { /* read from a file */
@@ -251,11 +286,53 @@ static int errorfile(cs_State *C, const char *what, int filename_index) {
 }
 
 
-CSLIB_API int csL_loadfile(cs_State *C, const char *filename) {
+/*
+** Try mapping the file into memory; only regular files bigger than
+** the read buffer are mapped, smaller ones are cheaper to 'fread'.
+** Pipes, devices and other special files are never mapped, as their
+** size says nothing about what can be read. The mapping lives only
+** for the duration of 'cs_load' (see 'CS_USE_MMAP' about truncation).
+** On any failure 'lf->map' stays NULL and the file is read normally.
+*/
+static void mapfile(LoadFile *lf) {
+#if CS_USE_MMAP
+    struct stat st;
+    int fd = fileno(lf->fp);
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+            st.st_size > (off_t)sizeof(lf->buffer)) {
+        size_t sz = (size_t)st.st_size;
+        void *p = mmap(NULL, sz, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            lf->map = (const char *)p;
+            lf->mapsz = sz;
+        } else /* fall back to 'fread' */
+            errno = 0;
+    }
+#else
+    (void)lf; /* unused */
+#endif
+}
+
+
+static void unmapfile(LoadFile *lf) {
+#if CS_USE_MMAP
+    if (lf->map != NULL)
+        munmap((void *)lf->map, lf->mapsz);
+#else
+    (void)lf; /* unused */
+#endif
+}
+
+
+CSLIB_API int csL_loadfilex(cs_State *C, const char *filename,
+                            const char *mode) {
     LoadFile lf;
     int status, readstatus;
     int filename_index = cs_gettop(C) + 1;
     errno = 0;
+    lf.n = 0;
+    lf.map = NULL;
+    lf.mapsz = 0;
     if (filename == NULL) { /* stdin? */
         cs_push_string(C, "stdin");
         lf.fp = stdin;
@@ -264,11 +341,14 @@ CSLIB_API int csL_loadfile(cs_State *C, const char *filename) {
         lf.fp = fopen(filename, "r");
         if (lf.fp == NULL)
             return errorfile(C, "open", filename_index);
+        mapfile(&lf);
     }
-    status = cs_load(C, filereader, &lf, cs_to_string(C, -1));
+    status = cs_load(C, filereader, &lf, cs_to_string(C, -1), mode);
     readstatus = ferror(lf.fp);
-    if (filename) /* real file ? */
+    if (filename) { /* real file ? */
+        unmapfile(&lf);
         fclose(lf.fp); /* close it */
+    }
     if (readstatus) { /* error while reading */
         cs_setntop(C, filename_index); /* remove any results */
         return errorfile(C, "read", filename_index);
@@ -295,12 +375,12 @@ static const char *stringreader(cs_State *C, void *data, size_t *szread) {
 }
 
 
-CSLIB_API int csL_loadbuffer(cs_State *C, const char *buff, size_t sz,
-                             const char *name) {
+CSLIB_API int csL_loadbufferx(cs_State *C, const char *buff, size_t sz,
+                              const char *name, const char *mode) {
     LoadString ls;
     ls.sz = sz;
     ls.str = buff;
-    return cs_load(C, stringreader, &ls, name);
+    return cs_load(C, stringreader, &ls, name, mode);
 }
 
 
@@ -614,7 +694,13 @@ CSLIB_API void csL_checkversion_(cs_State *C, cs_Number ver) {
 ** Reference System
 ** ------------------------------------------------------------------------ */
 
-/* index of free-list header (after the predefined values) */
+/*
+** Index of free-list header (after the predefined values). Free
+** references form a list threaded through their own slots ('a[ref]'
+** holds the next free reference, 0 ends the list); when the list is
+** empty new references are appended at the end of the array, so both
+** operations take constant time.
+*/
 #define freelist    (CS_RINDEX_LAST + 1)
 
 CSLIB_API int csL_ref(cs_State *C, int a) {
@@ -637,7 +723,7 @@ CSLIB_API int csL_ref(cs_State *C, int a) {
         cs_get_index(C, a, ref); /* remove it from list */
         cs_set_index(C, a, freelist); /* (a[freelist] = a[ref]) */
     } else /* no free elements */
-        ref = (int)cs_get_nilindex(C, a, freelist+1, 0); /* get a new ref */
+        ref = (int)cs_len(C, a); /* append a new ref */
     cs_set_index(C, a, ref);
     return ref;
 }
@@ -65,10 +65,14 @@ CSLIB_API const char *csL_opt_lstring(cs_State *C, int index, const char *dfl,
 /* ------------------------------------------------------------------------ 
 ** Chunk loading
 ** ------------------------------------------------------------------------ */
-CSLIB_API int csL_loadfile(cs_State *C, const char *filename);
+CSLIB_API int csL_loadfilex(cs_State *C, const char *filename,
+                            const char *mode);
 CSLIB_API int csL_loadstring(cs_State *C, const char *s);
-CSLIB_API int csL_loadbuffer(cs_State *C, const char *buff, size_t sz,
-                             const char *name);
+CSLIB_API int csL_loadbufferx(cs_State *C, const char *buff, size_t sz,
+                              const char *name, const char *mode);
+
+#define csL_loadfile(C,f)           csL_loadfilex(C, f, NULL)
+#define csL_loadbuffer(C,b,sz,n)    csL_loadbufferx(C, b, sz, n, NULL)
 
 /* ------------------------------------------------------------------------ 
 ** Miscellaneous functions
@@ -103,10 +103,10 @@ static int b_gc(cs_State *C) {
 
 /*
 ** Reserved slot, above all arguments, to hold a copy of the returned
-** string to avoid it being collected while parsed. 'load' has two
-** optional arguments (chunk and source name).
+** string to avoid it being collected while parsed. 'load' has three
+** arguments (chunk and optional source name and mode).
 */
-#define RESERVEDSLOT  2
+#define RESERVEDSLOT  3
 
 
 static const char *loadreader(cs_State *C, void *ud, size_t *sz) {
@@ -141,13 +141,15 @@ static int b_load(cs_State *C) {
     size_t sz;
     const char *chunkname;
     const char *chunk = cs_to_lstring(C, 0, &sz);
+    const char *mode = csL_opt_string(C, 2, NULL);
     if (chunk != NULL) { /* 'chunk' is a string? */
         chunkname = csL_opt_string(C, 1, chunk);
-        status = csL_loadbuffer(C, chunk, sz, chunkname);
+        status = csL_loadbufferx(C, chunk, sz, chunkname, mode);
     } else { /* 'chunk' is not a string */
         chunkname = csL_opt_string(C, 1, "(load)");
         csL_check_type(C, 0, CS_TFUNCTION); /* 'chunk' must be a function */
-        status = cs_load(C, loadreader, NULL, chunkname);
+        cs_setntop(C, RESERVEDSLOT + 1); /* create reserved slot */
+        status = cs_load(C, loadreader, NULL, chunkname, mode);
     }
     return auxload(C, status);
 }
@@ -155,7 +157,8 @@ static int b_load(cs_State *C) {
 
 static int b_loadfile(cs_State *C) {
     const char *filename = csL_opt_string(C, 0, NULL);
-    int status = csL_loadfile(C, filename);
+    const char *mode = csL_opt_string(C, 1, NULL);
+    int status = csL_loadfilex(C, filename, mode);
     return auxload(C, status);
 }
 
@@ -189,23 +192,20 @@ static int b_getmetamethod(cs_State *C) {
 }
 
 
-static int b_next(cs_State *C) {
-    int tt = cs_type(C, 0);
-    csL_expect_arg(C, (tt == CS_TINSTANCE || tt == CS_TTABLE), 0,
-                       "instance or table");
-    cs_setntop(C, 2); /* if 2nd argument is missing create it */
-    if (cs_next(C, 0)) { /* found field? */
-        return 2; /* key (index) + value */
-    } else {
-        cs_push_nil(C);
-        return 1;
-    }
+static int b_setmode(cs_State *C) {
+    static const char *const opts[] = {"", "k", "v", "kv", NULL};
+    int mode;
+    csL_check_type(C, 0, CS_TTABLE);
+    mode = csL_check_option(C, 1, "", opts);
+    cs_set_mode(C, 0, opts[mode]);
+    cs_setntop(C, 1);
+    return 1; /* return the table */
 }
 
 
 static int b_pairs(cs_State *C) {
     csL_check_any(C, 0);
-    cs_push_cfunction(C, b_next);    /* will return generator, */
+    cs_push_next(C);                   /* will return generator, */
     cs_push(C, 0);                     /* state, */
     cs_push_nil(C);                    /* and initial value */
     return 3;
@@ -246,7 +246,7 @@ static int b_pcall(cs_State *C) {
     csL_check_any(C, 0);
     cs_push_bool(C, 1); /* first result if no errors */
     cs_insert(C, 0); /* insert it before the object being called */
-    status = cs_pcall(C, cs_nvalues(C) - 2, CS_MULRET, 0);
+    status = cs_pcall(C, cs_nvalues(C) - 2, CS_MULRET, -1);
     return finishpcall(C, status, 0);
 }
 
@@ -506,7 +506,7 @@ static int b_tostring(cs_State *C) {
 static int b_typeof(cs_State *C) {
     int tt = cs_type(C, 0);
     csL_check_arg(C, tt != CS_TNONE, 0, "value expected");
-    cs_push_string(C, cs_typename(C, 0));
+    cs_push_string(C, cs_typename(C, tt));
     return 1;
 }
 
@@ -519,7 +519,7 @@ static const cs_Entry basic_funcs[] = {
     {"loadfile", b_loadfile},
     {"runfile", b_runfile},
     {"getmetamethod", b_getmetamethod},
-    {"next", b_next},
+    {"setmode", b_setmode},
     {"pairs", b_pairs},
     {"ipairs", b_ipairs},
     {"pcall", b_pcall},
@@ -535,6 +535,7 @@ static const cs_Entry basic_funcs[] = {
     {"tostring", b_tostring},
     {"typeof", b_typeof},
     /* placeholders */
+    {"next", NULL},
     {CS_GNAME, NULL},
     {"__VERSION", NULL},
     {NULL, NULL},
@@ -548,6 +549,9 @@ CSMOD_API int csopen_basic(cs_State *C) {
     /* set global __G */
     cs_push(C, -1);
     cs_set_fieldstr(C, -2, CS_GNAME);
+    /* set global next */
+    cs_push_next(C);
+    cs_set_fieldstr(C, -2, "next");
     /* set global __VERSION */
     cs_push_literal(C, CS_VERSION);
     cs_set_global(C, "__VERSION");
@@ -20,6 +20,8 @@
 #include "cgc.h"
 #include "cmem.h"
 
+#include <string.h>
+
 
 /* check if 'ExpInfo' has jumps */
 #define hasjumps(e)     ((e)->t != (e)->f)
@@ -27,7 +29,7 @@
 
 /* unary 'opr' to opcode */
 #define unopr2op(opr) \
-        cast(OpCode, cast_int(opr) - OPR_UNM + OP_NOT)
+        cast(OpCode, cast_int(opr) - OPR_UNM + OP_UNM)
 
 
 /* binary operation to OpCode */
@@ -71,7 +73,7 @@ CSI_DEF const c_byte csC_opProp[NUM_OPCODES] = {
     opProp(0, FormatIL), /* OP_CLOSURE */
     opProp(0, FormatIS), /* OP_NEWARRAY */
     opProp(0, FormatIS), /* OP_NEWCLASS */
-    opProp(0, FormatIS), /* OP_NEWTABLE */
+    opProp(0, FormatISS), /* OP_NEWTABLE */
     opProp(0, FormatIL), /* OP_METHOD */
     opProp(0, FormatIS), /* OP_SETMM */
     opProp(0, FormatI), /* OP_POP */
@@ -124,9 +126,12 @@ CSI_DEF const c_byte csC_opProp[NUM_OPCODES] = {
     opProp(0, FormatI), /* OP_NOT */
     opProp(0, FormatI), /* OP_UNM */
     opProp(0, FormatI), /* OP_BNOT */
+    opProp(0, FormatI), /* OP_FLOOR */
+    opProp(0, FormatI), /* OP_ABS */
     opProp(1, FormatIL), /* OP_JMP */
     opProp(1, FormatIL), /* OP_JMPS */
     opProp(1, FormatILL), /* OP_BJMP */
+    opProp(0, FormatIL), /* OP_SWITCH */
     opProp(1, FormatILS), /* OP_TEST */
     opProp(1, FormatILS), /* OP_TESTORPOP */
     opProp(1, FormatILS), /* OP_TESTANDPOP */
@@ -141,6 +146,7 @@ CSI_DEF const c_byte csC_opProp[NUM_OPCODES] = {
     opProp(0, FormatIL), /* OP_GETUVAL */
     opProp(0, FormatIL), /* OP_SETUVAL */
     opProp(0, FormatILS), /* OP_SETARRAY */
+    opProp(0, FormatIS), /* OP_SETFIELDS */
     opProp(0, FormatILL), /* OP_SETPROPERTY */
     opProp(0, FormatIL), /* OP_GETPROPERTY */
     opProp(0, FormatI), /* OP_GETINDEX */
@@ -204,9 +210,10 @@ CSI_DEF const char *csC_opName[NUM_OPCODES] = { /* ORDER OP */
     "BANDI", "BORI", "BXORI", "ADD", "SUB", "MUL", "DIV", "MOD", "POW",
     "BSHL", "BSHR", "BAND", "BOR", "BXOR", "CONCAT", "EQK", "EQI", "LTI",
     "LEI", "GTI", "GEI", "EQ", "LT", "LE", "EQPRESERVE", "NOT", "UNM",
-    "BNOT", "JMP", "JMPS", "BJMP", "TEST", "TESTORPOP", "TESTANDPOP",
-    "TESTPOP", "CALL", "CLOSE", "TBC", "GETGLOBAL", "SETGLOBAL",
-    "GETLOCAL", "SETLOCAL", "GETUVAL", "SETUVAL", "SETARRAY", "SETPROPERTY",
+    "BNOT", "FLOOR", "ABS", "JMP", "JMPS", "BJMP", "SWITCH", "TEST",
+    "TESTORPOP", "TESTANDPOP", "TESTPOP", "CALL", "CLOSE", "TBC", "GETGLOBAL", "SETGLOBAL",
+    "GETLOCAL", "SETLOCAL", "GETUVAL", "SETUVAL", "SETARRAY", "SETFIELDS",
+    "SETPROPERTY",
     "GETPROPERTY", "GETINDEX", "SETINDEX", "GETINDEXSTR", "SETINDEXSTR",
     "GETINDEXINT", "SETINDEXINT", "GETSUP", "GETSUPIDX", "GETSUPIDXSTR",
     "INHERIT", "FORPREP", "FORCALL", "FORLOOP", "RET",
@@ -219,38 +226,37 @@ CSI_DEF const char *csC_opName[NUM_OPCODES] = { /* ORDER OP */
 
 /*
 ** Save line info for new instruction. We only store difference
-** from the previous line in a singed byte array 'lineinfo' for each
-** instruction. Storing only the difference makes it easier to fit this
-** information in a single signed byte and save memory. In cases where the
+** from the previous line in a singed byte array 'lineinfo', one entry
+** per instruction (not per byte of code), as instruction boundaries
+** can always be recovered from the code itself. In cases where the
 ** difference of lines is too large to fit in a 'c_sbyte', or the MAXIWTHABS
 ** limit is reached, we store absolute line information which is held in
-** 'abslineinfo' array. When we do store absolute line info, we also
-** indicate the corresponding 'lineinfo' entry with special value ABSLINEINFO,
-** which tells us there is absolute line information for this instruction.
+** 'abslineinfo' array, keyed by the byte offset of the instruction
+** together with its index in 'lineinfo'. When we do store absolute line
+** info, we also indicate the corresponding 'lineinfo' entry with special
+** value ABSLINEINFO.
 **
-** Complexity of lookup in turn is something along the lines of O(n/k+k),
-** where n is the number of instructions and k is a constant MAXIWTHABS.
-** However this approximation does not take into consideration LIMLINEDIFF
-** and assumes we do not have cases where the line difference is too high.
+** Complexity of lookup in turn is O(log(n/k) + k), where n is the number
+** of instructions and k is a constant MAXIWTHABS: binary search in
+** 'abslineinfo' followed by a linear walk of at most k instructions.
 */
 static void savelineinfo(FunctionState *fs, Proto *p, int line) {
     int linedif = line - fs->prevline;
     int pc = fs->prevpc; /* last coded instruction */
-    int opsize = getOpSize(p->code[pc]); /* size of last coded instruction */
-    cs_assert(pc < currPC); /* must of emitted instruction */
+    int idx = fs->ninstr - 1; /* its 'lineinfo' index */
+    cs_assert(pc < currPC && idx >= 0); /* must of emitted instruction */
     if (c_abs(linedif) >= LIMLINEDIFF || fs->iwthabs++ >= MAXIWTHABS) {
+        AbsLineInfo *abs;
         csM_growarray(fs->lx->C, p->abslineinfo, p->sizeabslineinfo,
                       fs->nabslineinfo, MAXINT, "lines", AbsLineInfo);
-        p->abslineinfo[fs->nabslineinfo].pc = pc;
-        p->abslineinfo[fs->nabslineinfo++].line = line;
+        abs = &p->abslineinfo[fs->nabslineinfo++];
+        abs->pc = pc;
+        abs->idx = idx;
+        abs->line = line;
         linedif = ABSLINEINFO; /* signal the absolute line info entry */
         fs->iwthabs = 1; /* reset counter */
     }
-    csM_ensurearray(fs->lx->C, p->lineinfo, p->sizelineinfo, pc, opsize,
-                    MAXINT, "opcodes", c_sbyte);
-    p->lineinfo[pc] = linedif;
-    while (--opsize) /* fill func args (if any) */
-        p->lineinfo[++pc] = ARGLINEINFO;
+    p->lineinfo[idx] = linedif;
     fs->prevline = line; /* last line saved */
 }
 
@@ -263,29 +269,37 @@ static void savelineinfo(FunctionState *fs, Proto *p, int line) {
 */
 static void removelastlineinfo(FunctionState *fs) {
     Proto *p = fs->p;
-    int pc = fs->prevpc;
-    if (p->lineinfo[pc] != ABSLINEINFO) { /* relative line info? */
-        cs_assert(p->lineinfo[pc] >= 0); /* must have valid offset */
-        fs->prevline -= p->lineinfo[pc]; /* fix last line saved */
+    int idx = fs->ninstr - 1;
+    if (p->lineinfo[idx] != ABSLINEINFO) { /* relative line info? */
+        fs->prevline -= p->lineinfo[idx]; /* fix last line saved */
         fs->iwthabs--; /* undo previous increment */
     } else { /* otherwise absolute line info */
-        cs_assert(p->abslineinfo[fs->nabslineinfo - 1].pc == pc);
+        cs_assert(p->abslineinfo[fs->nabslineinfo - 1].pc == fs->prevpc);
         fs->nabslineinfo--; /* remove it */
         fs->iwthabs = MAXIWTHABS + 1; /* force next line info to be absolute */
     }
 }
 
 
-static void removeinstpc(FunctionState *fs) {
-    Proto *p = fs->p;
-    int pc = check_exp(fs->ninstpc > 0, p->instpc[--fs->ninstpc]);
-    currPC = pc;
-    if (fs->ninstpc > 0)
-        fs->prevpc = p->instpc[fs->ninstpc - 1];
-    else {
-        fs->prevpc = pc;
-        cs_assert(currPC == 0);
+/*
+** Find the pc of the instruction preceding the one at 'pc', by walking
+** the code forward from the last absolute line info entry before it
+** (there are at most MAXIWTHABS instructions in between).
+*/
+static int previnstpc(FunctionState *fs, int pc) {
+    const Proto *p = fs->p;
+    int i = fs->nabslineinfo;
+    int prev = 0;
+    while (i > 0 && p->abslineinfo[i - 1].pc >= pc)
+        i--; /* skip entries at or after 'pc' */
+    if (i > 0) prev = p->abslineinfo[i - 1].pc;
+    for (;;) {
+        int next = prev + getOpSize(p->code[prev]);
+        if (next >= pc) break;
+        prev = next;
     }
+    cs_assert(prev + getOpSize(p->code[prev]) == pc);
+    return prev;
 }
 
 
@@ -294,8 +308,14 @@ static void removeinstpc(FunctionState *fs) {
 ** accordingly.
 */
 static void removelastinstruction(FunctionState *fs) {
+    int pc = fs->prevpc;
     removelastlineinfo(fs);
-    removeinstpc(fs);
+    cs_assert(fs->ninstr > 0);
+    currPC = pc;
+    if (--fs->ninstr > 0)
+        fs->prevpc = previnstpc(fs, pc);
+    else
+        cs_assert(currPC == 0 && fs->prevpc == 0);
 }
 
 
@@ -335,16 +355,12 @@ static void emit3bytes(FunctionState *fs, int code) {
 }
 
 
-static void addinstpc(FunctionState *fs) {
-    Proto *p = fs->p;
-    csM_growarray(fs->lx->C, p->instpc, p->sizeinstpc, fs->ninstpc, MAXINT,
-                  "code", int);
-    fs->prevpc = p->instpc[fs->ninstpc++] = currPC;
-}
-
-
 static int codeinstruction(FunctionState *fs, Instruction i) {
-    addinstpc(fs);
+    Proto *p = fs->p;
+    csM_growarray(fs->lx->C, p->lineinfo, p->sizelineinfo, fs->ninstr,
+                  MAXINT, "opcodes", c_sbyte);
+    fs->ninstr++;
+    fs->prevpc = currPC;
     emitbyte(fs, i);
     savelineinfo(fs, fs->p, fs->lx->lastline);
     return currPC - 1;
@@ -385,6 +401,15 @@ int csC_emitIS(FunctionState *fs, Instruction i, int a) {
 }
 
 
+/* code instruction with 2 short args */
+int csC_emitISS(FunctionState *fs, Instruction i, int a, int b) {
+    int offset = csC_emitI(fs, i);
+    emitS(fs, a);
+    emitS(fs, b);
+    return offset;
+}
+
+
 /* code instruction 'i' with long arg 'a' */
 int csC_emitIL(FunctionState *fs, Instruction i, int a) {
     int offset = csC_emitI(fs, i);
@@ -564,20 +589,18 @@ void csC_setreturns(FunctionState *fs, ExpInfo *e, int nreturns) {
 
 static int adjuststack(FunctionState *fs, OpCode op, int n) {
     Instruction *inst = &prevOP(fs);
+    int ispop = (op == OP_POP || op == OP_POPN);
     int prevn = 0;
-    switch (*inst) {
+    /* (no previous instruction or it is not reachable only from above) */
+    switch (fs->ninstr > 0 && fs->lasttarget != currPC ? *inst : NUM_OPCODES) {
         case OP_POPN: case OP_NILN: {
+            if ((*inst == OP_POPN) != ispop) break; /* different adjustment */
             prevn = GETARG_L(inst, 0);
             SETARG_L(inst, 0, n + prevn);
             return fs->prevpc; /* done; do not code new instruction */
         }
-        case OP_POP: {
-            op = OP_POPN;
-            goto nil;
-        }
-        case OP_NIL: {
-            op = OP_NILN;
-nil:
+        case OP_POP: case OP_NIL: {
+            if ((*inst == OP_POP) != ispop) break; /* different adjustment */
             prevn = 1;
             removelastinstruction(fs);
             break;
@@ -585,13 +608,10 @@ nil:
         default: break; /* nothing to be done */
     }
     n += prevn;
-    if (n == 1) {
-        cs_assert(op == OP_NIL || op == OP_POP);
-        return csC_emitI(fs, op);
-    } else {
-        cs_assert(op == OP_NILN || op == OP_POPN);
-        return csC_emitIL(fs, op, n);
-    }
+    if (n == 1)
+        return csC_emitI(fs, ispop ? OP_POP : OP_NIL);
+    else
+        return csC_emitIL(fs, ispop ? OP_POPN : OP_NILN, n);
 }
 
 
@@ -738,9 +758,66 @@ int csC_storevar(FunctionState *fs, ExpInfo *var, int left) {
 }
 
 
+/* get the value of compile-time constant variable 'e' */
+static TValue *const2val(FunctionState *fs, const ExpInfo *e) {
+    cs_assert(e->et == EXP_CONST);
+    return &fs->lx->ps->actlocals.arr[e->u.info].val;
+}
+
+
+/* convert constant value 'v' into expression 'e' */
+static void const2exp(const TValue *v, ExpInfo *e) {
+    switch (ttypetag(v)) {
+        case CS_VNUMINT: e->et = EXP_INT; e->u.i = ival(v); break;
+        case CS_VNUMFLT: e->et = EXP_FLT; e->u.n = fval(v); break;
+        case CS_VFALSE: e->et = EXP_FALSE; break;
+        case CS_VTRUE: e->et = EXP_TRUE; break;
+        case CS_VNIL: e->et = EXP_NIL; break;
+        case CS_VSHRSTR: case CS_VLNGSTR: {
+            e->et = EXP_STRING;
+            e->u.str = strval(v);
+            break;
+        }
+        default: cs_assert(0);
+    }
+}
+
+
+/*
+** If 'e' is a compile-time constant variable, replace it with its
+** value so that it takes part in constant folding.
+*/
+void csC_const2exp(FunctionState *fs, ExpInfo *e) {
+    if (e->et == EXP_CONST)
+        const2exp(const2val(fs, e), e);
+}
+
+
+/*
+** Try to get the compile-time value of expression 'e' into 'v';
+** returns 0 if 'e' is not a constant.
+*/
+int csC_exp2const(FunctionState *fs, ExpInfo *e, TValue *v) {
+    if (hasjumps(e))
+        return 0; /* not a constant */
+    else if (e->et == EXP_CONST) {
+        setobj(fs->lx->C, v, const2val(fs, e));
+        return 1;
+    } else if (eisconstant(e)) {
+        csC_constexp2val(fs, e, v);
+        return 1;
+    } else
+        return 0;
+}
+
+
 /* ensure variable is on stack */
 static int dischargevars(FunctionState *fs, ExpInfo *e) {
     switch (e->et) {
+        case EXP_CONST: {
+            const2exp(const2val(fs, e), e);
+            return 0; /* it is a constant now */
+        }
         case EXP_GLOBAL: {
             e->u.info = csC_emitIL(fs, OP_GETGLOBAL, stringK(fs, e->u.str));
             break;
@@ -847,9 +924,19 @@ void csC_patch(FunctionState *fs, int pc, int target) {
 }
 
 
+/*
+** Mark current position as a jump target and return it; instructions
+** coded from here on must not be merged with the previous ones.
+*/
+int csC_getlabel(FunctionState *fs) {
+    fs->lasttarget = currPC;
+    return currPC;
+}
+
+
 /* backpatch jump instruction to current pc */
 void csC_patchtohere(FunctionState *fs, int pc) {
-    csC_patch(fs, pc, currPC);
+    csC_patch(fs, pc, csC_getlabel(fs));
 }
 
 
@@ -969,6 +1056,13 @@ void csC_setarray(FunctionState *fs, int nelems, int tostore) {
 }
 
 
+void csC_setfields(FunctionState *fs, int tostore) {
+    cs_assert(0 < tostore && tostore <= TABFIELDS_PER_FLUSH);
+    csC_emitIS(fs, OP_SETFIELDS, tostore);
+    freeslots(fs, 2 * tostore); /* free slots holding keys and values */
+}
+
+
 void csC_settablesize(FunctionState *fs, int pc, int hsize) {
     Instruction *inst = &fs->p->code[pc];
     hsize = (hsize != 0 ? csO_ceillog2(hsize) + 1 : 0);
@@ -1172,8 +1266,12 @@ void csC_unary(FunctionState *fs, ExpInfo *e, Unopr uopr, int line) {
 
 /* code test jump instruction */
 static int codetest(FunctionState *fs, ExpInfo *e, OpCode testop, int cond) {
+    int pc;
     exp2stack(fs, e); /* ensure test operand is on the stack */
-    return csC_emitILS(fs, testop, 0, cond);
+    pc = csC_emitILS(fs, testop, 0, cond);
+    if (testop == OP_TESTORPOP) /* operand is popped when not jumping? */
+        freeslots(fs, 1); /* second operand takes its place */
+    return pc;
 }
 
 
@@ -1215,7 +1313,10 @@ void falsejmp(FunctionState *fs, ExpInfo *e, OpCode testop) {
         }
     }
     csC_concatjl(fs, &e->f, pc); /* insert new jump in false list */
-    csC_patchtohere(fs, e->t); /* true list jumps to here (after false test) */
+    if (pc != NOJMP) /* true values must also be tested (and popped)? */
+        csC_patch(fs, e->t, pc); /* true list jumps to the new test */
+    else
+        csC_patchtohere(fs, e->t); /* true list jumps to here */
     e->t = NOJMP; /* set true list as empty */
 }
 
@@ -1238,7 +1339,10 @@ void truejmp(FunctionState *fs, ExpInfo *e, OpCode testop) {
         }
     }
     csC_concatjl(fs, &e->t, pc); /* insert new jump in true list */
-    csC_patchtohere(fs, e->f); /* false list jump to here (after true test) */
+    if (pc != NOJMP) /* false values must also be tested (and popped)? */
+        csC_patch(fs, e->f, pc); /* false list jumps to the new test */
+    else
+        csC_patchtohere(fs, e->f); /* false list jumps to here */
     e->f = NOJMP; /* set false list as empty */
 }
 
@@ -1248,14 +1352,20 @@ void csC_prebinary(FunctionState *fs, ExpInfo *e, Binopr op) {
         case OPR_ADD: case OPR_SUB: case OPR_MUL:
         case OPR_DIV: case OPR_MOD: case OPR_POW:
         case OPR_SHL: case OPR_SHR: case OPR_BAND:
-        case OPR_BOR: case OPR_BXOR: case OPR_NE:
-        case OPR_EQ: {
+        case OPR_BOR: case OPR_BXOR: {
             if (!tonumeral(e, NULL))
                 csC_exp2stack(fs, e);
             /* otherwise keep numeral for constant
              * or immediate operand variant instruction */
             break;
         }
+        case OPR_NE: case OPR_EQ: {
+            if (!eisconstant(e) || hasjumps(e))
+                csC_exp2stack(fs, e);
+            /* otherwise keep constant for folding or for
+             * constant or immediate operand variant instruction */
+            break;
+        }
         case OPR_GT: case OPR_GE: {
             /* Do not push expression value on the stack yet!
              * It will swap places with the second expression. */
@@ -1270,7 +1380,13 @@ void csC_prebinary(FunctionState *fs, ExpInfo *e, Binopr op) {
             break;
         }
         case OPR_CONCAT: {
-            csC_exp2stack(fs, e); /* operand must be on stack */
+            if (e->et == EXP_STRING && !hasjumps(e)) { /* string constant? */
+                OString *s = e->u.str;
+                csC_exp2stack(fs, e); /* load it... */
+                e->et = EXP_STRING; /* ...but remember it for folding */
+                e->u.str = s;
+            } else
+                csC_exp2stack(fs, e); /* operand must be on stack */
             break;
         }
         case OPR_AND: {
@@ -1402,14 +1518,14 @@ static void codeeq(FunctionState *fs, ExpInfo *e1, ExpInfo *e2, Binopr opr) {
     int iseq = (opr == OPR_EQ);
     cs_assert(opr == OPR_NE || opr == OPR_EQ);
     UNUSED(isflt);
-    if (e1->et != EXP_FINEXPR) {
-        /* 'e1' is either a numerical or stored string constant */
-        cs_assert(e1->et == EXP_K || e1->et == EXP_INT || e1->et == EXP_FLT);
+    if (e1->et != EXP_FINEXPR) { /* 'e1' is a constant? */
+        cs_assert(eisconstant(e1));
         swapexp(e1, e2);
     }
     csC_exp2stack(fs, e1); /* ensure 1st expression is on stack */
     if (isnumKL(e2, &imm, &isflt)) { /* 2nd expression is immediate operand? */
-        e1->u.info = emitILSS(fs, OP_EQI, imm, encodesign(imm), iseq);
+        e1->u.info = emitILSS(fs, OP_EQI, c_abs(imm), encodesign(imm),
+                                 iseq);
     } else if (exp2K(fs, e2)) { /* 2nd expression is a constant? */
         e1->u.info = csC_emitILS(fs, OP_EQK, e2->u.info, iseq);
     } else { /* otherwise 2nd expression must be on stack */
@@ -1435,7 +1551,7 @@ static void codeorder(FunctionState *fs, ExpInfo *e1, ExpInfo *e2, Binopr opr) {
         csC_exp2stack(fs, e2); /* ensure 'e2' is on stack */
         op = binopr2op(opr, OPR_LT, OP_GTI);
 code:
-        e1->u.info = csC_emitILS(fs, op, imm, encodesign(imm));
+        e1->u.info = csC_emitILS(fs, op, c_abs(imm), encodesign(imm));
     } else {
         csC_exp2stack(fs, e1); /* ensure first operand is on stack */
         csC_exp2stack(fs, e2); /* ensure second operand is on stack */
@@ -1452,6 +1568,71 @@ static Instruction *previousinstruction(FunctionState *fs) {
 }
 
 
+/*
+** Fold comparison of constants 'e1' and 'e2'; equality is folded for
+** any constants, ordering only for numbers (as that can not invoke
+** metamethods or raise errors).
+*/
+static int foldcompare(FunctionState *fs, ExpInfo *e1, ExpInfo *e2,
+                       Binopr opr) {
+    cs_State *C = fs->lx->C;
+    TValue v1, v2;
+    int res;
+    if (!csC_exp2const(fs, e1, &v1) || !csC_exp2const(fs, e2, &v2))
+        return 0;
+    switch (opr) {
+        case OPR_EQ: res = csV_raweq(&v1, &v2); break;
+        case OPR_NE: res = !csV_raweq(&v1, &v2); break;
+        default: {
+            if (!ttisnum(&v1) || !ttisnum(&v2))
+                return 0;
+            switch (opr) {
+                case OPR_LT: res = csV_orderlt(C, &v1, &v2); break;
+                case OPR_LE: res = csV_orderle(C, &v1, &v2); break;
+                case OPR_GT: res = csV_orderlt(C, &v2, &v1); break;
+                case OPR_GE: res = csV_orderle(C, &v2, &v1); break;
+                default: cs_assert(0); return 0;
+            }
+        }
+    }
+    e1->et = (res ? EXP_TRUE : EXP_FALSE);
+    return 1;
+}
+
+
+/*
+** Fold concatenation of string constants. 'e1' was loaded by
+** 'csC_prebinary' and, as 'e2' is a constant, that load is still the
+** last instruction; it is removed and the result is kept as a new
+** string constant, so constant chains end up as a single load.
+*/
+static int foldconcat(FunctionState *fs, ExpInfo *e1, ExpInfo *e2) {
+    Instruction *inst = previousinstruction(fs);
+    if (e1->et == EXP_STRING && e2->et == EXP_STRING && !hasjumps(e2) &&
+            (*inst == OP_CONST || *inst == OP_CONSTL)) {
+        Lexer *lx = fs->lx;
+        int k = (*inst == OP_CONST ? GETARG_S(inst, 0) : GETARG_L(inst, 0));
+        OString *s1 = e1->u.str;
+        OString *s2 = e2->u.str;
+        size_t l1 = getstrlen(s1);
+        size_t l2 = getstrlen(s2);
+        Buffer *b = lx->buff; /* (free; next token is already scanned) */
+        if (!ttisstring(&fs->p->k[k]) || strval(&fs->p->k[k]) != s1)
+            return 0; /* last instruction does not load 'e1' */
+        if (csR_buffsize(b) < l1 + l2)
+            csR_buffresize(lx->C, b, l1 + l2);
+        memcpy(csR_buff(b), getstr(s1), l1);
+        memcpy(csR_buff(b) + l1, getstr(s2), l2);
+        removelastinstruction(fs);
+        freeslots(fs, 1); /* 'e1' */
+        e1->u.str = csY_newstring(lx, csR_buff(b), l1 + l2);
+        csR_buffreset(b);
+        return 1;
+    }
+    return 0;
+}
+
+
 static void codeconcat(FunctionState *fs, ExpInfo *e1, ExpInfo *e2, int line) {
     Instruction *inst = previousinstruction(fs);
     UNUSED(e2);
@@ -1471,6 +1652,8 @@ void csC_binary(FunctionState *fs, ExpInfo *e1, ExpInfo *e2, Binopr opr,
                 int line) {
     if (oprisfoldable(opr) && constfold(fs, e1, e2, opr + CS_OPADD))
         return; /* done (folded) */
+    if (opriscompare(opr) && foldcompare(fs, e1, e2, opr))
+        return; /* done (folded) */
     switch (opr) {
         case OPR_ADD: case OPR_MUL:
         case OPR_BAND: case OPR_BOR: case OPR_BXOR: {
@@ -1486,6 +1669,9 @@ void csC_binary(FunctionState *fs, ExpInfo *e1, ExpInfo *e2, Binopr opr,
             break;
         }
         case OPR_CONCAT: {
+            if (foldconcat(fs, e1, e2))
+                break; /* folded */
+            e1->et = EXP_FINEXPR; /* (already on stack) */
             csC_exp2stack(fs, e2); /* second operand must be on stack */
             codeconcat(fs, e1, e2, line);
             break;
@@ -1505,14 +1691,14 @@ void csC_binary(FunctionState *fs, ExpInfo *e1, ExpInfo *e2, Binopr opr,
         }
         case OPR_AND: {
             cs_assert(e1->t == NOJMP); /* list closed by 'csC_prebinary' */
-            dischargevars(fs, e2);
+            exp2stack(fs, e2); /* takes the slot freed by the test */
             csC_concatjl(fs, &e2->f, e1->f);
             *e1 = *e2;
             break;
         }
         case OPR_OR: {
             cs_assert(e1->f == NOJMP); /* list closed by 'csC_prebinary' */
-            dischargevars(fs, e2);
+            exp2stack(fs, e2); /* takes the slot freed by the test */
             csC_concatjl(fs, &e2->t, e1->t);
             *e1 = *e2;
             break;
@@ -1557,6 +1743,8 @@ void csC_finish(FunctionState *fs) {
             /* TODO: finaltarget the OP_BJMP and accumulate npop */
             case OP_JMP: case OP_JMPS: { /* avoid jumps to jumps */
                 int target = finaltarget(p->code, i);
+                /* final target can be on the other side of the jump */
+                *pc = (target < i + getOpSize(*pc)) ? OP_JMPS : OP_JMP;
                 fixjump(fs, i, target);
                 break;
             }
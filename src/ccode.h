@@ -95,6 +95,9 @@ typedef enum {
 /* true if binary operator 'op' is foldable (it is arithmetic or bitwise) */
 #define oprisfoldable(op)      ((op) <= OPR_BXOR)
 
+/* true if binary operator 'op' is a comparison */
+#define opriscompare(op)       (OPR_NE <= (op) && (op) <= OPR_GE)
+
 
 /* unary operators */
 typedef enum { OPR_UNM, OPR_BNOT, OPR_NOT, OPR_NOUNOPR } Unopr;
@@ -115,6 +118,7 @@ typedef enum { /* ORDER OP */
 ** OU{x} - open upvalue at index 'x'
 ** G{x} - global variable, key is K{x}:string
 ** L{x} - local variable in 'p->locals[x]'
+** SW{x} - jump table in 'p->swtabs[x]'
 **
 ** operation     args           description
 ** ------------------------------------------------------------------------ */
@@ -131,7 +135,7 @@ OP_VARARG,/*       L          'load L-1 varargs'                            */
 OP_CLOSURE,/*      L          'load closure(Enclosing->fns[L])'             */
 OP_NEWARRAY,/*     S          'create and load new array of size 1<<(S-1)'  */
 OP_NEWCLASS,/*                'create and load new class'                   */
-OP_NEWTABLE,/*     S          'create and load new table of size 1<<(S-1)'  */
+OP_NEWTABLE,/*     S1 S2      'create and load new table of size 1<<(S1-1)'*/
 OP_METHOD,/*       L V1 V2    'define method V2 for class V1 under key K{L}'*/
 OP_SETMM,/*        S V1 V2    'V1->vmt[S] = V2' (see notes)                 */
 OP_POP,/*                     'pop value off the stack'                     */
@@ -195,9 +199,13 @@ OP_NOT,/*          V       '!V'                                             */
 OP_UNM,/*          V       '-V'                                             */
 OP_BNOT,/*         V       '~V'                                             */
 
+OP_FLOOR,/*        V       'math.floor(V)' (intrinsic)                      */
+OP_ABS,/*          V       'math.abs(V)' (intrinsic)                        */
+
 OP_JMP,/*          L       'pc += L'                                        */
 OP_JMPS,/*         L       'pc -= L'                                        */
 OP_BJMP,/*         L1 L2   'pc += L1; pop(L2)'                              */
+OP_SWITCH,/*       V L     'pc = SW{L}[V]'                                  */
 
 OP_TEST,/*         V L S   'if (!c_isfalse(V) == S) pc += L'                */
 OP_TESTORPOP,/*    V L S   'if (!c_isfalse(V) == S) pc += L; else pop V;'   */
@@ -220,6 +228,7 @@ OP_GETUVAL,/*      L           'U{L}'                                       */
 OP_SETUVAL,/*      V L         'U{L} = V'                                   */
 
 OP_SETARRAY,/*     L S         'V{-S}[L+i] = V{-S+i}, 1 <= i <= S           */
+OP_SETFIELDS,/*    S           'V{-2S-1}[K_i] = V_i for S key-value pairs on top' */
 
 OP_SETPROPERTY,/*  V L1 L2     'V{-L1}.K{L2}:string = V'                    */
 OP_GETPROPERTY,/*  V  L        'V.K{L}'                                     */
@@ -251,6 +260,10 @@ OP_RET,/*         L1 L2 S  'return V{L1}, ... ,V{L1+L2-2}' (check notes)    */
 ** [OP_SETMM]
 ** Sets virtual method table entry value at index S.
 ** 
+** [OP_NEWTABLE]
+** If S2 != 0, the table never escapes the frame (temporary site S2-1), so
+** the table from its previous execution is cleared and reused instead.
+** 
 ** [OP_CALL]
 ** L1 is the offset from stack base, where the value being called is located.
 ** L2 is the number of expected results biased with +1.
@@ -330,6 +343,13 @@ CSI_DEC(const char *csC_opName[NUM_OPCODES];)
 #define ARRFIELDS_PER_FLUSH     50
 
 
+/*
+** Number of table fields (key-value pairs) to accumulate before a
+** SETFIELDS instruction (same constraints as 'ARRFIELDS_PER_FLUSH').
+*/
+#define TABFIELDS_PER_FLUSH     25
+
+
 #define csC_setmulret(fs,e)     csC_setreturns(fs, e, CS_MULRET)
 
 #define csC_store(fs,var)       csC_storevar(fs, var, 0)
@@ -341,12 +361,14 @@ CSI_DEC(const char *csC_opName[NUM_OPCODES];)
 
 CSI_FUNC int csC_emitI(FunctionState *fs, Instruction i);
 CSI_FUNC int csC_emitIS(FunctionState *fs, Instruction i, int a);
+CSI_FUNC int csC_emitISS(FunctionState *fs, Instruction i, int a, int b);
 CSI_FUNC int csC_emitIL(FunctionState *fs, Instruction i, int a);
 CSI_FUNC int csC_emitILS(FunctionState *fs, Instruction op, int a, int b);
 CSI_FUNC int csC_emitILL(FunctionState *fs, Instruction i, int a, int b);
 CSI_FUNC int csC_emitILLL(FunctionState *fs, Instruction i, int a, int b, int c);
 CSI_FUNC void csC_fixline(FunctionState *fs, int line);
 CSI_FUNC void csC_removelastjump(FunctionState *fs);
+CSI_FUNC int csC_getlabel(FunctionState *fs);
 CSI_FUNC void csC_checkstack(FunctionState *fs, int n);
 CSI_FUNC void csC_reserveslots(FunctionState *fs, int n);
 CSI_FUNC void csC_setoneret(FunctionState *fs, ExpInfo *e);
@@ -359,8 +381,11 @@ CSI_FUNC void csC_method(FunctionState *fs, ExpInfo *e);
 CSI_FUNC int csC_storevar(FunctionState *fs, ExpInfo *var, int left);
 CSI_FUNC void csC_setarraysize(FunctionState *fs, int pc, int sz);
 CSI_FUNC void csC_setarray(FunctionState *fs, int nelems, int tostore);
+CSI_FUNC void csC_setfields(FunctionState *fs, int tostore);
 CSI_FUNC void csC_settablesize(FunctionState *fs, int pc, int hsize);
 CSI_FUNC void csC_constexp2val(FunctionState *fs, ExpInfo *e, TValue *v);
+CSI_FUNC void csC_const2exp(FunctionState *fs, ExpInfo *e);
+CSI_FUNC int csC_exp2const(FunctionState *fs, ExpInfo *e, TValue *v);
 CSI_FUNC TValue *csC_getconstant(FunctionState *fs, ExpInfo *v);
 CSI_FUNC void csC_varexp2stack(FunctionState *fs, ExpInfo *e);
 CSI_FUNC void csC_exp2stack(FunctionState *fs, ExpInfo *e);
@@ -27,57 +27,30 @@
 #define CScriptClosure(cl)      ((cl) != NULL && (cl)->c.tt_ == CS_VCSCL)
 
 
-/*
-** Gets the Number of instructions up to 'pc' in O(log(n)).
-** As CSCript implementation is using stack-based architecture for its VM,
-** we then also store additional pc for each instruction emitted for a
-** faster lookup. This is required in order to properly calculate estimate
-** when fetching base line.
-*/
-static int Ninstuptopc(const Proto *p, int pc) {
-    int l = 0;
-    int h = p->sizeinstpc - 1;
-    int m, instpc;
-    cs_assert(h >= 0);
-    while (l <= h) {
-        m = l + ((h - l) / 2); /* avoid potential overflow */
-        instpc = p->instpc[m];
-        if (pc < instpc)
-            h = m - 1;
-        else if (instpc < pc)
-            l = m + 1;
-        else
-            return m;
-    }
-    cs_assert(0); /* 'pc' does not correspond to any instruction */
-}
-
-
 /*
 ** Get a "base line" to find the line corresponding to an instruction.
-** Base lines are regularly placed at MAXIWTHABS intervals, so usually
-** an integer division gets the right place. When the source file has
-** large sequences of empty/comment lines, it may need extra entries,
-** so the original estimate needs a correction.
-** If the original estimate is -1, the initial 'if' ensures that the
-** 'while' will run at least once.
-** The assertion that the estimate is a lower bound for the correct base
-** is valid as long as the debug info has been generated with the same
-** value for MAXIWTHABS or smaller.
+** Absolute line entries are sorted by 'pc', so a binary search finds the
+** last entry at or before 'pc'; from there at most MAXIWTHABS
+** instructions must be walked. Entry 'idx' is the 'lineinfo' index of
+** the instruction at 'basepc'.
 */
-static int getbaseline(const Proto *p, int pc, int *basepc) {
+static int getbaseline(const Proto *p, int pc, int *basepc, int *idx) {
     if (p->sizeabslineinfo == 0 || pc < p->abslineinfo[0].pc) {
-        *basepc = 0; /* start from the beginning */
+        *basepc = *idx = 0; /* start from the beginning */
         return p->defline + p->lineinfo[0]; /* first instruction line */
     } else {
-        int i = cast_uint(Ninstuptopc(p, pc)) / MAXIWTHABS - 1; /* get an estimate */
-        /* estimate must be a lower bound of the correct base */
-        cs_assert(i < 0 || /* linedif was too large before MAXIWTHABS? */
-                 (i < p->sizeabslineinfo && p->abslineinfo[i].pc <= pc));
-        while (i + 1 < p->sizeabslineinfo && pc >= p->abslineinfo[i + 1].pc)
-            i++; /* low estimate; adjust it */
-        *basepc = p->abslineinfo[i].pc;
-        return p->abslineinfo[i].line;
+        int l = 0;
+        int h = p->sizeabslineinfo - 1;
+        while (l < h) { /* find last entry with 'pc' <= given 'pc' */
+            int m = h - ((h - l) / 2); /* (rounded up) */
+            if (p->abslineinfo[m].pc <= pc)
+                l = m;
+            else
+                h = m - 1;
+        }
+        *basepc = p->abslineinfo[l].pc;
+        *idx = p->abslineinfo[l].idx;
+        return p->abslineinfo[l].line;
     }
 }
 
@@ -85,22 +58,21 @@ static int getbaseline(const Proto *p, int pc, int *basepc) {
 /*
 ** Get the line corresponding to instruction 'pc' in function prototype 'p';
 ** first gets a base line and from there does the increments until the
-** desired instruction.
+** instruction containing 'pc'. Returns -1 if 'p' has no line information
+** (debug information was stripped).
 */
 int csD_getfuncline(const Proto *p, int pc) {
-    int basepc;
-    int prevbaseline = -1;
-    int baseline = getbaseline(p, pc, &basepc);
-    while (basepc < pc) { /* walk until given instruction */
-        basepc += getOpSize(p->code[basepc]); /* next instruction pc */
-        cs_assert(p->lineinfo[basepc] != ABSLINEINFO);
-        cs_assert(p->lineinfo[basepc] != ARGLINEINFO);
-        prevbaseline = baseline;
-        baseline += p->lineinfo[basepc]; /* correct line */
-    }
-    if (c_unlikely(pc < basepc)) { /* 'pc' in between instructions? */
-        cs_assert(prevbaseline >= 0);
-        baseline -= p->lineinfo[basepc]; /* go back one instruction */
+    int basepc, idx, baseline;
+    if (p->lineinfo == NULL) /* no debug information? */
+        return -1;
+    baseline = getbaseline(p, pc, &basepc, &idx);
+    for (;;) { /* walk until instruction containing 'pc' */
+        int nextpc = basepc + getOpSize(p->code[basepc]);
+        if (pc < nextpc) break; /* 'pc' is within instruction at 'basepc' */
+        basepc = nextpc;
+        idx++;
+        cs_assert(idx < p->sizelineinfo && p->lineinfo[idx] != ABSLINEINFO);
+        baseline += p->lineinfo[idx]; /* correct line */
     }
     return baseline;
 }
@@ -375,6 +347,8 @@ const char *csD_addinfo(cs_State *C, const char *msg, OString *src,
         buffer[0] = '?';
         buffer[1] = '\0';
     }
+    if (line < 0) /* no line information (stripped)? */
+        return csS_pushfstring(C, "%s:?: %s", buffer, msg);
     return csS_pushfstring(C, "%s:%d: %s", buffer, line, msg);
 }
 
@@ -26,12 +26,6 @@
 #define ABSLINEINFO     (-0x80)
 
 
-/*
-** Mark for entries in 'lineinfo' array that containt instruction
-** arguments.
-*/
-#define ARGLINEINFO     (ABSLINEINFO + 1)
-
 
 /*
 ** MAXimum number of successive Instructions WiTHout ABSolute line
@@ -0,0 +1,269 @@
+/*
+** cdump.c
+** Save precompiled CScript chunks
+** See Copyright Notice in cscript.h
+*/
+
+
+#define CS_CORE
+
+
+#include <limits.h>
+#include <string.h>
+
+#include "cgc.h"
+#include "cobject.h"
+#include "cstate.h"
+#include "ctable.h"
+#include "cundump.h"
+
+
+typedef struct DumpState {
+    cs_State *C;
+    cs_Writer writer;
+    void *data;
+    int strip;
+    int status;
+} DumpState;
+
+
+/*
+** All high-level dumps go through 'dumpvector'; you can change it to
+** change the endianness of the result.
+*/
+#define dumpvector(D,v,n)	dumpblock(D,v,(n)*sizeof((v)[0]))
+
+#define dumpliteral(D, s)	dumpblock(D,s,sizeof(s) - sizeof(char))
+
+
+static void dumpblock(DumpState *D, const void *b, size_t size) {
+    if (D->status == 0 && size > 0) {
+        cs_unlock(D->C);
+        D->status = (*D->writer)(D->C, b, size, D->data);
+        cs_lock(D->C);
+    }
+}
+
+
+#define dumpvar(D,x)		dumpvector(D,&x,1)
+
+
+static void dumpbyte(DumpState *D, int y) {
+    c_byte x = cast_byte(y);
+    dumpvar(D, x);
+}
+
+
+/*
+** 'dumpsize' buffer size: each byte can store up to 7 bits. (The "+6"
+** rounds up the division.)
+*/
+#define DIBS    ((sizeof(size_t) * CHAR_BIT + 6) / 7)
+
+/* encode 'x' with a variable length, 7 bits per byte, MSB first */
+static void dumpsize(DumpState *D, size_t x) {
+    c_byte buff[DIBS];
+    int n = 0;
+    do {
+        buff[DIBS - (++n)] = x & 0x7f; /* fill buffer in reverse order */
+        x >>= 7;
+    } while (x != 0);
+    buff[DIBS - 1] |= 0x80; /* mark last byte */
+    dumpvector(D, buff + DIBS - n, n);
+}
+
+
+static void dumpint(DumpState *D, int x) {
+    dumpsize(D, cast_sizet(x));
+}
+
+
+static void dumpnumber(DumpState *D, cs_Number x) {
+    dumpvar(D, x);
+}
+
+
+static void dumpinteger(DumpState *D, cs_Integer x) {
+    dumpvar(D, x);
+}
+
+
+/* strings are saved with their size plus one (0 means NULL) */
+static void dumpstring(DumpState *D, const OString *s) {
+    if (s == NULL)
+        dumpsize(D, 0);
+    else {
+        size_t size = getstrlen(s);
+        const char *str = getstr(s);
+        dumpsize(D, size + 1);
+        dumpvector(D, str, size);
+    }
+}
+
+
+static void dumpcode(DumpState *D, const Proto *p) {
+    dumpint(D, p->sizecode);
+    dumpvector(D, p->code, p->sizecode);
+}
+
+
+static void dumpfunction(DumpState *D, const Proto *p, OString *psource);
+
+
+static void dumpvalue(DumpState *D, const TValue *o) {
+    int tt = ttypetag(o);
+    dumpbyte(D, tt);
+    switch (tt) {
+        case CS_VNUMFLT: dumpnumber(D, fval(o)); break;
+        case CS_VNUMINT: dumpinteger(D, ival(o)); break;
+        case CS_VSHRSTR: case CS_VLNGSTR: dumpstring(D, strval(o)); break;
+        default: cs_assert(tt == CS_VNIL || tt == CS_VFALSE ||
+                           tt == CS_VTRUE);
+    }
+}
+
+
+static void dumpconstants(DumpState *D, const Proto *p) {
+    int n = p->sizek;
+    dumpint(D, n);
+    for (int i = 0; i < n; i++)
+        dumpvalue(D, &p->k[i]);
+}
+
+
+/* dump labels in table 't' of a jump table */
+static void dumplabels(DumpState *D, Table *t) {
+    Node *n;
+    int nlabels = 0;
+    csH_finishrehash(D->C, t); /* all labels in 't->node' */
+    for (n = htnode(t, 0); n < htnodelast(t); n++)
+        nlabels += !isempty(nodeval(n));
+    dumpint(D, nlabels);
+    for (n = htnode(t, 0); n < htnodelast(t); n++) {
+        if (!isempty(nodeval(n))) {
+            TValue k;
+            getnodekey(D->C, &k, n);
+            dumpvalue(D, &k);
+            dumpint(D, cast_int(ival(nodeval(n))));
+        }
+    }
+}
+
+
+static void dumpswitches(DumpState *D, const Proto *p) {
+    int n = p->sizeswtabs;
+    dumpint(D, n);
+    for (int i = 0; i < n; i++) {
+        const SwitchTable *st = &p->swtabs[i];
+        dumpint(D, st->dflt);
+        dumpbyte(D, st->t != NULL);
+        if (st->t != NULL) /* hash labels? */
+            dumplabels(D, st->t);
+        else { /* dense integer labels */
+            dumpinteger(D, st->lo);
+            dumpint(D, st->sizejmps);
+            for (int j = 0; j < st->sizejmps; j++)
+                dumpint(D, st->jmps[j]);
+        }
+    }
+}
+
+
+static void dumpprotos(DumpState *D, const Proto *p) {
+    int n = p->sizep;
+    dumpint(D, n);
+    for (int i = 0; i < n; i++)
+        dumpfunction(D, p->p[i], p->source);
+}
+
+
+static void dumpupvalues(DumpState *D, const Proto *p) {
+    int n = p->sizeupvals;
+    dumpint(D, n);
+    for (int i = 0; i < n; i++) {
+        dumpbyte(D, p->upvals[i].onstack);
+        dumpint(D, p->upvals[i].idx);
+        dumpbyte(D, p->upvals[i].kind);
+    }
+}
+
+
+static void dumpdebug(DumpState *D, const Proto *p) {
+    int n;
+    n = (D->strip) ? 0 : p->sizelineinfo;
+    dumpint(D, n);
+    dumpvector(D, p->lineinfo, n);
+    n = (D->strip) ? 0 : p->sizeabslineinfo;
+    dumpint(D, n);
+    for (int i = 0; i < n; i++) {
+        dumpint(D, p->abslineinfo[i].pc);
+        dumpint(D, p->abslineinfo[i].idx);
+        dumpint(D, p->abslineinfo[i].line);
+    }
+    n = (D->strip) ? 0 : p->sizelocals;
+    dumpint(D, n);
+    for (int i = 0; i < n; i++) {
+        dumpstring(D, p->locals[i].name);
+        dumpint(D, p->locals[i].startpc);
+        dumpint(D, p->locals[i].endpc);
+    }
+    /* pre-parsed bodies resolve their upvalues by name when compiled */
+    n = (D->strip && p->lazysrc == NULL) ? 0 : p->sizeupvals;
+    dumpint(D, n);
+    for (int i = 0; i < n; i++)
+        dumpstring(D, p->upvals[i].name);
+}
+
+
+static void dumpfunction(DumpState *D, const Proto *p, OString *psource) {
+    if (p->lazysrc != NULL) /* body still to be compiled? */
+        dumpstring(D, p->source); /* (parent's source may be stripped) */
+    else if (D->strip || p->source == psource)
+        dumpstring(D, NULL); /* no debug info or same source as its parent */
+    else
+        dumpstring(D, p->source);
+    dumpint(D, p->defline);
+    dumpint(D, p->deflastline);
+    dumpint(D, p->arity);
+    dumpbyte(D, p->isvararg);
+    dumpint(D, p->maxstack);
+    dumpcode(D, p);
+    dumpconstants(D, p);
+    dumpswitches(D, p);
+    dumpint(D, p->sizetmptabs);
+    dumpupvalues(D, p);
+    dumpprotos(D, p);
+    /* pre-parsed body is kept as source (see 'lazybody') */
+    dumpstring(D, p->lazysrc);
+    dumpint(D, p->lazyline);
+    dumpdebug(D, p);
+}
+
+
+static void dumpheader(DumpState *D) {
+    dumpliteral(D, CS_SIGNATURE);
+    dumpbyte(D, CSC_VERSION);
+    dumpbyte(D, CSC_FORMAT);
+    dumpliteral(D, CSC_DATA);
+    dumpbyte(D, sizeof(Instruction));
+    dumpbyte(D, sizeof(cs_Integer));
+    dumpbyte(D, sizeof(cs_Number));
+    dumpinteger(D, CSC_INT);
+    dumpnumber(D, CSC_NUM);
+}
+
+
+/* dump CScript function as precompiled chunk */
+int csU_dump(cs_State *C, const Proto *p, cs_Writer w, void *data,
+             int strip) {
+    DumpState D;
+    D.C = C;
+    D.writer = w;
+    D.data = data;
+    D.strip = strip;
+    D.status = 0;
+    dumpheader(&D);
+    dumpbyte(&D, p->sizeupvals);
+    dumpfunction(&D, p, NULL);
+    return D.status;
+}
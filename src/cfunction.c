@@ -26,18 +26,22 @@ Proto *csF_newproto(cs_State *C) {
     p->isvararg = 0;
     p->gclist = NULL;
     p->source = NULL;
+    p->lazysrc = NULL;
+    p->cache = NULL;
     { p->p = NULL; p->sizep = 0; } /* function prototypes */
     { p->k = NULL; p->sizek = 0; } /* constants */
     { p->code = NULL; p->sizecode = 0; } /* code */
     { p->lineinfo = NULL; p->sizelineinfo = 0; } /* rel line info */
     { p->abslineinfo = NULL; p->sizeabslineinfo = 0; } /* abs line info */
-    { p->instpc = NULL; p->sizeinstpc = 0; } /* instruction pc's */
     { p->locals = NULL; p->sizelocals = 0; } /* locals */
     { p->upvals = NULL; p->sizeupvals = 0; } /* upvalues */
+    { p->swtabs = NULL; p->sizeswtabs = 0; } /* switch jump tables */
+    { p->tmptabs = NULL; p->sizetmptabs = 0; } /* temporary tables */
     p->maxstack = 0;
     p->arity = 0;
     p->defline = 0;
     p->deflastline = 0;
+    p->lazyline = 0;
     return p;
 }
 
@@ -132,21 +136,33 @@ static UpVal *newupval(cs_State *C, SPtr val, UpVal **prev) {
 }
 
 
+/* slot in 'uvcache' for open upvalue of stack slot 'sv' */
+#define uvcacheslot(C,sv) \
+        (&G(C)->uvcache[(pointer2uint(sv) / sizeof(SValue)) & \
+                        (UVCACHE_N - 1)])
+
+
 /*
 ** Find and return already existing upvalue or create
-** and return a new one.
+** and return a new one. Open upvalues found (or created) are
+** remembered in 'uvcache', so repeated captures of the same
+** variables (closures created in a loop) do not walk the whole
+** 'openupval' list.
 */
 UpVal *csF_findupval(cs_State *C, SPtr sv) {
+    UpVal **cache = uvcacheslot(C, sv);
     UpVal **pp = &C->openupval; /* good ol' pp */
     UpVal *p;
     cs_assert(isinthwouv(C) || C->openupval == NULL);
-    while ((p = *pp) != NULL && uvlevel(p) > sv) {
+    if (*cache != NULL && uvlevel(*cache) == sv) /* cache hit? */
+        return *cache;
+    while ((p = *pp) != NULL && uvlevel(p) >= sv) {
         cs_assert(!isdead(G(C), p));
         if (uvlevel(p) == sv)
-            return p;
+            return (*cache = p);
         pp = &p->u.open.next;
     }
-    return newupval(C, sv, pp);
+    return (*cache = newupval(C, sv, pp));
 }
 
 
@@ -203,9 +219,12 @@ void csF_newtbcvar(cs_State *C, SPtr level) {
 }
 
 
-/* unlinks upvalue from the list */
-void csF_unlinkupval(UpVal *uv) {
+/* unlinks upvalue from the list (and from 'uvcache') */
+void csF_unlinkupval(cs_State *C, UpVal *uv) {
+    UpVal **cache = uvcacheslot(C, uvlevel(uv));
     cs_assert(uvisopen(uv));
+    if (*cache == uv)
+        *cache = NULL;
     *uv->u.open.prev = uv->u.open.next;
     if (uv->u.open.next)
         uv->u.open.next->u.open.prev = uv->u.open.prev;
@@ -217,7 +236,7 @@ void csF_closeupval(cs_State *C, SPtr level) {
     UpVal *uv;
     while ((uv = C->openupval) != NULL && uvlevel(uv) >= level) {
         TValue *slot = &uv->u.value; /* new position for value */
-        csF_unlinkupval(uv); /* remove it from 'openupval' list */
+        csF_unlinkupval(C, uv); /* remove it from 'openupval' list */
         setobj(C, slot, uv->v.p); /* move value to the upvalue slot */
         uv->v.p = slot; /* adjust its pointer */
         if (!iswhite(uv)) { /* neither white nor dead? */
@@ -247,9 +266,9 @@ static void callCLOSEmm(cs_State *C, TValue *obj, TValue *errobj) {
     SPtr top = C->sp.p;
     const TValue *method = csMM_get(C, obj, CS_MM_CLOSE);
     cs_assert(!ttisnil(method));
-    setobj2s(C, top + 1, method);
-    setobj2s(C, top + 2, obj);
-    setobj2s(C, top + 3, errobj);
+    setobj2s(C, top, method);
+    setobj2s(C, top + 1, obj);
+    setobj2s(C, top + 2, errobj);
     C->sp.p = top + 3;
     csV_call(C, top, 0);
 }
@@ -292,6 +311,49 @@ SPtr csF_close(cs_State *C, SPtr level, int status) {
 }
 
 
+/* free line and local variable information of 'p' and its children */
+void csF_stripdebug(cs_State *C, Proto *p) {
+    csM_freearray(C, p->lineinfo, p->sizelineinfo);
+    csM_freearray(C, p->abslineinfo, p->sizeabslineinfo);
+    csM_freearray(C, p->locals, p->sizelocals);
+    { p->lineinfo = NULL; p->sizelineinfo = 0; }
+    { p->abslineinfo = NULL; p->sizeabslineinfo = 0; }
+    { p->locals = NULL; p->sizelocals = 0; }
+    for (int i = 0; i < p->sizep; i++)
+        csF_stripdebug(C, p->p[i]);
+}
+
+
+/*
+** Free what a failed 'csP_parselazy' compiled into 'p', leaving it as
+** pre-parse left it, so that its body is compiled again next time.
+*/
+void csF_resetlazy(cs_State *C, Proto *p) {
+    cs_assert(p->lazysrc != NULL);
+    csM_freearray(C, p->p, p->sizep);
+    csM_freearray(C, p->k, p->sizek);
+    csM_freearray(C, p->code, p->sizecode);
+    csM_freearray(C, p->lineinfo, p->sizelineinfo);
+    csM_freearray(C, p->abslineinfo, p->sizeabslineinfo);
+    csM_freearray(C, p->locals, p->sizelocals);
+    for (int i = 0; i < p->sizeswtabs; i++)
+        csM_freearray(C, p->swtabs[i].jmps, p->swtabs[i].sizejmps);
+    csM_freearray(C, p->swtabs, p->sizeswtabs);
+    csM_freearray(C, p->tmptabs, p->sizetmptabs);
+    { p->p = NULL; p->sizep = 0; }
+    { p->k = NULL; p->sizek = 0; }
+    { p->code = NULL; p->sizecode = 0; }
+    { p->lineinfo = NULL; p->sizelineinfo = 0; }
+    { p->abslineinfo = NULL; p->sizeabslineinfo = 0; }
+    { p->locals = NULL; p->sizelocals = 0; }
+    { p->swtabs = NULL; p->sizeswtabs = 0; }
+    { p->tmptabs = NULL; p->sizetmptabs = 0; }
+    p->isvararg = 0;
+    p->arity = 0;
+    p->maxstack = 0;
+}
+
+
 /* free function prototype */
 void csF_free(cs_State *C, Proto *p) {
     csM_freearray(C, p->p, p->sizep);
@@ -299,8 +361,11 @@ void csF_free(cs_State *C, Proto *p) {
     csM_freearray(C, p->code, p->sizecode);
     csM_freearray(C, p->lineinfo, p->sizelineinfo);
     csM_freearray(C, p->abslineinfo, p->sizeabslineinfo);
-    csM_freearray(C, p->instpc, p->sizeinstpc);
     csM_freearray(C, p->locals, p->sizelocals);
     csM_freearray(C, p->upvals, p->sizeupvals);
+    for (int i = 0; i < p->sizeswtabs; i++)
+        csM_freearray(C, p->swtabs[i].jmps, p->swtabs[i].sizejmps);
+    csM_freearray(C, p->swtabs, p->sizeswtabs);
+    csM_freearray(C, p->tmptabs, p->sizetmptabs);
     csM_free(C, p);
 }
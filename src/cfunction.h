@@ -52,12 +52,14 @@ CSI_FUNC void csF_adjustvarargs(cs_State *C, int arity, CallFrame *cf,
 CSI_FUNC void csF_getvarargs(cs_State *C, CallFrame *cf, int wanted);
 CSI_FUNC void csF_initupvals(cs_State *C, CSClosure *cl);
 CSI_FUNC UpVal *csF_findupval(cs_State *C, SPtr sval);
-CSI_FUNC void csF_unlinkupval(UpVal *upval);
+CSI_FUNC void csF_unlinkupval(cs_State *C, UpVal *upval);
 CSI_FUNC const char *csF_getlocalname(const Proto *fn, int lnum, int pc);
 CSI_FUNC void csF_newtbcvar(cs_State *C, SPtr level);
 CSI_FUNC void csF_closeupval(cs_State *C, SPtr level);
 CSI_FUNC SPtr csF_close(cs_State *C, SPtr level, int status);
 CSI_FUNC void csF_freeupval(cs_State *C, UpVal *upval);
+CSI_FUNC void csF_stripdebug(cs_State *C, Proto *p);
+CSI_FUNC void csF_resetlazy(cs_State *C, Proto *p);
 CSI_FUNC void csF_free(cs_State *C, Proto *fn);
 
 #endif
@@ -43,6 +43,13 @@
 #define keyiswhite(n)		(keyiscollectable(n) && iswhite(keygcoval(n)))
 
 
+/* collectable object of value 'v' or NULL */
+#define gcvalueN(v)		(iscollectable(v) ? gcoval(v) : NULL)
+
+/* collectable object of key in node 'n' or NULL */
+#define gckeyN(n)		(keyiscollectable(n) ? keygcoval(n) : NULL)
+
+
 /* 'markobject_' but only if object is white */
 #define markobject(gs,o) \
         (iswhite(o) ? markobject_(gs, obj2gco(o)) : (void)0)
@@ -92,7 +99,7 @@ static void markobject_(GState *gs, GCObject *o);
 
 static void cleargraylists(GState *gs) {
     gs->graylist = gs->grayagain = NULL;
-    gs->weak = NULL;
+    gs->weak = gs->ephemeron = gs->allweak = NULL;
 }
 
 
@@ -305,10 +312,44 @@ static void clearkey (Node *n) {
 }
 
 
-/* mark 'Table' slots */
-static c_mem markhtable(GState *gs, Table *ht) {
-    Node *last = htnodelast(ht);
-    for (Node *n = htnode(ht, 0); n < last; n++) {
+/*
+** Check if a weak table entry referring to object 'o' (NULL if the
+** referent is not collectable) can be removed. Strings are values, not
+** objects with identity, so entries are never removed because of them;
+** they are marked instead.
+*/
+static int iscleared(GState *gs, GCObject *o) {
+    if (o == NULL) /* not collectable? */
+        return 0;
+    else if (novariant(o->tt_) == CS_TSTRING) {
+        markobject(gs, o); /* strings are never weak */
+        return 0;
+    } else
+        return iswhite(o);
+}
+
+
+/* function applied to a range of nodes of a table */
+typedef int (*NodeF)(GState *gs, Node *n, Node *last);
+
+
+/*
+** Apply 'f' to the nodes of 'ht', including the nodes of its old hash
+** array that were not moved yet (see 'rehash'), and return the union
+** of the results.
+*/
+static int visitnodes(GState *gs, Table *ht, NodeF f) {
+    int res = f(gs, htnode(ht, 0), htnodelast(ht));
+    if (ht->oldnode != NULL)
+        res |= f(gs, ht->oldnode + ht->oldpos,
+                     ht->oldnode + twoto(ht->oldsize));
+    return res;
+}
+
+
+/* mark the entries in nodes from 'n' up to 'last' */
+static int marknodes(GState *gs, Node *n, Node *last) {
+    for (; n < last; n++) {
         if (!isempty(nodeval(n))) { /* entry is not empty? */
             cs_assert(!keyisnil(n));
             markkey(gs, n);
@@ -316,14 +357,120 @@ static c_mem markhtable(GState *gs, Table *ht) {
         } else
             clearkey(n);
     }
-    return 1 + htsize(ht) * 2; /* hashtable + key/value pairs */
+    return 0;
+}
+
+
+/* results of traversing the nodes of weak tables */
+#define WMARKED		1 /* some value got marked */
+#define WCLEARS		2 /* some entry might be removed */
+#define WWHITE		4 /* some unmarked key has unmarked value */
+
+
+/* mark the keys in nodes from 'n' up to 'last' (weak values) */
+static int markweakvalnodes(GState *gs, Node *n, Node *last) {
+    int res = 0;
+    for (; n < last; n++) {
+        if (isempty(nodeval(n)))
+            clearkey(n);
+        else {
+            markkey(gs, n);
+            if (iscleared(gs, gcvalueN(nodeval(n))))
+                res = WCLEARS;
+        }
+    }
+    return res;
+}
+
+
+/*
+** Mark the values of marked keys in nodes from 'n' up to 'last'
+** (ephemerons); a value is kept alive only by its key, so entries with
+** unmarked keys are left for later, when their keys might be marked.
+*/
+static int markephemeronnodes(GState *gs, Node *n, Node *last) {
+    int res = 0;
+    for (; n < last; n++) {
+        if (isempty(nodeval(n)))
+            clearkey(n);
+        else if (iscleared(gs, gckeyN(n))) { /* key not marked (yet)? */
+            res |= WCLEARS;
+            if (valiswhite(nodeval(n)))
+                res |= WWHITE;
+        } else if (valiswhite(nodeval(n))) { /* marked key? */
+            markobject_(gs, gcoval(nodeval(n)));
+            res |= WMARKED;
+        }
+    }
+    return res;
+}
+
+
+/*
+** Mark table with weak values. While propagating, values might still
+** change, so the table is traversed again in 'atomic', where it goes
+** into 'weak' list if some of its entries might be removed.
+*/
+static void markweakval(GState *gs, Table *ht) {
+    int res = visitnodes(gs, ht, markweakvalnodes);
+    if (gs->gcstate == GCSatomic && res)
+        linkgclist(ht, gs->weak);
+    else
+        linkgclist(ht, gs->grayagain);
+}
+
+
+/*
+** Mark ephemeron table (weak keys) and return true if any value got
+** marked. In 'atomic', tables with unmarked values of unmarked keys go
+** into 'ephemeron' list (their keys might still get marked), and tables
+** only with unmarked keys go into 'allweak' list (to be cleared).
+*/
+static int markephemeron(GState *gs, Table *ht) {
+    int res = visitnodes(gs, ht, markephemeronnodes);
+    if (gs->gcstate == GCSpropagate)
+        linkgclist(ht, gs->grayagain); /* traverse again in 'atomic' */
+    else if (res & WWHITE)
+        linkgclist(ht, gs->ephemeron);
+    else if (res & WCLEARS)
+        linkgclist(ht, gs->allweak);
+    return (res & WMARKED);
+}
+
+
+/*
+** Mark 'Table' slots. Tables with both weak keys and values mark
+** nothing, they only need clearing; as their mode might still change
+** they are also deferred to 'atomic'.
+*/
+static c_mem markhtable(GState *gs, Table *ht) {
+    c_mem work = 1 + htsize(ht) * 2; /* hashtable + key/value pairs */
+    if (ht->oldnode != NULL) /* nodes not moved yet (see 'rehash') */
+        work += (twoto(ht->oldsize) - ht->oldpos) * 2;
+    if (!isweakkey(ht) && !isweakval(ht)) /* strong table? */
+        visitnodes(gs, ht, marknodes);
+    else if (!isweakkey(ht)) /* weak values? */
+        markweakval(gs, ht);
+    else if (!isweakval(ht)) /* weak keys? */
+        markephemeron(gs, ht);
+    else if (gs->gcstate == GCSatomic) /* all weak */
+        linkgclist(ht, gs->allweak);
+    else
+        linkgclist(ht, gs->grayagain);
+    return work;
 }
 
 
 /* mark 'Function' */
 static c_mem markfunction(GState *gs, Proto *p) {
     int i;
+    if (p->cache && iswhite(p->cache))
+        p->cache = NULL; /* allow cache to be collected */
+    for (i = 0; i < p->sizetmptabs; i++)
+        if (p->tmptabs[i] && iswhite(p->tmptabs[i]))
+            p->tmptabs[i] = NULL; /* idem */
     markobjectN(gs, p->source);
+    markobjectN(gs, p->lazysrc);
     for (i = 0; i < p->sizep; i++)
         markobjectN(gs, p->p[i]);
     for (i = 0; i < p->sizek; i++)
@@ -332,8 +479,11 @@ static c_mem markfunction(GState *gs, Proto *p) {
         markobjectN(gs, p->locals[i].name);
     for (i = 0; i < p->sizeupvals; i++)
         markobjectN(gs, p->upvals[i].name);
-    /* p + prototypes + constants + locals + upvalues */
-    return 1 + p->sizep + p->sizek + p->sizelocals + p->sizeupvals;
+    for (i = 0; i < p->sizeswtabs; i++)
+        markobjectN(gs, p->swtabs[i].t);
+    /* p + prototypes + constants + locals + upvalues + switch tables */
+    return 1 + p->sizep + p->sizek + p->sizelocals + p->sizeupvals +
+               p->sizeswtabs;
 }
 
 
@@ -403,6 +553,13 @@ static c_mem markthread(GState *gs, cs_State *C) {
         markvalue(gs, s2v(sp));
     for (UpVal *uv = C->openupval; uv != NULL; uv = uv->u.open.next)
         markobject(gs, uv); /* open upvalues cannot be collected */
+    for (CallFrame *cf = C->cf; cf != &C->basecf; cf = cf->prev) {
+        if (isCScript(cf)) { /* mark temporary tables (they are reused) */
+            Proto *p = cfProto(cf);
+            for (int i = 0; i < p->sizetmptabs; i++)
+                markobjectN(gs, cf->tmptabs[i]);
+        }
+    }
     if (gs->gcstate == GCSatomic) { /* final traversal? */
         if (!gs->gcemergency) /* not an emergency collection? */
             csT_shrinkstack(C); /* shrink stack if possible */
@@ -492,6 +649,78 @@ static c_mem propagateall(GState *gs) {
 }
 
 
+/*
+** Traverse ephemeron tables until no more values get marked; marking
+** a value might mark keys of other (or the same) ephemeron tables.
+*/
+static c_mem convergeephemerons(GState *gs) {
+    c_mem work = 0;
+    int changed;
+    do {
+        GCObject *next = gs->ephemeron;
+        gs->ephemeron = NULL; /* tables may return to the list */
+        changed = 0;
+        while (next != NULL) {
+            Table *ht = gco2ht(next);
+            next = ht->gclist;
+            notw2black(ht);
+            work += htsize(ht);
+            if (markephemeron(gs, ht)) { /* marked some value? */
+                work += propagateall(gs);
+                changed = 1;
+            }
+        }
+    } while (changed);
+    return work;
+}
+
+
+
+/* -----------------------------------------------------------------------
+** Weak tables
+** ----------------------------------------------------------------------- */
+
+/* remove entries with unmarked keys in nodes from 'n' up to 'last' */
+static int clearkeynodes(GState *gs, Node *n, Node *last) {
+    for (; n < last; n++) {
+        if (iscleared(gs, gckeyN(n)))
+            setemptyval(nodeval(n));
+        if (isempty(nodeval(n)))
+            clearkey(n);
+    }
+    return 0;
+}
+
+
+/* remove entries with unmarked values in nodes from 'n' up to 'last' */
+static int clearvalnodes(GState *gs, Node *n, Node *last) {
+    for (; n < last; n++) {
+        if (iscleared(gs, gcvalueN(nodeval(n))))
+            setemptyval(nodeval(n));
+        if (isempty(nodeval(n)))
+            clearkey(n);
+    }
+    return 0;
+}
+
+
+/* clear entries with unmarked keys from all tables in list 'l' */
+static void clearbykeys(GState *gs, GCObject *l) {
+    for (; l != NULL; l = gco2ht(l)->gclist)
+        visitnodes(gs, gco2ht(l), clearkeynodes);
+}
+
+
+/*
+** Clear entries with unmarked values from all tables in list 'l'
+** up to element 'f'.
+*/
+static void clearbyvalues(GState *gs, GCObject *l, GCObject *f) {
+    for (; l != f; l = gco2ht(l)->gclist)
+        visitnodes(gs, gco2ht(l), clearvalnodes);
+}
+
+
 
 /* -----------------------------------------------------------------------
 ** Free objects
@@ -499,8 +728,8 @@ static c_mem propagateall(GState *gs) {
 
 static void freeupval(cs_State *C, UpVal *uv) {
     if (uvisopen(uv))
-        csF_unlinkupval(uv);
-    csM_free(C, uv);
+        csF_unlinkupval(C, uv);
+    csM_freeobj(C, uv, sizeof(*uv));
 }
 
 
@@ -510,42 +739,42 @@ static void freeobject(cs_State *C, GCObject *o) {
         case CS_VUPVALUE: freeupval(C, gco2uv(o)); break;
         case CS_VARRAY: csA_free(C, gco2arr(o)); break;
         case CS_VTABLE: csH_free(C, gco2ht(o)); break;
-        case CS_VINSTANCE: csM_free(C, gco2ins(o)); break;
-        case CS_VIMETHOD: csM_free(C, gco2im(o)); break;
+        case CS_VINSTANCE: csM_freeobj(C, o, sizeof(Instance)); break;
+        case CS_VIMETHOD: csM_freeobj(C, o, sizeof(IMethod)); break;
         case CS_VTHREAD: csT_free(C, gco2th(o)); break;
         case CS_VSHRSTR: {
             OString *s = gco2str(o);
             csS_remove(C, s); /* remove the weak reference */
-            csM_freemem(C, s, sizeofstring(s->shrlen));
+            csM_freeobj(C, s, sizeofstring(s->shrlen));
             break;
         }
         case CS_VLNGSTR: {
             OString *s = gco2str(o);
-            csM_freemem(C, s, sizeofstring(s->u.lnglen));
+            csM_freeobj(C, s, sizeofstring(s->u.lnglen));
             break;
         }
         case CS_VCSCL: {
             CSClosure *cl = gco2clcs(o);
-            csM_freemem(C, cl, sizeofCScl(cl->nupvalues));
+            csM_freeobj(C, cl, sizeofCScl(cl->nupvalues));
             break;
         }
         case CS_VCCL: {
             CClosure *cl = gco2clc(o);
-            csM_freemem(C, cl, sizeofCcl(cl->nupvalues));
+            csM_freeobj(C, cl, sizeofCcl(cl->nupvalues));
             break;
         }
         case CS_VCLASS: {
             OClass *cls = gco2cls(o);
             if (cls->vmt) /* have VMT? */
                 csM_freearray(C, cls->vmt, SIZEVMT);
-            csM_free(C, cls);
+            csM_freeobj(C, cls, sizeof(*cls));
             break;
         }
         case CS_VUSERDATA: {
             UserData *u = gco2u(o);
             if (u->vmt)
                 csM_freearray(C, u->vmt, SIZEVMT);
-            csM_freemem(C, u, sizeofuserdata(u->nuv, u->size));
+            csM_freeobj(C, u, sizeofuserdata(u->nuv, u->size));
             break;
         }
         default: cs_assert(0); break; /* invalid object */
@@ -783,8 +1012,10 @@ static c_mem atomic(cs_State *C) {
     GState *gs = G(C);
     c_smem work = 0;
     GCObject *grayagain = gs->grayagain;
+    GCObject *origweak, *origall;
     gs->grayagain = NULL;
-    cs_assert(gs->weak == NULL); /* 'weak' unused */
+    cs_assert(gs->weak == NULL && gs->ephemeron == NULL);
+    cs_assert(gs->allweak == NULL);
     cs_assert(!iswhite(gs->mainthread)); /* mainthread must be marked */
     gs->gcstate = GCSatomic;
     markobject(gs, C); /* mark running thread */
@@ -796,13 +1027,25 @@ static c_mem atomic(cs_State *C) {
     cs_assert(gs->graylist == NULL); /* all must be propagated */
     gs->graylist = grayagain; /* set 'grayagain' as the graylist */
     work += propagateall(gs); /* propagate gray objects from 'grayagain' */
+    work += convergeephemerons(gs);
+    /* all strongly reachable objects are marked; values of objects to
+       be finalized are removed from weak tables before resurrecting */
+    clearbyvalues(gs, gs->weak, NULL);
+    clearbyvalues(gs, gs->allweak, NULL);
+    origweak = gs->weak; origall = gs->allweak;
     /* separate and 'resurrect' unreachable objects with the finalizer... */
     separatetobefin(gs, 0);
     work += marktobefin(gs); /* ...and mark them */
     work += propagateall(gs); /* propagate changes */
+    work += convergeephemerons(gs);
+    /* remove resurrected keys too, and values that got in meanwhile */
+    clearbykeys(gs, gs->ephemeron);
+    clearbykeys(gs, gs->allweak);
+    clearbyvalues(gs, gs->weak, origweak);
+    clearbyvalues(gs, gs->allweak, origall);
+    csS_clearcache(gs); /* drop strings about to be collected from cache */
     gs->whitebit = whitexor(gs); /* flip current white bit */
     cs_assert(gs->graylist == NULL); /* all must be propagated */
-    cs_assert(gs->weak == NULL); /* 'weak' unused */
     return work; /* estimate number of slots marked by 'atomic' */
 }
 
@@ -949,6 +1192,7 @@ void csG_freeallobjects(cs_State *C) {
     freelist(C, gs->objects, obj2gco(gs->mainthread));
     cs_assert(gs->fin == NULL); /* no new finalizers */
     freelist(C, gs->fixed, NULL); /* collect fixed objects */
+    csM_freepools(C);
     cs_assert(gs->strtab.nuse == 0);
 }
 
@@ -956,7 +1200,7 @@ void csG_freeallobjects(cs_State *C) {
 /* run GState steps until 'state' is in any of the states of 'statemask' */
 void csG_rununtilstate(cs_State *C, int statemask) {
     GState *gs = G(C);
-    while (!testbits(gs->gcstate, statemask))
+    while (!testbits(bitmask(gs->gcstate), statemask))
         singlestep(C);
 }
 
@@ -1001,7 +1245,7 @@ static void fullcycle(cs_State *C) {
     /* finish any pending sweep phase to start a new cycle */
     csG_rununtilstate(C, bitmask(GCSpause));
     csG_rununtilstate(C, bitmask(GCSpropagate)); /* start a new cycle */
-    gs->gcstate = GCSatomic; /* go to atomic phase (skip GCSenteratomic) */
+    gs->gcstate = GCSenteratomic; /* go to atomic phase (skip propagate) */
     csG_rununtilstate(C, bitmask(GCScallfin)); /* run up to finalizers */
     /* estimate must be correct after full GC cycle */
     cs_assert(gs->gcestimate == gettotalbytes(gs));
@@ -1015,6 +1259,8 @@ void csG_full(cs_State *C, int isemergency) {
     cs_assert(!gs->gcemergency);
     gs->gcemergency = isemergency;
     fullcycle(C);
+    if (isemergency) /* memory is scarce? */
+        csM_freepools(C); /* give pooled blocks back too */
     gs->gcemergency = 0;
 }
 
@@ -0,0 +1,658 @@
+/*
+** ciolib.c
+** Standard I/O (and system) library
+** See Copyright Notice in cscript.h
+*/
+
+
+#define CS_LIB
+
+
+/*
+** @CS_USE_MMAP controls whether 'io.mmap' maps files into memory
+** (POSIX 'mmap'); without it 'io.mmap' falls back to a regular
+** buffered handle.
+*/
+#if !defined(CS_USE_MMAP)
+#if defined(__unix__) || defined(__APPLE__)
+#define CS_USE_MMAP     1
+#else
+#define CS_USE_MMAP     0
+#endif
+#endif
+
+
+#if CS_USE_MMAP && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE     200809L /* 'fileno', 'fstat' and 'mmap' */
+#endif
+
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if CS_USE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "cscript.h"
+
+#include "cauxlib.h"
+#include "cslib.h"
+
+
+
+/* size of the read buffer of each file handle */
+#if !defined(IO_BUFFSIZE)
+#define IO_BUFFSIZE     16384
+#endif
+
+
+/* kinds of handles */
+#define IO_FILE         0   /* regular file */
+#define IO_STD          1   /* standard file (cannot be closed) */
+#define IO_MAP          2   /* read-only memory mapped file */
+#define IO_CLOSED       3   /* closed handle */
+
+
+/*
+** File handle. Reads go through the handle's own buffer 'b', which
+** lets 'lines' and 'read' push strings straight from it instead of
+** reading byte by byte. For mapped files 'b' is the whole mapping and
+** is never refilled.
+*/
+typedef struct IOHandle {
+    FILE *f; /* stream (NULL for mapped and closed handles) */
+    char *b; /* read buffer (or mapped memory) */
+    size_t n; /* number of bytes in 'b' */
+    size_t pos; /* current read position in 'b' */
+    int kind; /* kind of handle */
+    char buff[IO_BUFFSIZE]; /* buffer for streams */
+} IOHandle;
+
+
+/* unique address identifying io handles (held as their user value) */
+static const char iotag = 0;
+
+
+static IOHandle *testhandle(cs_State *C, int arg) {
+    IOHandle *h = (IOHandle *)cs_to_userdata(C, arg);
+    if (h != NULL && cs_type(C, arg) == CS_TUSERDATA) { /* full userdata? */
+        int istag;
+        cs_get_uservalue(C, arg, 1);
+        istag = (cs_is_lightuserdata(C, -1) && cs_to_pointer(C, -1) == &iotag);
+        cs_pop(C, 1);
+        return (istag ? h : NULL);
+    }
+    return NULL;
+}
+
+
+static IOHandle *checkhandle(cs_State *C, int arg) {
+    IOHandle *h = testhandle(C, arg);
+    csL_expect_arg(C, h != NULL, arg, "file");
+    return h;
+}
+
+
+static IOHandle *checkopen(cs_State *C, int arg) {
+    IOHandle *h = checkhandle(C, arg);
+    if (c_unlikely(h->kind == IO_CLOSED))
+        csL_error(C, "attempt to use a closed file");
+    return h;
+}
+
+
+/* returns number of results pushed by 'csL_fileresult' */
+static int fileresult(cs_State *C, int ok, const char *fname) {
+    return (csL_fileresult(C, ok, fname) == CS_OK ? 1 : 3);
+}
+
+
+/* release resources held by 'h'; returns 0 on failure */
+static int closehandle(IOHandle *h) {
+    int ok = 1;
+    switch (h->kind) {
+        case IO_FILE: ok = (fclose(h->f) == 0); break;
+#if CS_USE_MMAP
+        case IO_MAP: if (h->b) ok = (munmap(h->b, h->n) == 0); break;
+#endif
+        default: break;
+    }
+    h->f = NULL;
+    h->b = NULL;
+    h->n = h->pos = 0;
+    h->kind = IO_CLOSED;
+    return ok;
+}
+
+
+static int io_gc(cs_State *C) {
+    IOHandle *h = (IOHandle *)cs_to_userdata(C, 0);
+    if (h->kind != IO_STD && h->kind != IO_CLOSED)
+        closehandle(h); /* ignore errors */
+    return 0;
+}
+
+
+static const cs_VMT handlevmt = {
+    .func[CS_MM_GC] = io_gc,
+    .func[CS_MM_CLOSE] = io_gc,
+};
+
+
+/* create new handle of kind 'kind' for stream 'f' */
+static IOHandle *newhandle(cs_State *C, FILE *f, int kind) {
+    IOHandle *h;
+    cs_push_lightuserdata(C, (void *)&iotag);
+    h = (IOHandle *)cs_newuserdata(C, sizeof(IOHandle), 1);
+    h->f = f;
+    h->b = h->buff;
+    h->n = h->pos = 0;
+    h->kind = kind;
+    cs_set_uservmt(C, -1, &handlevmt);
+    return h;
+}
+
+
+/*
+** Refill the buffer of 'h', returns 0 at end of file. Standard files
+** fill up to a newline so that interactive input does not block
+** waiting for a full buffer.
+*/
+static int fillbuff(IOHandle *h) {
+    size_t n = 0;
+    if (h->f == NULL) return 0; /* mapped files are never refilled */
+    if (h->kind == IO_STD) {
+        int c;
+        while (n < IO_BUFFSIZE && (c = getc(h->f)) != EOF) {
+            h->b[n++] = (char)c;
+            if (c == '\n') break;
+        }
+    } else
+        n = fread(h->b, 1, IO_BUFFSIZE, h->f);
+    h->pos = 0;
+    h->n = n;
+    return (n > 0);
+}
+
+
+/*
+** Drop buffered (read but unused) data before writing or seeking, by
+** moving the stream position back to the logical position of 'h'.
+*/
+static int syncbuff(IOHandle *h) {
+    int ok = 1;
+    if (h->f != NULL && h->pos < h->n)
+        ok = (fseek(h->f, -(long)(h->n - h->pos), SEEK_CUR) == 0);
+    if (h->f != NULL)
+        h->n = h->pos = 0;
+    return ok;
+}
+
+
+
+/* {======================================================================
+** Reading
+** ======================================================================= */
+
+#define avail(h)        ((h)->n - (h)->pos)
+
+
+/*
+** Read a line; if 'chop' the newline is not included. Lines that fit
+** in the buffer are pushed directly from it, longer lines are
+** accumulated in a 'csL_Buffer'.
+*/
+static int readline(cs_State *C, IOHandle *h, int chop) {
+    csL_Buffer B;
+    int inbuff = 0; /* true if line is being accumulated in 'B' */
+    for (;;) {
+        const char *start, *nl;
+        if (avail(h) == 0 && !fillbuff(h))
+            break; /* end of file */
+        start = h->b + h->pos;
+        nl = memchr(start, '\n', avail(h));
+        if (nl != NULL) { /* found end of line? */
+            size_t l = (size_t)(nl - start);
+            h->pos += l + 1; /* skip line and newline */
+            l += !chop; /* include newline? */
+            if (!inbuff) { /* whole line is in the buffer? */
+                cs_push_lstring(C, start, l);
+                return 1;
+            }
+            csL_buff_push_lstring(&B, start, l);
+            csL_buff_end(&B);
+            return 1;
+        } else { /* save what is buffered and continue */
+            if (!inbuff) {
+                csL_buff_init(C, &B);
+                inbuff = 1;
+            }
+            csL_buff_push_lstring(&B, start, avail(h));
+            h->pos = h->n;
+        }
+    }
+    if (inbuff) { /* last line without newline */
+        csL_buff_end(&B);
+        return 1;
+    }
+    return 0; /* end of file */
+}
+
+
+/*
+** Number of bytes left to read from 'h', or NOSIZE when it is unknown
+** (streams that are not regular files).
+*/
+#define NOSIZE      (~(size_t)0)
+
+static size_t bytesleft(IOHandle *h) {
+    if (h->f == NULL) /* mapped file? */
+        return avail(h);
+#if CS_USE_MMAP
+    {
+        struct stat st;
+        long pos;
+        if (fstat(fileno(h->f), &st) == 0 && S_ISREG(st.st_mode) &&
+                (pos = ftell(h->f)) >= 0)
+            return avail(h) + ((st.st_size > pos) ? (size_t)(st.st_size - pos)
+                                                  : 0);
+    }
+#endif
+    return NOSIZE;
+}
+
+
+/* read up to 'n' bytes by buffer loads, for streams of unknown size */
+static int readchunks(cs_State *C, IOHandle *h, size_t n) {
+    size_t nr = 0;
+    csL_Buffer B;
+    csL_buff_init(C, &B);
+    while (nr < n && (avail(h) > 0 || fillbuff(h))) {
+        size_t k = (avail(h) < n - nr) ? avail(h) : n - nr;
+        csL_buff_push_lstring(&B, h->b + h->pos, k);
+        h->pos += k;
+        nr += k;
+    }
+    csL_buff_end(&B);
+    if (nr == 0) { /* nothing read? */
+        cs_pop(C, 1); /* remove empty result */
+        return 0;
+    }
+    return 1;
+}
+
+
+/*
+** Read up to 'n' bytes. Long results are read straight into the
+** string object ('cs_push_newlstring'), avoiding intermediate copies;
+** the string is never larger than what is left in the file.
+*/
+static int readchars(cs_State *C, IOHandle *h, size_t n) {
+    size_t nr; /* number of bytes actually read */
+    size_t left = bytesleft(h);
+    char *p;
+    csL_Buffer B;
+    if (left == NOSIZE && avail(h) < n)
+        return readchunks(C, h, n);
+    if (n > left) n = left; /* do not allocate beyond the end */
+    if (n == 0)
+        return 0; /* end of file */
+    if (avail(h) >= n) { /* enough buffered data? */
+        cs_push_lstring(C, h->b + h->pos, n);
+        h->pos += n;
+        return 1;
+    }
+    nr = avail(h);
+    if ((p = cs_push_newlstring(C, n)) != NULL) { /* long string? */
+        memcpy(p, h->b + h->pos, nr);
+        h->pos = h->n;
+        if (h->f != NULL) /* read rest directly from the stream */
+            nr += fread(p + nr, 1, n - nr, h->f);
+        if (nr < n) { /* short read (end of file)? */
+            cs_push_lstring(C, p, nr); /* keep only what was read */
+            cs_remove(C, -2); /* remove preallocated string */
+        }
+    } else { /* short string */
+        p = csL_buff_initsz(C, &B, n);
+        memcpy(p, h->b + h->pos, nr);
+        h->pos = h->n;
+        if (h->f != NULL)
+            nr += fread(p + nr, 1, n - nr, h->f);
+        csL_buffadd(&B, nr);
+        csL_buff_end(&B);
+    }
+    if (nr == 0) { /* nothing read? */
+        cs_pop(C, 1); /* remove empty result */
+        return 0;
+    }
+    return 1;
+}
+
+
+static void readall(cs_State *C, IOHandle *h) {
+    csL_Buffer B;
+    csL_buff_init(C, &B);
+    do { /* push buffered data, then read by full buffers */
+        csL_buff_push_lstring(&B, h->b + h->pos, avail(h));
+        h->pos = h->n;
+    } while (fillbuff(h));
+    csL_buff_end(&B);
+}
+
+
+/* test whether there is more data to read */
+static int testeof(cs_State *C, IOHandle *h) {
+    if (avail(h) > 0 || fillbuff(h)) {
+        cs_push_literal(C, "");
+        return 1;
+    }
+    return 0;
+}
+
+
+/*
+** read(f [, fmt...]) where each 'fmt' is either an integer (number of
+** bytes), "l" (line), "L" (line with newline) or "a" (rest of file).
+** Each reader pushes its result only on success; the first failure
+** results in fail and stops reading.
+*/
+static int io_read(cs_State *C) {
+    IOHandle *h = checkopen(C, 0);
+    int nargs = cs_gettop(C); /* number of formats */
+    int first = 1;
+    int success = 1;
+    int n;
+    if (nargs == 0) /* no formats? */
+        return (readline(C, h, 1) ? 1 : (csL_push_fail(C), 1));
+    csL_check_stack(C, nargs + CS_MINSTACK, "too many arguments");
+    for (n = first; nargs-- && success; n++) {
+        if (cs_type(C, n) == CS_TNUMBER) {
+            size_t l = (size_t)csL_check_integer(C, n);
+            success = (l == 0) ? testeof(C, h) : readchars(C, h, l);
+        } else {
+            const char *p = csL_check_string(C, n);
+            if (*p == '*') p++; /* skip optional '*' (for compatibility) */
+            switch (*p) {
+                case 'l': success = readline(C, h, 1); break;
+                case 'L': success = readline(C, h, 0); break;
+                case 'a': readall(C, h); success = 1; break;
+                default: return csL_error_arg(C, n, "invalid format");
+            }
+        }
+    }
+    if (!success)
+        csL_push_fail(C);
+    return n - first;
+}
+
+
+static int io_readline(cs_State *C);
+
+
+/*
+** Push the lines iterator; upvalues are the handle, whether to close
+** it when the iteration ends and whether to keep newlines.
+*/
+static void auxlines(cs_State *C, int toclose, int keepnl) {
+    cs_push_bool(C, toclose);
+    cs_push_bool(C, keepnl);
+    cs_push_cclosure(C, io_readline, 3);
+}
+
+
+static int io_readline(cs_State *C) {
+    IOHandle *h = (IOHandle *)cs_to_userdata(C, cs_upvalueindex(0));
+    if (h->kind == IO_CLOSED)
+        return csL_error(C, "file is already closed");
+    if (readline(C, h, !cs_to_bool(C, cs_upvalueindex(2))))
+        return 1;
+    if (cs_to_bool(C, cs_upvalueindex(1))) /* close at end of file? */
+        closehandle(h);
+    return 0; /* ends the iteration */
+}
+
+
+static int getkeepnl(cs_State *C, int arg) {
+    const char *fmt = csL_opt_string(C, arg, "l");
+    if (*fmt == '*') fmt++; /* skip optional '*' (for compatibility) */
+    csL_check_arg(C, (*fmt == 'l' || *fmt == 'L') && fmt[1] == '\0', arg,
+                     "invalid format");
+    return (*fmt == 'L');
+}
+
+
+/*
+** lines(f [, fmt]) iterates over the lines of handle 'f';
+** lines(filename [, fmt]) opens the file and closes it at the end.
+*/
+static int io_lines(cs_State *C) {
+    int toclose = 0;
+    int keepnl = getkeepnl(C, 1);
+    if (cs_is_string(C, 0)) { /* file name? */
+        const char *fname = cs_to_string(C, 0);
+        IOHandle *h = newhandle(C, NULL, IO_FILE);
+        h->f = fopen(fname, "r");
+        if (h->f == NULL) {
+            h->kind = IO_CLOSED;
+            return csL_error(C, "%s: %s", fname, strerror(errno));
+        }
+        toclose = 1;
+    } else {
+        checkopen(C, 0);
+        cs_push(C, 0); /* handle */
+    }
+    auxlines(C, toclose, keepnl);
+    return 1;
+}
+
+/* }====================================================================== */
+
+
+static int io_write(cs_State *C) {
+    IOHandle *h = checkopen(C, 0);
+    int nargs = cs_gettop(C);
+    int status = 1;
+    if (c_unlikely(h->f == NULL))
+        return csL_error(C, "cannot write to a mapped file");
+    status = syncbuff(h);
+    for (int arg = 1; arg <= nargs; arg++) {
+        size_t l;
+        const char *s;
+        csL_expect_arg(C, cs_is_string(C, arg) || cs_is_number(C, arg),
+                       arg, "string");
+        s = csL_to_lstring(C, arg, &l);
+        status = status && (fwrite(s, sizeof(char), l, h->f) == l);
+        cs_pop(C, 1); /* remove converted string */
+    }
+    if (c_likely(status)) {
+        cs_push(C, 0); /* return handle */
+        return 1;
+    }
+    return fileresult(C, status, NULL);
+}
+
+
+static int io_seek(cs_State *C) {
+    static const int mode[] = {SEEK_SET, SEEK_CUR, SEEK_END};
+    static const char *const modenames[] = {"set", "cur", "end", NULL};
+    IOHandle *h = checkopen(C, 0);
+    int op = csL_check_option(C, 1, "cur", modenames);
+    cs_Integer offset = csL_opt_integer(C, 2, 0);
+    if (h->f == NULL) { /* mapped file? */
+        cs_Integer base = (op == 0) ? 0 : (op == 1) ? (cs_Integer)h->pos
+                                                     : (cs_Integer)h->n;
+        csL_check_arg(C, 0 <= base + offset &&
+                         (size_t)(base + offset) <= h->n, 2,
+                         "position out of bounds");
+        h->pos = (size_t)(base + offset);
+        cs_push_integer(C, (cs_Integer)h->pos);
+        return 1;
+    } else {
+        long off = (long)offset;
+        csL_check_arg(C, (cs_Integer)off == offset, 2,
+                         "not an integer in proper range");
+        if (!syncbuff(h) || fseek(h->f, off, mode[op]) != 0)
+            return fileresult(C, 0, NULL); /* error */
+        cs_push_integer(C, (cs_Integer)ftell(h->f));
+        return 1;
+    }
+}
+
+
+static int io_flush(cs_State *C) {
+    IOHandle *h = checkopen(C, 0);
+    if (h->f == NULL) { /* nothing to flush */
+        cs_push(C, 0);
+        return 1;
+    }
+    if (fflush(h->f) == 0) {
+        cs_push(C, 0); /* return handle */
+        return 1;
+    }
+    return fileresult(C, 0, NULL);
+}
+
+
+static int io_remove(cs_State *C) {
+    const char *fname = csL_check_string(C, 0);
+    errno = 0;
+    return fileresult(C, remove(fname) == 0, fname);
+}
+
+
+static int io_close(cs_State *C) {
+    IOHandle *h = checkopen(C, 0);
+    if (h->kind == IO_STD) {
+        csL_push_fail(C);
+        cs_push_literal(C, "cannot close standard file");
+        return 2;
+    }
+    return fileresult(C, closehandle(h), NULL);
+}
+
+
+/* check whether 'mode' matches '[rwa]%+?[b]*' */
+static int checkmode(const char *mode) {
+    return (*mode != '\0' && strchr("rwa", *(mode++)) != NULL &&
+           (*mode != '+' || ((void)(++mode), 1)) && /* skip if char is '+' */
+           (strspn(mode, "b") == strlen(mode))); /* check extensions */
+}
+
+
+static int io_open(cs_State *C) {
+    const char *fname = csL_check_string(C, 0);
+    const char *mode = csL_opt_string(C, 1, "r");
+    IOHandle *h;
+    csL_check_arg(C, checkmode(mode), 1, "invalid mode");
+    h = newhandle(C, NULL, IO_FILE);
+    h->f = fopen(fname, mode);
+    if (h->f == NULL) {
+        h->kind = IO_CLOSED;
+        return fileresult(C, 0, fname);
+    }
+    return 1;
+}
+
+
+/*
+** mmap(filename) maps the file read-only into memory; the returned
+** handle supports 'read', 'lines' and 'seek' without any stream
+** buffering or system calls after the mapping. Only regular files
+** are mapped, anything else gets a buffered handle; truncating a
+** mapped file makes later reads past its new end raise SIGBUS.
+*/
+static int io_mmap(cs_State *C) {
+    const char *fname = csL_check_string(C, 0);
+    IOHandle *h = newhandle(C, NULL, IO_CLOSED);
+#if CS_USE_MMAP
+    FILE *f = fopen(fname, "rb");
+    struct stat st;
+    if (f == NULL)
+        return fileresult(C, 0, fname);
+    if (fstat(fileno(f), &st) != 0) {
+        int err = errno;
+        fclose(f);
+        errno = err;
+        return fileresult(C, 0, fname);
+    }
+    if (!S_ISREG(st.st_mode)) { /* pipe, device...? */
+        h->f = f; /* use a buffered handle */
+        h->kind = IO_FILE;
+        return 1;
+    }
+    h->b = NULL;
+    h->n = (size_t)st.st_size;
+    if (h->n > 0) { /* ('mmap' rejects empty mappings) */
+        void *p = mmap(NULL, h->n, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+        if (p == MAP_FAILED) {
+            int err = errno;
+            fclose(f);
+            h->n = 0;
+            errno = err;
+            return fileresult(C, 0, fname);
+        }
+        h->b = (char *)p;
+    }
+    fclose(f); /* mapping stays valid after closing the file */
+    h->kind = IO_MAP;
+#else
+    h->f = fopen(fname, "rb"); /* fallback to a buffered handle */
+    if (h->f == NULL)
+        return fileresult(C, 0, fname);
+    h->kind = IO_FILE;
+#endif
+    return 1;
+}
+
+
+/* type(v) returns "file", "closed file" or fail if 'v' is not a handle */
+static int io_type(cs_State *C) {
+    IOHandle *h;
+    csL_check_any(C, 0);
+    h = testhandle(C, 0);
+    if (h == NULL)
+        csL_push_fail(C);
+    else if (h->kind == IO_CLOSED)
+        cs_push_literal(C, "closed file");
+    else
+        cs_push_literal(C, "file");
+    return 1;
+}
+
+
+static const cs_Entry iolib[] = {
+    {"close", io_close},
+    {"flush", io_flush},
+    {"lines", io_lines},
+    {"mmap", io_mmap},
+    {"open", io_open},
+    {"read", io_read},
+    {"remove", io_remove},
+    {"seek", io_seek},
+    {"type", io_type},
+    {"write", io_write},
+    /* placeholders */
+    {"stdin", NULL},
+    {"stdout", NULL},
+    {"stderr", NULL},
+    {NULL, NULL}
+};
+
+
+static void createstdfile(cs_State *C, FILE *f, const char *fname) {
+    newhandle(C, f, IO_STD);
+    cs_set_fieldstr(C, -2, fname);
+}
+
+
+CSMOD_API int csopen_io(cs_State *C) {
+    csL_newlib(C, iolib);
+    createstdfile(C, stdin, "stdin");
+    createstdfile(C, stdout, "stdout");
+    createstdfile(C, stderr, "stderr");
+    return 1;
+}
@@ -85,9 +85,12 @@ static const void *const jmptable[NUM_OPCODES] = { /* ORDER OP */
     &&L_OP_NOT,
     &&L_OP_UNM,
     &&L_OP_BNOT,
+    &&L_OP_FLOOR,
+    &&L_OP_ABS,
     &&L_OP_JMP,
     &&L_OP_JMPS,
     &&L_OP_BJMP,
+    &&L_OP_SWITCH,
     &&L_OP_TEST,
     &&L_OP_TESTORPOP,
     &&L_OP_TESTANDPOP,
@@ -102,6 +105,7 @@ static const void *const jmptable[NUM_OPCODES] = { /* ORDER OP */
     &&L_OP_GETUVAL,
     &&L_OP_SETUVAL,
     &&L_OP_SETARRAY,
+    &&L_OP_SETFIELDS,
     &&L_OP_SETPROPERTY,
     &&L_OP_GETPROPERTY,
     &&L_OP_GETINDEX,
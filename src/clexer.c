@@ -8,6 +8,8 @@
 #define CS_CORE
 
 
+#include <string.h>
+
 #include "cmeta.h"
 #include "cobject.h"
 #include "ctypes.h"
@@ -27,7 +29,9 @@
 
 
 /* fetch the next character and store it as current char */
-#define advance(lx)     ((lx)->c = brgetc((lx)->br))
+#define advance(lx) \
+        ((lx)->c = brgetc((lx)->br), \
+         (c_unlikely((lx)->capture != NULL) ? capturec(lx) : (void)0))
 
 /* save current character into lexer buffer */
 #define save(lx)        savec(lx, (lx)->c)
@@ -37,6 +41,100 @@
 
 
 
+/* -----------------------------------------------------------------------
+** Character classes
+** ----------------------------------------------------------------------- */
+
+#define CIDENT      0x01    /* letter, digit or '_' */
+#define CDIGIT      0x02    /* decimal digit */
+#define CSPACE      0x04    /* blank (but not newline) */
+#define CXDIGIT     0x08    /* hexadecimal digit */
+#define CLINE       0x10    /* anything but newline (and EOF) */
+
+
+/* class table, indexed by 'c + 1' so that CSEOF has no class */
+static const c_byte cclass[UCHAR_MAX + 2] = {
+    0x00,  /* EOF */
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,  /* 0. */
+    0x10, 0x14, 0x00, 0x14, 0x14, 0x00, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,  /* 1. */
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x14, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,  /* 2. */
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b,  /* 3. */
+    0x1b, 0x1b, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x11,  /* 4. */
+    0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+    0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,  /* 5. */
+    0x11, 0x11, 0x11, 0x10, 0x10, 0x10, 0x10, 0x11,
+    0x10, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x11,  /* 6. */
+    0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+    0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,  /* 7. */
+    0x11, 0x11, 0x11, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,  /* 8. */
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,  /* 9. */
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,  /* A. */
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,  /* B. */
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,  /* C. */
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,  /* D. */
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,  /* E. */
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,  /* F. */
+    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+};
+
+
+#define testclass(c,cl)     (cclass[(c) + 1] & (cl))
+
+
+
+/* -----------------------------------------------------------------------
+** Keywords
+** ----------------------------------------------------------------------- */
+
+/*
+** Perfect hash of the reserved words (collision-free for the current
+** set, checked in 'csY_init'), lets the scanner recognize keywords
+** before interning the identifier.
+*/
+#define kwhash(s,l) \
+        (((l) + 9 * (cast_byte((s)[0]) + cast_byte((s)[(l) - 1]))) & 63)
+
+/* keyword index + 1 for each hash slot (0 if empty) */
+static const c_byte kwslot[64] = {
+    [0] = TK_LOOP - FIRSTTK + 1,
+    [1] = TK_WHILE - FIRSTTK + 1,
+    [4] = TK_INHERITS - FIRSTTK + 1,
+    [5] = TK_FOREACH - FIRSTTK + 1,
+    [9] = TK_IF - FIRSTTK + 1,
+    [11] = TK_CLASS - FIRSTTK + 1,
+    [12] = TK_CASE - FIRSTTK + 1,
+    [16] = TK_CONTINUE - FIRSTTK + 1,
+    [17] = TK_IN - FIRSTTK + 1,
+    [18] = TK_SUPER - FIRSTTK + 1,
+    [27] = TK_FOR - FIRSTTK + 1,
+    [29] = TK_LOCAL - FIRSTTK + 1,
+    [30] = TK_ELSE - FIRSTTK + 1,
+    [31] = TK_DEFAULT - FIRSTTK + 1,
+    [37] = TK_TRUE - FIRSTTK + 1,
+    [38] = TK_RETURN - FIRSTTK + 1,
+    [40] = TK_FALSE - FIRSTTK + 1,
+    [43] = TK_OR - FIRSTTK + 1,
+    [45] = TK_NIL - FIRSTTK + 1,
+    [48] = TK_AND - FIRSTTK + 1,
+    [54] = TK_FN - FIRSTTK + 1,
+    [57] = TK_SWITCH - FIRSTTK + 1,
+    [58] = TK_BREAK - FIRSTTK + 1,
+};
+
+
+
 static const char *tkstr[] = { /* ORDER TK */
     "and", "break", "case", "continue", "class",
     "default", "else", "false", "for", "foreach", "fn", "if",
@@ -68,6 +166,7 @@ void csY_setinput(cs_State *C, Lexer *lx, BuffReader *br, OString *source) {
     lx->tahead.tk = TK_EOS; /* no lookahead token */
     lx->br = br;
     lx->src = source;
+    lx->capture = NULL;
     csR_buffresize(C, lx->buff, CSI_MINBUFFER);
 }
 
@@ -78,6 +177,7 @@ void csY_init(cs_State *C) {
         OString *s = csS_new(C, tkstr[i]);
         s->extra = i + 1;
         csG_fix(C, obj2gco(s));
+        cs_assert(kwslot[kwhash(tkstr[i], strlen(tkstr[i]))] == i + 1);
     }
 }
 
@@ -99,6 +199,66 @@ c_sinline void savec(Lexer *lx, int c) {
 }
 
 
+/* pushes 'n' characters from 'b' into token buffer */
+static void savebuff(Lexer *lx, const char *b, size_t n) {
+    Buffer *buff = lx->buff;
+    if (csR_bufflen(buff) + n > csR_buffsize(buff)) {
+        size_t newsize = csR_buffsize(buff);
+        if (c_unlikely(n >= MAXSIZE / 2 - csR_bufflen(buff)))
+            lexerror(lx, "lexical element too long", 0);
+        while (newsize < csR_bufflen(buff) + n)
+            newsize *= 2;
+        csR_buffresize(lx->C, buff, newsize);
+    }
+    memcpy(csR_buff(buff) + csR_bufflen(buff), b, n);
+    csR_bufflen(buff) += n;
+}
+
+
+/* copy current char into the capture buffer */
+static void capturec(Lexer *lx) {
+    Buffer *b = lx->capture;
+    if (lx->c == CSEOF) return;
+    if (csR_bufflen(b) >= csR_buffsize(b)) {
+        size_t newsize;
+        if (csR_buffsize(b) >= MAXSIZE / 2)
+            lexerror(lx, "function body too long", 0);
+        newsize = (csR_buffsize(b) > 0 ? csR_buffsize(b) * 2 : CSI_MINBUFFER);
+        csR_buffresize(lx->C, b, newsize);
+    }
+    csR_buff(b)[csR_bufflen(b)++] = cast_char(lx->c);
+}
+
+
+/*
+** Start copying raw source into 'b', beginning with the current
+** (single char) token 'tk'. There must be no lookahead token, as
+** its source was already consumed.
+*/
+void csY_startcapture(Lexer *lx, Buffer *b, int tk) {
+    int c = lx->c;
+    cs_assert(lx->tahead.tk == TK_EOS && tk < FIRSTTK);
+    csR_buffreset(b);
+    lx->capture = b;
+    lx->c = tk; capturec(lx); /* the token itself... */
+    lx->c = c; capturec(lx); /* ...and the char already read after it */
+}
+
+
+/*
+** Stop copying raw source, the copy ends with the current (single char)
+** token 'tk'. The char read after that token is not part of the copy.
+*/
+void csY_endcapture(Lexer *lx, int tk) {
+    Buffer *b = lx->capture;
+    lx->capture = NULL;
+    if (lx->c != CSEOF) /* read past 'tk'? */
+        csR_buffpop(b); /* remove that char */
+    cs_assert(csR_bufflen(b) > 0 && csR_buff(b)[csR_bufflen(b) - 1] == tk);
+    UNUSED(tk);
+}
+
+
 /* if current char matches 'c' advance */
 c_sinline int lxmatch(Lexer *lx, int c) {
     if (c == lx->c) {
@@ -181,14 +341,62 @@ OString *csY_newstring(Lexer *lx, const char *str, size_t len) {
 }
 
 
+/* return keyword token for identifier in 'buff' or 0 if not reserved */
+c_sinline int getkeyword(const char *buff, size_t len) {
+    if (len >= 2 && len <= 8) { /* ('in', 'if', ... 'continue') */
+        int i = kwslot[kwhash(buff, len)];
+        if (i != 0 && strncmp(tkstr[i - 1], buff, len) == 0 &&
+                      tkstr[i - 1][len] == '\0')
+            return i - 1 + FIRSTTK;
+    }
+    return 0;
+}
+
+
+/*
+** Consume the run of characters of class 'cl' starting at the current
+** char, saving them into the lexer buffer if 'dosave'. The run is
+** taken in bulk straight from the reader buffer instead of char by
+** char (unless raw source is being captured). Returns the length of
+** the run.
+*/
+static size_t readrun(Lexer *lx, int cl, int dosave) {
+    BuffReader *br = lx->br;
+    size_t n = 0;
+    if (c_unlikely(lx->capture != NULL)) { /* slow path */
+        for (; testclass(lx->c, cl); n++) {
+            if (dosave) save(lx);
+            advance(lx);
+        }
+        return n;
+    }
+    while (testclass(lx->c, cl)) {
+        const char *p = br->buff;
+        const char *end = p + br->n;
+        size_t len;
+        while (p < end && testclass(cast_byte(*p), cl))
+            p++;
+        len = cast_sizet(p - br->buff);
+        if (dosave) {
+            save(lx); /* current char... */
+            savebuff(lx, br->buff, len); /* ...and the rest of the run */
+        }
+        br->buff = p;
+        br->n -= len;
+        n += len + 1;
+        lx->c = brgetc(br);
+    }
+    return n;
+}
+
+
 /* -----------------------------------------------------------------------
 ** Read comments
 ** ----------------------------------------------------------------------- */
 
 /* read single line comment */
 static void read_comment(Lexer *lx) {
-    while (!currIsEnd(lx) && !currIsNewline(lx))
-        advance(lx);
+    readrun(lx, CLINE, 0);
 }
 
 
@@ -437,6 +645,8 @@ static int lexstr2num(Lexer *lx, Literal *k) {
 */
 static int read_digits(Lexer *lx, DigType dt, int fp) {
     int digits = 0;
+    if (dt == DigDec) /* common case, take digits in bulk */
+        digits = cast_int(readrun(lx, CDIGIT, 1));
     for (;;) {
         if (!fp && lx->c == '_') /* digits separator? */
             goto only_read; /* skip */
@@ -564,7 +774,7 @@ static int scan(Lexer *lx, Literal *k) {
     for (;;) {
         switch (lx->c) {
             case ' ': case '\t': case '\f': case '\v': {
-                advance(lx);
+                readrun(lx, CSPACE, 0);
                 break;
             }
             case '\n': case '\r':  {
@@ -649,18 +859,15 @@ static int scan(Lexer *lx, Literal *k) {
                 return TK_EOS;
             }
             default: {
-                if (cisalpha(lx->c) || lx->c == '_') {
-                    OString *s;
-                    do {
-                        save_and_advance(lx);
-                    } while (cisalnum(lx->c) || lx->c == '_');
-                    s = csY_newstring(lx, csR_buff(lx->buff),
-                                          csR_bufflen(lx->buff));
-                    k->str = s;
-                    if (isreserved(s))
-                        return s->extra + FIRSTTK - 1;
-                    else
-                        return TK_NAME;
+                if (testclass(lx->c, CIDENT)) { /* identifier? */
+                    int tk;
+                    readrun(lx, CIDENT, 1);
+                    tk = getkeyword(csR_buff(lx->buff), csR_bufflen(lx->buff));
+                    if (tk != 0) /* reserved word? */
+                        return tk;
+                    k->str = csY_newstring(lx, csR_buff(lx->buff),
+                                               csR_bufflen(lx->buff));
+                    return TK_NAME;
                 } else {
                     int c = lx->c;
                     advance(lx);
@@ -687,6 +894,6 @@ void csY_scan(Lexer *lx) {
 /* fetch next token into 'tahead' */
 int csY_scanahead(Lexer *lx) {
     cs_assert(lx->t.tk != TK_EOS);
-    lx->tahead.tk = scan(lx, &lx->t.lit);
+    lx->tahead.tk = scan(lx, &lx->tahead.lit);
     return lx->tahead.tk;
 }
@@ -65,6 +65,7 @@ typedef struct Lexer {
     Buffer *buff; /* string buffer */
     struct ParserState *ps; /* dynamic data used by parser */
     OString *src; /* current source name */
+    Buffer *capture; /* if not NULL, raw source is copied here */
 } Lexer;
 
 
@@ -76,5 +77,7 @@ CSI_FUNC OString *csY_newstring(Lexer *lx, const char *str, size_t len);
 CSI_FUNC c_noret csY_syntaxerror(Lexer *lx, const char *err);
 CSI_FUNC void csY_scan(Lexer *lx);
 CSI_FUNC int csY_scanahead(Lexer *lx);
+CSI_FUNC void csY_startcapture(Lexer *lx, Buffer *b, int tk);
+CSI_FUNC void csY_endcapture(Lexer *lx, int tk);
 
 #endif
@@ -160,6 +160,63 @@ typedef c_byte Instruction;
 #endif
 
 
+/*
+** Size of cache for open upvalues (direct-mapped by stack slot), must
+** be a power of 2.
+*/
+#if !defined(UVCACHE_N)
+#define UVCACHE_N	    64
+#endif
+
+
+/*
+** Maximum number of temporary table sites per function (table
+** constructors whose table never escapes the frame, see 'OP_NEWTABLE').
+*/
+#if !defined(MAXTMPTABS)
+#define MAXTMPTABS	    4
+#endif
+
+
+/*
+** Hash table engine: 0 uses chained scatter tables with Brent's
+** variation; 1 uses open addressing with a separate array of control
+** bytes probed in groups of 16 slots ("Swiss tables"), see 'ctable.c'.
+*/
+#if !defined(CSI_SWISSTABLE)
+#define CSI_SWISSTABLE	    0
+#endif
+
+
+/*
+** Hash arrays with at least CSI_REHASHMIN nodes grow incrementally:
+** the table keeps its old array and every insertion of a new key moves
+** CSI_REHASHSTEP nodes of it into the new one, so that no insertion
+** pays for the whole rehash. Setting CSI_REHASHSTEP to 0 disables it.
+*/
+#if !defined(CSI_REHASHMIN)
+#define CSI_REHASHMIN       (1 << 12)
+#endif
+
+#if !defined(CSI_REHASHSTEP)
+#define CSI_REHASHSTEP      64
+#endif
+
+
+/*
+** Collected objects of at most CSI_POOLMAX bytes (a multiple of the
+** pointer size) are kept in per-size pools, up to CSI_POOLLIMIT bytes
+** in total, and reused for new objects of the same size instead of
+** going through the allocator. Setting CSI_POOLLIMIT to 0 disables it.
+*/
+#if !defined(CSI_POOLMAX)
+#define CSI_POOLMAX         128
+#endif
+
+#if !defined(CSI_POOLLIMIT)
+#define CSI_POOLLIMIT       (1 << 18)
+#endif
+
 
 /*
 ** Minimum size for string buffer during lexing, this buffer memory
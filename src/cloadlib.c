@@ -7,9 +7,39 @@
 #define cloadlib_c
 #define CS_LIB
 
+
+/*
+** @CS_USE_CHUNKCACHE controls whether 'include' keeps compiled chunks
+** on disk (cached chunks are validated with 'stat').
+*/
+#if !defined(CS_USE_CHUNKCACHE)
+#if defined(__unix__) || defined(__APPLE__) || defined(_WIN32)
+#define CS_USE_CHUNKCACHE   1
+#else
+#define CS_USE_CHUNKCACHE   0
+#endif
+#endif
+
+
+#if CS_USE_CHUNKCACHE && defined(__unix__) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE     200809L /* 'stat' */
+#endif
+
+
 #include <string.h>
 #include <stdlib.h>
 
+#if CS_USE_CHUNKCACHE
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <process.h>
+#define cachepid()      ((long)_getpid())
+#else
+#include <unistd.h>
+#define cachepid()      ((long)getpid())
+#endif
+#endif
+
 #include "cscript.h"
 
 #include "ctrace.h"
@@ -30,6 +60,13 @@
 */
 static const char *const CLIBS = "__CLIBS";
 
+
+/*
+** Key for table in the global table that caches resolved file names,
+** PATHCACHE[path][modname] = filename.
+*/
+static const char *const PATHCACHE = "__PATHCACHE";
+
 #define LIB_FAIL    "open"
 
 
@@ -200,7 +237,7 @@ static cs_CFunction csys_symbolf(cs_State *C, void *lib, const char *sym) {
 
 
 static int searcher_preload(cs_State *C) {
-    const char *name = csL_check_string(C, 1);
+    const char *name = csL_check_string(C, 0);
     cs_push_globaltable(C); /* get __G table */
     cs_get_fieldstr(C, -1, CS_PRELOAD_TABLE); /* get __PRELOAD table */
     if (cs_get_fieldstr(C, -1, name) == CS_TNIL) { /* not found? */
@@ -379,14 +416,44 @@ static int l_searchpath(cs_State *C) {
 }
 
 
+/* push PATHCACHE[path] */
+static void getpathcache(cs_State *C, const char *path) {
+    cs_push_globaltable(C);
+    csL_get_subtable(C, -1, PATHCACHE);
+    csL_get_subtable(C, -1, path);
+    cs_rotate(C, -3, 1); /* move it below global table and PATHCACHE */
+    cs_pop(C, 2);
+}
+
+
+/*
+** Search 'name' in 'package[pname]'. File names resolved before are
+** remembered, so each later search for 'name' (with the same path)
+** only checks that the file is still readable.
+*/
 static const char *findfile(cs_State *C, const char *name, const char *pname,
                             const char *dirsep) {
     const char *path;
+    const char *filename;
+    int cache;
     cs_get_fieldstr(C, cs_upvalueindex(0), pname);
     path = cs_to_string(C, -1);
     if (c_unlikely(path == NULL))
         csL_error(C, "'package.%s' must be a string", pname);
-    return searchpath(C, name, path, ".", dirsep);
+    getpathcache(C, path);
+    cache = cs_gettop(C);
+    if (cs_get_fieldstr(C, -1, name) == CS_TSTRING) { /* resolved before? */
+        filename = cs_to_string(C, -1);
+        if (readable(filename)) /* still there? */
+            return filename;
+    }
+    cs_pop(C, 1); /* remove cached entry */
+    filename = searchpath(C, name, path, ".", dirsep);
+    if (filename != NULL) { /* found it? */
+        cs_push(C, -1);
+        cs_set_fieldstr(C, cache, name); /* PATHCACHE[path][name] = filename */
+    }
+    return filename;
 }
 
 
@@ -396,16 +463,230 @@ static int checkload(cs_State *C, int res, const char *filename) {
         return 2; /* return open function and file name */
     } else
         return csL_error(C, "error loading module '%s' from file '%s':\n\t%s",
-                            cs_to_string(C, 1), filename, cs_to_string(C, -1));
+                            cs_to_string(C, 0), filename, cs_to_string(C, -1));
+}
+
+
+/*
+** {======================================================================
+** Compiled-chunk cache
+** =======================================================================
+*/
+
+/*
+** Compiled module 'file.cst' is saved as 'file.cst' CS_CACHE_SUFFIX,
+** either next to it or, if 'package.cachedir' is a string, inside that
+** directory (with the directory separators in the file name replaced
+** by CS_CACHE_SEP). Setting 'package.cachedir' to false disables the
+** cache. Each cached chunk starts with a header holding the source
+** file name, size and modification time; it is used only while all of
+** them still match and 'cs_load' accepts the chunk itself (whose own
+** header checks the version and format of the interpreter that wrote
+** it), otherwise the module is loaded from source again.
+*/
+#if !defined(CS_CACHE_SUFFIX)
+#define CS_CACHE_SUFFIX     "c"
+#endif
+
+#if !defined(CS_CACHE_SEP)
+#define CS_CACHE_SEP        "%"
+#endif
+
+/*
+** CS_CACHEDIR_VAR is the name of the environment variable that sets
+** the initial 'package.cachedir'.
+*/
+#if !defined(CS_CACHEDIR_VAR)
+#define CS_CACHEDIR_VAR     "CS_CACHEDIR"
+#endif
+
+#define CACHE_MAGIC     "\x1b" "CSCache"
+
+
+#if CS_USE_CHUNKCACHE
+
+typedef struct CacheKey {
+    cs_Integer size;
+    cs_Integer mtime;
+} CacheKey;
+
+
+static int getcachekey(const char *filename, CacheKey *key) {
+    struct stat st;
+    if (stat(filename, &st) != 0) return 0;
+    memset(key, 0, sizeof(*key)); /* no garbage in padding */
+    key->size = (cs_Integer)st.st_size;
+    key->mtime = (cs_Integer)st.st_mtime;
+    return 1;
+}
+
+
+/*
+** Push name of the cached chunk for 'filename'; returns NULL (pushing
+** nothing) if the cache is disabled.
+*/
+static const char *cachename(cs_State *C, const char *filename) {
+    int t = cs_get_fieldstr(C, cs_upvalueindex(0), "cachedir");
+    if (t == CS_TSTRING) {
+        const char *dir = cs_to_string(C, -1);
+        const char *name = csL_gsub(C, filename, CS_DIRSEP, CS_CACHE_SEP);
+        cs_push_fstring(C, "%s" CS_DIRSEP "%s" CS_CACHE_SUFFIX, dir, name);
+        cs_rotate(C, -3, 1); /* move it below 'dir' and 'name' */
+        cs_pop(C, 2);
+    } else if (t == CS_TNIL) { /* next to the source? */
+        cs_pop(C, 1);
+        cs_push_fstring(C, "%s" CS_CACHE_SUFFIX, filename);
+    } else { /* cache disabled */
+        cs_pop(C, 1);
+        return NULL;
+    }
+    return cs_to_string(C, -1);
+}
+
+
+typedef struct LoadCache {
+    FILE *f;
+    char buff[BUFSIZ];
+} LoadCache;
+
+
+static const char *cachereader(cs_State *C, void *ud, size_t *size) {
+    LoadCache *lc = (LoadCache *)ud;
+    (void)C; /* not used */
+    if (feof(lc->f)) return NULL;
+    *size = fread(lc->buff, 1, sizeof(lc->buff), lc->f);
+    return lc->buff;
+}
+
+
+/* check that cached chunk in 'lc' was compiled from 'filename' */
+static int checkcache(LoadCache *lc, const char *filename,
+                      const CacheKey *key) {
+    char magic[sizeof(CACHE_MAGIC) - 1];
+    CacheKey ckey;
+    size_t len = strlen(filename);
+    size_t clen;
+    if (fread(magic, 1, sizeof(magic), lc->f) != sizeof(magic) ||
+        memcmp(magic, CACHE_MAGIC, sizeof(magic)) != 0 ||
+        fread(&ckey, sizeof(ckey), 1, lc->f) != 1 ||
+        memcmp(&ckey, key, sizeof(ckey)) != 0 ||
+        fread(&clen, sizeof(clen), 1, lc->f) != 1 || clen != len)
+        return 0;
+    while (len > 0) { /* compare file names */
+        size_t n = (len < sizeof(lc->buff)) ? len : sizeof(lc->buff);
+        if (fread(lc->buff, 1, n, lc->f) != n ||
+            memcmp(lc->buff, filename, n) != 0)
+            return 0;
+        filename += n;
+        len -= n;
+    }
+    return 1;
+}
+
+
+/*
+** Try to load the cached chunk 'cname' of 'filename'; returns true
+** (and the function on top) on success, otherwise pushes nothing.
+*/
+static int loadcache(cs_State *C, const char *cname, const char *filename,
+                     const CacheKey *key) {
+    LoadCache lc;
+    int ok = 0;
+    lc.f = fopen(cname, "rb");
+    if (lc.f == NULL) return 0;
+    if (checkcache(&lc, filename, key)) {
+        if (cs_load(C, cachereader, &lc, filename, "b") == CS_OK)
+            ok = 1;
+        else
+            cs_pop(C, 1); /* remove error message */
+    }
+    fclose(lc.f);
+    return ok;
+}
+
+
+static int cachewriter(cs_State *C, const void *p, size_t size, void *ud) {
+    (void)C; /* not used */
+    return (fwrite(p, 1, size, (FILE *)ud) != size);
+}
+
+
+/*
+** Save function on top as cached chunk 'cname' of 'filename'. The
+** chunk is written into a temporary file which then replaces 'cname'
+** at once, so concurrent readers never see partial chunks. The name of
+** the temporary file is unique to the process and state, so concurrent
+** writers do not overwrite each other's chunks. Failures are ignored,
+** the cache is only an optimization.
+*/
+static void savecache(cs_State *C, const char *cname, const char *filename,
+                      const CacheKey *key) {
+    const char *tmpname = cs_push_fstring(C, "%s.%I-%p.tmp", cname,
+                                          (cs_Integer)cachepid(),
+                                          (void *)C);
+    size_t len = strlen(filename);
+    int err;
+    FILE *f = fopen(tmpname, "wb");
+    if (f == NULL) {
+        cs_pop(C, 1); /* remove 'tmpname' */
+        return;
+    }
+    err = (fwrite(CACHE_MAGIC, 1, sizeof(CACHE_MAGIC) - 1, f)
+                != sizeof(CACHE_MAGIC) - 1 ||
+           fwrite(key, sizeof(*key), 1, f) != 1 ||
+           fwrite(&len, sizeof(len), 1, f) != 1 ||
+           fwrite(filename, 1, len, f) != len);
+    cs_push(C, -2); /* function to dump */
+    err = (err || cs_dump(C, cachewriter, f, 0) != 0);
+    cs_pop(C, 1); /* remove function copy */
+    err = (fclose(f) != 0 || err);
+    if (!err && rename(tmpname, cname) != 0) { /* could not replace? */
+        remove(cname);
+        err = (rename(tmpname, cname) != 0);
+    }
+    if (err)
+        remove(tmpname);
+    cs_pop(C, 1); /* remove 'tmpname' */
 }
 
 
+/*
+** Load module 'filename', from its cached chunk when it is up to date,
+** otherwise from source (refreshing the cached chunk).
+*/
+static int loadmodule(cs_State *C, const char *filename) {
+    CacheKey key;
+    const char *cname;
+    int status;
+    if (!getcachekey(filename, &key) ||
+            (cname = cachename(C, filename)) == NULL)
+        return csL_loadfile(C, filename);
+    if (loadcache(C, cname, filename, &key)) {
+        cs_remove(C, -2); /* remove 'cname' */
+        return CS_OK;
+    }
+    status = csL_loadfile(C, filename);
+    if (status == CS_OK)
+        savecache(C, cname, filename, &key);
+    cs_remove(C, -2); /* remove 'cname' */
+    return status;
+}
+
+#else
+
+#define loadmodule(C,filename)      csL_loadfile(C, filename)
+
+#endif
+
+/* }====================================================================== */
+
+
 static int searcher_CScript(cs_State *C) {
     const char *filename;
-    const char *name = csL_check_string(C, 1);
+    const char *name = csL_check_string(C, 0);
     filename = findfile(C, name, "path", CS_DIRSEP);
     if (filename == NULL) return 1; /* module not found in this path */
-    return checkload(C, (csL_loadfile(C, filename) == CS_OK), filename);
+    return checkload(C, (loadmodule(C, filename) == CS_OK), filename);
 }
 
 
@@ -431,7 +712,7 @@ static void findloader(cs_State *C, const char *name) {
         csL_error(C, "'package.searchers' must be array value");
     csL_buff_init(C, &msg);
     /* iterate over available searchers to find a loader */
-    for (i = 1; ; i++) {
+    for (i = 0; ; i++) {
         csL_buff_push_string(&msg, "\n\t"); /* error-message prefix */
         if (c_unlikely(cs_get_index(C, 2, i) == CS_TNIL)) { /* no more searchers? */
             cs_pop(C, 1); /* remove nil */
@@ -654,6 +935,16 @@ static void setpath(cs_State *C, const char *fieldname, const char *envname,
 }
 
 
+/* set 'package.cachedir' from environment (stays nil if unset) */
+static void setcachedir(cs_State *C) {
+    const char *dir = getenv(CS_CACHEDIR_VAR);
+    if (dir != NULL && !noenv(C)) {
+        cs_push_string(C, dir);
+        cs_set_fieldstr(C, -2, "cachedir");
+    }
+}
+
+
 CSMOD_API int csopen_package(cs_State *C) {
     cs_push_globaltable(C);
     createclibs(C);
@@ -662,6 +953,7 @@ CSMOD_API int csopen_package(cs_State *C) {
     /* set paths */
     setpath(C, "path", CS_PATH_VAR, CS_PATH_DEFAULT);
     setpath(C, "cpath", CS_CPATH_VAR, CS_CPATH_DEFAULT);
+    setcachedir(C);
     /* package.config = configstring */
     cs_push_literal(C, CS_DIRSEP "\n" CS_PATH_SEP "\n" CS_PATH_MARK "\n"
                        CS_EXEC_DIR "\n" CS_IGMARK "\n");
@@ -0,0 +1,348 @@
+/*
+** cmathlib.c
+** Standard mathematical library
+** See Copyright Notice in cscript.h
+*/
+
+
+#define CS_LIB
+
+
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "cscript.h"
+
+#include "cauxlib.h"
+#include "cslib.h"
+
+
+
+#undef PI
+#define PI      (cs_mathop(3.141592653589793238462643383279502884))
+
+
+/*
+** Floor/ceil of float 'f' into an integer if it fits, else float.
+** Conversion mirrors the core 'csO_n2i' ('N2IFLOOR'/'N2ICEIL') so that
+** the library functions and the compiler intrinsics ('OP_FLOOR')
+** return identical results.
+*/
+static void pushnumint(cs_State *C, cs_Number f) {
+    cs_Integer n;
+    if (cs_number2integer(f, &n))
+        cs_push_integer(C, n);
+    else
+        cs_push_number(C, f);
+}
+
+
+static int m_abs(cs_State *C) {
+    if (cs_is_integer(C, 0)) {
+        cs_Integer n = cs_to_integer(C, 0);
+        if (n < 0) n = csL_intop(-, 0, n);
+        cs_push_integer(C, n);
+    } else
+        cs_push_number(C, cs_mathop(fabs)(csL_check_number(C, 0)));
+    return 1;
+}
+
+
+static int m_floor(cs_State *C) {
+    if (cs_is_integer(C, 0))
+        cs_setntop(C, 1); /* integer is its own floor */
+    else
+        pushnumint(C, cs_mathop(floor)(csL_check_number(C, 0)));
+    return 1;
+}
+
+
+static int m_ceil(cs_State *C) {
+    if (cs_is_integer(C, 0))
+        cs_setntop(C, 1); /* integer is its own ceiling */
+    else
+        pushnumint(C, cs_mathop(ceil)(csL_check_number(C, 0)));
+    return 1;
+}
+
+
+static int m_sqrt(cs_State *C) {
+    cs_push_number(C, cs_mathop(sqrt)(csL_check_number(C, 0)));
+    return 1;
+}
+
+
+static int m_fmod(cs_State *C) {
+    if (cs_is_integer(C, 0) && cs_is_integer(C, 1)) {
+        cs_Integer d = cs_to_integer(C, 1);
+        if ((cs_Unsigned)d + 1u <= 1u) { /* special cases: -1 or 0 */
+            csL_check_arg(C, d != 0, 1, "zero");
+            cs_push_integer(C, 0); /* avoid overflow with 0x80000... / -1 */
+        } else /* C '%' truncates, like 'fmod' */
+            cs_push_integer(C, cs_to_integer(C, 0) % d);
+    } else
+        cs_push_number(C, cs_mathop(fmod)(csL_check_number(C, 0),
+                                          csL_check_number(C, 1)));
+    return 1;
+}
+
+
+/*
+** Integer division rounding towards minus infinity (same as '//' in
+** most languages), with the remainder as second result.
+*/
+static int m_idiv(cs_State *C) {
+    cs_Integer m = csL_check_integer(C, 0);
+    cs_Integer n = csL_check_integer(C, 1);
+    cs_Integer q, r;
+    if (c_unlikely((cs_Unsigned)n + 1u <= 1u)) { /* special cases: -1 or 0 */
+        csL_check_arg(C, n != 0, 1, "zero");
+        q = csL_intop(-, 0, m); /* n == -1; avoid overflow */
+        r = 0;
+    } else {
+        q = m / n; /* C division truncates towards zero */
+        r = m % n;
+        if (r != 0 && (r ^ n) < 0) { /* signs differ? */
+            q -= 1; /* correct result for floor division */
+            r += n;
+        }
+    }
+    cs_push_integer(C, q);
+    cs_push_integer(C, r);
+    return 2;
+}
+
+
+static int m_tointeger(cs_State *C) {
+    int isnum;
+    cs_Integer n = cs_to_integerx(C, 0, &isnum);
+    if (isnum)
+        cs_push_integer(C, n);
+    else {
+        csL_check_any(C, 0);
+        csL_push_fail(C); /* value is not convertible to integer */
+    }
+    return 1;
+}
+
+
+static int m_minmax(cs_State *C, int op) {
+    int n = cs_gettop(C) + 1; /* number of arguments */
+    int imin = 0; /* index of current extreme value */
+    csL_check_arg(C, n >= 1, 0, "value expected");
+    csL_check_number(C, 0);
+    for (int i = 1; i < n; i++) {
+        csL_check_number(C, i);
+        if (op ? cs_compare(C, imin, i, CS_OPLT)
+               : cs_compare(C, i, imin, CS_OPLT))
+            imin = i;
+    }
+    cs_push(C, imin);
+    return 1;
+}
+
+
+static int m_min(cs_State *C) {
+    return m_minmax(C, 0);
+}
+
+
+static int m_max(cs_State *C) {
+    return m_minmax(C, 1);
+}
+
+
+
+/* {=====================================================================
+** Pseudo-Random Number Generator (xoshiro256**)
+** ====================================================================== */
+
+typedef unsigned long long Rand64;
+
+
+/* rotate left 'x' by 'n' bits */
+static Rand64 rotl(Rand64 x, int n) {
+    return (x << n) | (x >> (64 - n));
+}
+
+
+static Rand64 nextrand(Rand64 *state) {
+    Rand64 state0 = state[0];
+    Rand64 state1 = state[1];
+    Rand64 state2 = state[2] ^ state0;
+    Rand64 state3 = state[3] ^ state1;
+    Rand64 res = rotl(state1 * 5, 7) * 9;
+    state1 <<= 17;
+    state[0] = state0 ^ state3;
+    state[1] = state0 ^ state2;
+    state[2] = state2 ^ state1;
+    state[3] = rotl(state3, 45);
+    return res;
+}
+
+
+/* must throw out the extra (64 - FIGS) bits */
+#define FIGS        (DBL_MANT_DIG > 64 ? 64 : DBL_MANT_DIG)
+#define shift64_FIG (64 - FIGS)
+
+/* to scale to [0, 1), multiply by 2^(-FIGS) */
+#define scaleFIG    (cs_mathop(0.5) / ((Rand64)1 << (FIGS - 1)))
+
+
+/* convert random bits into a float in the interval [0, 1) */
+static cs_Number I2d(Rand64 x) {
+    return (cs_Number)(x >> shift64_FIG) * scaleFIG;
+}
+
+
+/*
+** Project a random integer 'ran' into the interval [0, n].
+** Computes the smallest (2^b - 1) not smaller than 'n' and uses it as
+** a mask; if the result is still out of range, draws another value.
+*/
+static cs_Unsigned project(cs_Unsigned ran, cs_Unsigned n, Rand64 *state) {
+    if ((n & (n + 1)) == 0) /* is 'n + 1' a power of 2? */
+        return ran & n;
+    else {
+        cs_Unsigned lim = n;
+        /* compute the smallest (2^b - 1) not smaller than n */
+        lim |= (lim >> 1);
+        lim |= (lim >> 2);
+        lim |= (lim >> 4);
+        lim |= (lim >> 8);
+        lim |= (lim >> 16);
+#if (CS_UNSIGNED_MAX >> 31) >= 3
+        lim |= (lim >> 32);
+#endif
+        while ((ran &= lim) > n) /* project 'ran' into [0, lim] */
+            ran = (cs_Unsigned)nextrand(state); /* not inside [0, n]? */
+        return ran;
+    }
+}
+
+
+/*
+** random()     -> float in [0, 1)
+** random(n)    -> integer in [0, n) (valid array index for length 'n')
+** random(m, n) -> integer in [m, n]
+*/
+static int m_random(cs_State *C) {
+    cs_Integer low, up;
+    Rand64 *state = (Rand64 *)cs_to_userdata(C, cs_upvalueindex(0));
+    Rand64 rv = nextrand(state);
+    switch (cs_gettop(C) + 1) {
+        case 0: {
+            cs_push_number(C, I2d(rv));
+            return 1;
+        }
+        case 1: {
+            low = 0;
+            up = csL_check_integer(C, 0);
+            csL_check_arg(C, up > 0, 0, "interval is empty");
+            up--; /* exclusive upper bound */
+            break;
+        }
+        case 2: {
+            low = csL_check_integer(C, 0);
+            up = csL_check_integer(C, 1);
+            break;
+        }
+        default: return csL_error(C, "wrong number of arguments");
+    }
+    csL_check_arg(C, low <= up, 1, "interval is empty");
+    cs_push_integer(C, (cs_Integer)(project((cs_Unsigned)rv,
+                                   (cs_Unsigned)up - (cs_Unsigned)low,
+                                   state) + (cs_Unsigned)low));
+    return 1;
+}
+
+
+static void setseed(cs_State *C, Rand64 *state, cs_Unsigned n1,
+                    cs_Unsigned n2) {
+    state[0] = (Rand64)n1; /* avoid a zero state */
+    state[1] = (Rand64)0xff;
+    state[2] = (Rand64)n2;
+    state[3] = (Rand64)0;
+    for (int i = 0; i < 16; i++)
+        nextrand(state); /* discard initial values to "spread" seed */
+    cs_push_integer(C, (cs_Integer)n1);
+    cs_push_integer(C, (cs_Integer)n2);
+}
+
+
+/* seed from the current time and the address of 'C' */
+static void randseed(cs_State *C, Rand64 *state) {
+    cs_Unsigned seed1 = (cs_Unsigned)time(NULL);
+    cs_Unsigned seed2 = (cs_Unsigned)(size_t)C;
+    setseed(C, state, seed1, seed2);
+}
+
+
+static int m_randomseed(cs_State *C) {
+    Rand64 *state = (Rand64 *)cs_to_userdata(C, cs_upvalueindex(0));
+    if (cs_is_none(C, 0))
+        randseed(C, state);
+    else {
+        cs_Integer n1 = csL_check_integer(C, 0);
+        cs_Integer n2 = csL_opt_integer(C, 1, 0);
+        setseed(C, state, (cs_Unsigned)n1, (cs_Unsigned)n2);
+    }
+    return 2;
+}
+
+
+static const cs_Entry randfuncs[] = {
+    {"random", m_random},
+    {"randomseed", m_randomseed},
+    {NULL, NULL}
+};
+
+
+/* register random functions with a shared state as their upvalue */
+static void setrandfuncs(cs_State *C) {
+    Rand64 *state = (Rand64 *)cs_newuserdata(C, 4 * sizeof(Rand64), 0);
+    randseed(C, state);
+    cs_pop(C, 2); /* remove pushed seeds */
+    csL_setfuncs(C, randfuncs, 1);
+}
+
+/* }===================================================================== */
+
+
+static const cs_Entry mathlib[] = {
+    {"abs", m_abs},
+    {"ceil", m_ceil},
+    {"floor", m_floor},
+    {"fmod", m_fmod},
+    {"idiv", m_idiv},
+    {"max", m_max},
+    {"min", m_min},
+    {"sqrt", m_sqrt},
+    {"tointeger", m_tointeger},
+    /* placeholders */
+    {"random", NULL},
+    {"randomseed", NULL},
+    {"pi", NULL},
+    {"huge", NULL},
+    {"maxinteger", NULL},
+    {"mininteger", NULL},
+    {NULL, NULL}
+};
+
+
+CSMOD_API int csopen_math(cs_State *C) {
+    csL_newlib(C, mathlib);
+    cs_push_number(C, PI);
+    cs_set_fieldstr(C, -2, "pi");
+    cs_push_number(C, (cs_Number)HUGE_VAL);
+    cs_set_fieldstr(C, -2, "huge");
+    cs_push_integer(C, CS_INTEGER_MAX);
+    cs_set_fieldstr(C, -2, "maxinteger");
+    cs_push_integer(C, CS_INTEGER_MIN);
+    cs_set_fieldstr(C, -2, "mininteger");
+    setrandfuncs(C);
+    return 1;
+}
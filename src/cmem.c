@@ -145,3 +145,63 @@ void csM_free_(cs_State *C, void *ptr, size_t osz) {
     callfalloc(gs, ptr, osz, 0);
     gs->gcdebt -= osz;
 }
+
+
+
+/* -----------------------------------------------------------------------
+** Object pools
+** ----------------------------------------------------------------------- */
+
+/*
+** Collected objects are not handed back to the allocator one by one
+** while sweeping; small ones go into the pool for their size (a list
+** linked through the first word of each block) and new objects of the
+** same size take them from there. Blocks in pools count as freed, so
+** 'gcdebt' does not depend on where a block comes from or goes to.
+*/
+
+/* true if blocks of 'sz' bytes can be kept in a pool */
+#define poolable(sz)         ((sz) <= CSI_POOLMAX && (sz) % sizeof(void *) == 0)
+
+/* index of the pool for blocks of 'sz' bytes */
+#define poolindex(sz)       ((sz) / sizeof(void *) - 1)
+
+
+void *csM_newobj_(cs_State *C, size_t size, int tag) {
+    GState *gs = G(C);
+    if (poolable(size) && gs->pools[poolindex(size)] != NULL) {
+        void **block = cast(void **, gs->pools[poolindex(size)]);
+        gs->pools[poolindex(size)] = *block; /* remove it from the pool */
+        gs->poolbytes -= size;
+        gs->gcdebt += size;
+        return block;
+    }
+    return csM_malloc_(C, size, tag);
+}
+
+
+void csM_freeobj_(cs_State *C, void *ptr, size_t size) {
+    GState *gs = G(C);
+    if (poolable(size) && gs->poolbytes + size <= CSI_POOLLIMIT) {
+        *cast(void **, ptr) = gs->pools[poolindex(size)];
+        gs->pools[poolindex(size)] = ptr; /* insert it in the pool */
+        gs->poolbytes += size;
+        gs->gcdebt -= size;
+    } else
+        csM_free_(C, ptr, size);
+}
+
+
+/* give all blocks in pools back to the allocator */
+void csM_freepools(cs_State *C) {
+    GState *gs = G(C);
+    for (size_t i = 0; i < CSI_POOLMAX / sizeof(void *); i++) {
+        size_t size = (i + 1) * sizeof(void *);
+        while (gs->pools[i] != NULL) {
+            void **block = cast(void **, gs->pools[i]);
+            gs->pools[i] = *block;
+            callfalloc(gs, block, size, 0); /* (already out of 'gcdebt') */
+        }
+    }
+    gs->poolbytes = 0;
+}
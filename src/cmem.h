@@ -17,11 +17,12 @@
 
 #define csM_new(C,t)            csM_malloc_(C, sizeof(t), 0)
 #define csM_newarray(C,s,t)     csM_malloc_(C, (s)*sizeof(t), 0)
-#define csM_newobj(C,tag,sz)    csM_malloc_(C, (sz), tag)
+#define csM_newobj(C,tag,sz)    csM_newobj_(C, (sz), tag)
 
 #define csM_free(C,p)           csM_free_(C, p, sizeof(*(p)))
 #define csM_freemem(C,p,sz)     csM_free_((C), (p), (sz))
 #define csM_freearray(C,p,n)    csM_free_((C), (p), (n)*sizeof(*(p)))
+#define csM_freeobj(C,p,sz)     csM_freeobj_((C), (p), (sz))
 
 #define csM_reallocarray(C,p,os,ns) \
         ((p) = csM_realloc_(C, p, (os)*sizeof(*(p)), (ns)*sizeof(*(p))))
@@ -43,6 +44,9 @@ CSI_FUNC void *csM_saferealloc(cs_State *C, void *ptr, c_mem osize,
                                c_mem nsize);
 CSI_FUNC c_noret csM_toobig(cs_State *C);
 CSI_FUNC void csM_free_(cs_State *C, void *ptr, c_mem osize);
+CSI_FUNC void *csM_newobj_(cs_State *C, c_mem size, int tag);
+CSI_FUNC void csM_freeobj_(cs_State *C, void *ptr, c_mem size);
+CSI_FUNC void csM_freepools(cs_State *C);
 CSI_FUNC void *csM_growarr_(cs_State *C, void *ptr, int *sizep, int len,
                            int elemsz, int ensure, int lim, const char *what);
 CSI_FUNC void *csM_shrinkarr_(cs_State *C, void *ptr, int *sizep, int final,
@@ -55,7 +55,7 @@ static cs_Number numarithm(cs_State *C, cs_Number x, cs_Number y, int op) {
         case CS_OPDIV: return c_numdiv(C, x, y);
         case CS_OPMOD: return csV_modnum(C, x, y);
         case CS_OPPOW: return c_numpow(C, x, y);
-        case CS_OPUNM: return c_nummul(C, x, y);
+        case CS_OPUNM: return c_numunm(C, x);
         default: cs_assert(0); return 0.0;
     }
 }
@@ -87,7 +87,7 @@ int csO_n2i(cs_Number n, cs_Integer *i, N2IMode mode) {
         if (mode == N2IEXACT) return 0;
         else if (mode == N2ICEIL) floored++;
     }
-    return cs_number2integer(n, i);
+    return cs_number2integer(floored, i);
 }
 
 
@@ -418,8 +418,18 @@ typedef union Node {
 typedef struct Table {
     ObjectHeader; /* internal only object */
     c_byte size; /* 2^size */
+    c_byte oldsize; /* 2^oldsize nodes in 'oldnode' */
+    c_byte mode; /* weak keys and/or values (see 'cs_set_mode') */
     Node *node; /* memory block */
+    uint *hashes; /* cached hash of each node key (after 'node') */
+    Node *oldnode; /* hash array being moved into 'node' or NULL */
+    int oldpos; /* nodes of 'oldnode' before this one were moved */
+#if CSI_SWISSTABLE
+    c_byte *ctrl; /* control bytes, one per node */
+    int growthleft; /* keys that can be inserted before rehashing */
+#else
     Node *lastfree; /* any free position is before this position */
+#endif
     GCObject *gclist;
 } Table;
 
@@ -594,13 +604,31 @@ typedef struct LVarInfo {
 ** computation of a line number: we can use binary search in the
 ** absolute-line array, but we must traverse the 'lineinfo' array
 ** linearly to compute a line.)
+** As instructions are variable-length, 'lineinfo' is indexed by
+** instruction and not by 'pc'; 'idx' maps the entry back to it.
 */
 typedef struct AbsLineInfo {
-    int pc;
+    int pc;     /* byte offset of the instruction */
+    int idx;    /* index of the instruction in 'lineinfo' */
     int line;
 } AbsLineInfo;
 
 
+/*
+** Jump table of a 'switch' statement ('OP_SWITCH'). Cases whose labels
+** form a dense integer range are kept in 'jmps' (indexed from 'lo');
+** any other set of constant labels is kept in the table 't', mapping
+** each label to the 'pc' of its body. Values not found jump to 'dflt'.
+*/
+typedef struct SwitchTable {
+    Table *t;           /* label -> target (NULL if dense) */
+    int *jmps;          /* targets of dense integer labels */
+    cs_Integer lo;      /* label of 'jmps[0]' */
+    int sizejmps;       /* size of 'jmps' */
+    int dflt;           /* target when value does not match any label */
+} SwitchTable;
+
+
 /*
 ** Function Prototypes.
 */
@@ -615,19 +643,24 @@ typedef struct Proto {
     int sizeupvals;         /* size of 'upvals' */
     int sizelineinfo;       /* size of 'lineinfo' */
     int sizeabslineinfo;    /* size of 'abslineinfo' */
-    int sizeinstpc;         /* size of 'instpc' */
     int sizelocals;         /* size of 'locals' */
+    int sizeswtabs;         /* size of 'swtabs' */
+    int sizetmptabs;        /* size of 'tmptabs' */
     int defline;            /* function definition line (debug) */
     int deflastline;        /* function definition last line (debug) */
+    int lazyline;           /* line where 'lazysrc' starts */
     struct Proto **p;       /* list of funcs defined inside of this function */
     TValue *k;              /* constant values */
     Instruction *code;      /* bytecode */
     UpValInfo *upvals;      /* debug information for upvalues */
     c_sbyte *lineinfo;      /* information about source lines (debug) */
     AbsLineInfo *abslineinfo; /* idem */
-    int *instpc;            /* list of pc's for each instruction (debug) */
     LVarInfo *locals;       /* information about local variables (debug) */
+    SwitchTable *swtabs;    /* jump tables of 'switch' statements */
     OString *source;        /* source name (debug information) */
+    OString *lazysrc;       /* source of body not yet compiled (or NULL) */
+    struct CSClosure *cache; /* last-created closure (weak, or NULL) */
+    struct Table **tmptabs; /* free temporary tables (weak, or NULL) */
     GCObject *gclist;
 } Proto;
 
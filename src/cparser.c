@@ -133,7 +133,7 @@ static void rmpatchlists(Lexer *lx, int limit) {
 
 static void storecontext(FunctionState *fs, FuncContext *ctx) {
     ParserState *ps = fs->lx->ps;
-    ctx->ninstpc = fs->ninstpc;
+    ctx->ninstr = fs->ninstr;
     ctx->loopstart = fs->loopstart;
     ctx->prevpc = fs->prevpc;
     ctx->prevline = fs->prevline;
@@ -156,7 +156,7 @@ static void storecontext(FunctionState *fs, FuncContext *ctx) {
 
 static void loadcontext(FunctionState *fs, FuncContext *ctx) {
     ParserState *ps = fs->lx->ps;
-    fs->ninstpc = ctx->ninstpc;
+    fs->ninstr = ctx->ninstr;
     fs->loopstart = ctx->loopstart;
     fs->prevpc = ctx->prevpc;
     fs->prevline = ctx->prevline;
@@ -294,14 +294,33 @@ static void continuepop(FunctionState *fs) {
 }
 
 
+/*
+** Local variable 'lvar' goes out of scope; if the table it was
+** initialized with never escaped (it was only indexed), its constructor
+** becomes a temporary site, that is, the frame reuses the same table
+** on each execution of the constructor (see 'OP_NEWTABLE').
+*/
+static void tmptablesite(FunctionState *fs, LVar *lvar) {
+    int pc = lvar->s.newpc;
+    if (pc != -1 && pc < currPC && fs->ntmptabs < MAXTMPTABS) {
+        Instruction *inst = &fs->p->code[pc];
+        if (*inst == OP_NEWTABLE && GETARG_S(inst, 1) == 0)
+            SETARG_S(inst, 1, ++fs->ntmptabs);
+    }
+}
+
+
 /* 
 ** Remove local variables up to 'tolevel'.
 */
 static void removelocals(FunctionState *fs, int tolevel) {
-    fs->lx->ps->actlocals.len -= (fs->nactlocals - tolevel);
-    cs_assert(fs->lx->ps->actlocals.len >= 0);
-    while (fs->nactlocals > tolevel) /* set debug information */
-        getlocalinfo(fs, --fs->nactlocals)->endpc = currPC;
+    int len = fs->lx->ps->actlocals.len - (fs->nactlocals - tolevel);
+    cs_assert(len >= 0);
+    while (fs->nactlocals > tolevel) { /* set debug information */
+        tmptablesite(fs, getlocalvar(fs, --fs->nactlocals));
+        getlocalinfo(fs, fs->nactlocals)->endpc = currPC;
+    }
+    fs->lx->ps->actlocals.len = len;
 }
 
 
@@ -311,7 +330,8 @@ static int finishpatchlist(FunctionState *fs, int level) {
     int hasclose = 0;
     if (!isdummy(j)) { /* have jump? */
         Instruction *jmp = &fs->p->code[j->jmp];
-        if (j->jmp == fs->prevpc) { /* no offset jump? */
+        if (j->jmp == fs->prevpc && fs->lasttarget != currPC) {
+            /* no offset jump (and nothing else jumps past it) */
             csC_removelastjump(fs); /* remove it */
             j = poplistjump(l); /* get the next jump (if any) */
         }
@@ -324,7 +344,8 @@ static int finishpatchlist(FunctionState *fs, int level) {
             } else { /* otherwise 'break' jump */
                 cs_assert(*jmp == OP_BJMP);
                 hasclose |= j->e.hasclose;
-                csC_patchtohere(fs, j->jmp);
+                if (j->jmp != fs->prevpc) /* (else it has no offset) */
+                    csC_patchtohere(fs, j->jmp);
                 SETARG_L(jmp, 1, j->nactlocals - level);
             }
             cs_assert(j->nactlocals >= level);
@@ -433,6 +454,21 @@ static void leavescope(FunctionState *fs) {
 }
 
 
+/*
+** Value of local variable in stack slot 'sidx' escapes (it is read
+** as a whole, not just indexed), so it can't hold a temporary table.
+*/
+static void escapelocal(FunctionState *fs, int sidx) {
+    for (int i = fs->nactlocals - 1; 0 <= i; i--) {
+        LVar *lvar = getlocalvar(fs, i);
+        if (lvar->s.sidx == sidx) {
+            lvar->s.newpc = -1;
+            break;
+        }
+    }
+}
+
+
 /* 
 ** Mark scope where variable at idx 'vidx' was defined
 ** in order to emit close instruction before the scope
@@ -440,6 +476,7 @@ static void leavescope(FunctionState *fs) {
 */
 static void scopemarkupval(FunctionState *fs, int vidx) {
     Scope *s = fs->scope;
+    escapelocal(fs, vidx); /* captured value escapes */
     while(s->nactlocals - 1 > vidx)
         s = s->prev;
     s->haveupval = 1;
@@ -467,7 +504,7 @@ static void open_func(Lexer *lx, FunctionState *fs, Scope *s) {
     lx->fs = fs;
     fs->scope = fs->loopscope = fs->switchscope = NULL;
     fs->loopstart = NOJMP;
-    currPC = fs->prevpc = 0;
+    currPC = fs->prevpc = fs->lasttarget = 0;
     fs->prevline = p->defline;
     fs->sp = 0;
     fs->nactlocals = 0;
@@ -475,9 +512,11 @@ static void open_func(Lexer *lx, FunctionState *fs, Scope *s) {
     fs->np = 0;
     fs->nk = 0;
     fs->nabslineinfo = 0;
-    fs->ninstpc = 0;
+    fs->ninstr = 0;
     fs->nlocals = 0;
     fs->nupvals = 0;
+    fs->nswtabs = 0;
+    fs->ntmptabs = 0;
     fs->iwthabs = fs->needclose = fs->lastwasret = 0;
     p->source = lx->src;
     csG_objbarrier(lx->C, p, p->source);
@@ -499,12 +538,18 @@ static void close_func(Lexer *lx) {
     csM_shrinkarray(C, p->p, p->sizep, fs->np, Proto);
     csM_shrinkarray(C, p->k, p->sizek, fs->nk, TValue);
     csM_shrinkarray(C, p->code, p->sizecode, currPC, Instruction);
-    csM_shrinkarray(C, p->lineinfo, p->sizelineinfo, currPC, c_sbyte);
+    csM_shrinkarray(C, p->lineinfo, p->sizelineinfo, fs->ninstr, c_sbyte);
     csM_shrinkarray(C, p->abslineinfo, p->sizeabslineinfo, fs->nabslineinfo,
                         AbsLineInfo);
-    csM_shrinkarray(C, p->instpc, p->sizeinstpc, fs->ninstpc, int);
     csM_shrinkarray(C, p->locals, p->sizelocals, fs->nlocals, LVarInfo);
     csM_shrinkarray(C, p->upvals, p->sizeupvals, fs->nupvals, UpValInfo);
+    csM_shrinkarray(C, p->swtabs, p->sizeswtabs, fs->nswtabs, SwitchTable);
+    if (fs->ntmptabs > 0) { /* have temporary table sites? */
+        p->tmptabs = csM_newarray(C, fs->ntmptabs, Table *);
+        for (int i = 0; i < fs->ntmptabs; i++)
+            p->tmptabs[i] = NULL;
+        p->sizetmptabs = fs->ntmptabs;
+    }
     lx->fs = fs->prev; /* go back to enclosing function (if any) */
     csG_checkGC(C); /* try to collect garbage memory */
 #if DISASSEMBLE_BYTECODE
@@ -541,7 +586,7 @@ static void setvararg(FunctionState *fs, int arity) {
 
 
 /* forward declare (can be both part of statement and expression) */
-static void funcbody(Lexer *lx, ExpInfo *v, int linenum, int ismethod);
+static void funcbody(Lexer *lx, ExpInfo *v, int ismethod, int line);
 
 /* forward declare recursive non-terminals */
 static void decl(Lexer *lx);
@@ -615,6 +660,7 @@ static int addlocal(Lexer *lx, OString *name) {
     local->s.kind = VARREG;
     local->s.name = name;
     local->s.pidx = -1;
+    local->s.newpc = -1;
     return ps->actlocals.len - fs->firstlocal - 1;
 }
 
@@ -624,9 +670,12 @@ static int addlocal(Lexer *lx, OString *name) {
 
 
 /*
-** Searches for local variable 'name'.
+** Searches for local variable 'name'. Compile-time constants are
+** resolved to their value (EXP_CONST) only if 'ctc' is true,
+** otherwise they are seen as the regular locals holding them.
 */
-static int searchlocal(FunctionState *fs, OString *name, ExpInfo *e, int limit) {
+static int searchlocal(FunctionState *fs, OString *name, ExpInfo *e,
+                       int limit, int ctc) {
     for (int i = fs->nactlocals - 1; 0 <= i && limit < i; i--) {
         LVar *lvar = getlocalvar(fs, i);
         if (eqstr(name, lvar->s.name)) { /* found? */
@@ -635,6 +684,9 @@ static int searchlocal(FunctionState *fs, OString *name, ExpInfo *e, int limit)
                     "can't read local variable '%s' in its own initializer",
                     getstr(name));
                 csP_semerror(fs->lx, msg);
+            } else if (ctc && lvar->s.kind == VARCTC) { /* constant? */
+                initexp(e, EXP_CONST, fs->firstlocal + i);
+                return e->et;
             } else {
                 initexp(e, EXP_LOCAL, lvar->s.sidx);
                 return e->et;
@@ -694,19 +746,22 @@ static int searchupvalue(FunctionState *fs, OString *name) {
 /*
 ** Find a variable with the given name. If it is upvalue add this upvalue
 ** into all intermediate functions. If it is not found, set 'var' as EXP_VOID.
+** Compile-time constants of enclosing functions are not captured (when
+** 'ctc' is true), their value is used directly.
 */
-static void varaux(FunctionState *fs, OString *name, ExpInfo *var, int base) {
+static void varaux(FunctionState *fs, OString *name, ExpInfo *var, int base,
+                   int ctc) {
     if (fs == NULL) { /* last scope? */
         voidexp(var); /* not found */
     } else { /* otherwise search... */
-        int ret = searchlocal(fs, name, var, -1); /* ...locals */
+        int ret = searchlocal(fs, name, var, -1, ctc); /* ...locals */
         if (ret >= 0) { /* found? */
             if (ret == EXP_LOCAL && !base) /* in recursive call to varaux? */
                 scopemarkupval(fs, var->u.info); /* mark scope appropriately */
         } else { /* if not found try searching for upvalue */
             ret = searchupvalue(fs, name);
             if (ret < 0) { /* still not found? */
-                varaux(fs->prev, name, var, 0); /* try enclosing 'fs' */
+                varaux(fs->prev, name, var, 0, ctc); /* try enclosing 'fs' */
                 if (var->et == EXP_LOCAL || var->et == EXP_UVAL) /* found? */
                     ret = addupvalue(fs, name, var); /* add upvalue to 'fs' */
                 else /* otherwise not found (EXP_VOID) */
@@ -719,8 +774,8 @@ static void varaux(FunctionState *fs, OString *name, ExpInfo *var, int base) {
 
 
 /* find variable 'name' */
-static void var(Lexer *lx, OString *varname, ExpInfo *var) {
-    varaux(lx->fs, varname, var, 1);
+static void findvar(Lexer *lx, OString *varname, ExpInfo *var) {
+    varaux(lx->fs, varname, var, 1, 1);
     if (var->et == EXP_VOID) { /* global name? */
         var->et = EXP_GLOBAL;
         var->u.str = varname;
@@ -728,6 +783,14 @@ static void var(Lexer *lx, OString *varname, ExpInfo *var) {
 }
 
 
+/* find variable 'name' whose value escapes */
+static void var(Lexer *lx, OString *varname, ExpInfo *var) {
+    findvar(lx, varname, var);
+    if (var->et == EXP_LOCAL)
+        escapelocal(lx->fs, var->u.info);
+}
+
+
 #define varlit(lx,l,e)      var(lx, csY_newstring(lx, "" l, SLL(l)), e)
 
 
@@ -822,7 +885,9 @@ static void primaryexp(Lexer *lx, ExpInfo *e) {
         csC_varexp2stack(lx->fs, e);
         break;
     case TK_NAME:
-        var(lx, str_expectname(lx), e);
+        findvar(lx, str_expectname(lx), e);
+        if (e->et == EXP_LOCAL && !check(lx, '.') && !check(lx, '['))
+            escapelocal(lx->fs, e->u.info); /* not only indexed */
         break;
     case TK_SUPER:
         superkw(lx, e);
@@ -862,6 +927,109 @@ static void call(Lexer *lx, ExpInfo *e) {
 }
 
 
+/*
+** Calls to these 'math' library functions are compiled into dedicated
+** opcodes instead of a function call. This is done only when 'math' is
+** a global variable (not shadowed by a local or an upvalue) and the
+** call has exactly one argument; the binding is therefore resolved at
+** compile time, reassigning 'math.floor' at runtime does not affect
+** already compiled intrinsic calls.
+*/
+static const struct {
+    const char *name;
+    OpCode op;
+} intrinsics[] = {
+    {"floor", OP_FLOOR},
+    {"abs", OP_ABS},
+};
+
+
+/* return intrinsic opcode for 'math.name', or -1 if none */
+static int getintrinsic(OString *name) {
+    for (uint i = 0; i < sizeof(intrinsics)/sizeof(intrinsics[0]); i++) {
+        if (strcmp(getstr(name), intrinsics[i].name) == 0)
+            return intrinsics[i].op;
+    }
+    return -1;
+}
+
+
+/* check if 'e' is the global 'math' library table */
+static int ismathlib(const ExpInfo *e) {
+    return (e->et == EXP_GLOBAL && strcmp(getstr(e->u.str), "math") == 0);
+}
+
+
+/*
+** Regular call to 'math.name' with more than one argument, where the
+** first one 'e' is already on the stack: the function is loaded above
+** it and called with a copy of it followed by the remaining arguments,
+** and the result then replaces the original first argument.
+*/
+static void mathcall(Lexer *lx, ExpInfo *e, ExpInfo *lib, ExpInfo *key,
+                     int line) {
+    FunctionState *fs = lx->fs;
+    int arg = fs->sp - 1; /* first argument */
+    int base;
+    ExpInfo var;
+    csC_exp2stack(fs, lib);
+    csC_getfield(fs, lib, key, 0);
+    csC_exp2stack(fs, lib); /* put func on stack */
+    base = fs->sp - 1;
+    initexp(&var, EXP_LOCAL, arg);
+    csC_exp2stack(fs, &var); /* copy of the first argument */
+    csY_scan(lx); /* skip ',' */
+    explist(lx, e);
+    if (eismulret(e))
+        csC_setmulret(fs, e);
+    else
+        csC_exp2stack(fs, e);
+    expectmatch(lx, ')', '(', line);
+    initexp(e, EXP_CALL, csC_emitILL(fs, OP_CALL, base, 2));
+    csC_fixline(fs, line);
+    fs->sp = base + 1;
+    csC_exp2stack(fs, e); /* single result */
+    initexp(&var, EXP_LOCAL, arg);
+    csC_store(fs, &var); /* over the first argument */
+    initexp(e, EXP_FINEXPR, var.u.info);
+}
+
+
+/*
+** mathfield ::= '.' name
+**             | '.' intrinsic '(' expr ')'
+**
+** Calls to an intrinsic without arguments or with more than one are
+** compiled as regular calls.
+*/
+static void mathfield(Lexer *lx, ExpInfo *v) {
+    FunctionState *fs = lx->fs;
+    ExpInfo lib = *v; /* 'math' (not loaded yet) */
+    ExpInfo key;
+    int op;
+    voidexp(&key);
+    csY_scan(lx); /* skip '.' */
+    expname(lx, &key);
+    if (check(lx, '(') && (op = getintrinsic(key.u.str)) >= 0 &&
+            csY_scanahead(lx) != ')') {
+        int line = lx->line;
+        csY_scan(lx); /* skip '(' */
+        expr(lx, v); /* first argument ('math' was never loaded) */
+        csC_exp2stack(fs, v);
+        if (check(lx, ',')) /* more arguments? */
+            mathcall(lx, v, &lib, &key, line);
+        else {
+            expectmatch(lx, ')', '(', line);
+            initexp(v, EXP_FINEXPR, csC_emitI(fs, op));
+            csC_fixline(fs, line);
+        }
+    } else { /* regular field access */
+        csC_exp2stack(fs, v);
+        csC_getfield(fs, v, &key, 0);
+    }
+}
+
+
 /*
 ** suffixedexpr ::= primaryexp
 **               | primaryexp dotaccess
@@ -873,7 +1041,10 @@ static void suffixedexp(Lexer *lx, ExpInfo *e) {
     for (;;) {
         switch (lx->t.tk) {
             case '.': {
-                getfield(lx, e, 0);
+                if (ismathlib(e))
+                    mathfield(lx, e);
+                else
+                    getfield(lx, e, 0);
                 break;
             }
             case '[': {
@@ -899,8 +1070,8 @@ typedef struct Constructor {
             int tostore; /* number of array elements pending to be stored */
         } a; /* array */
         struct {
-            ExpInfo *t; /* table descriptor */
             int nh; /* total number of table elements */
+            int tostore; /* number of fields pending to be stored */
         } t; /* table */
     } u;
 } Constructor;
@@ -978,27 +1149,32 @@ static void tabindex(Lexer *lx, ExpInfo *e) {
 /*
 ** tabfield ::= name '=' expr
 **            | tabindex '=' expr
+** Keys and values are left on the stack and stored in batches by
+** SETFIELDS (see 'closetabfields').
 */
 static void tabfield(Lexer *lx, Constructor *c) {
     FunctionState *fs = lx->fs;
-    int sp = fs->sp;
-    int extra;
-    ExpInfo tab, key, val;
-    UNUSED(sp); /* used only for assertion */
+    ExpInfo key, val;
     if (check(lx, TK_NAME)) {
         checklimit(fs, c->u.t.nh, MAXINT, "records in a table constructor");
         expname(lx, &key);
     } else
         tabindex(lx, &key);
+    csC_exp2stack(fs, &key); /* put key on stack... */
     c->u.t.nh++;
     expectnext(lx, '=');
-    tab = *c->u.t.t;
-    csC_indexed(fs, &tab, &key, 0); /* ensure key is in proper place... */
     expr(lx, &val); /* get key value... */
-    csC_exp2stack(fs, &val); /* put it on stack... */
-    extra = csC_store(fs, &tab); /* ...and do the store */
-    csC_pop(fs, extra); /* pop potential key value */
-    cs_assert(fs->sp == sp);
+    csC_exp2stack(fs, &val); /* ...and put it on stack */
+    c->u.t.tostore++;
+}
+
+
+/* store pending table fields if there are 'limit' or more of them */
+static void closetabfields(FunctionState *fs, Constructor *c, int limit) {
+    if (c->u.t.tostore > 0 && c->u.t.tostore >= limit) {
+        csC_setfields(fs, c->u.t.tostore);
+        c->u.t.tostore = 0;
+    }
 }
 
 
@@ -1009,18 +1185,19 @@ static void tabfield(Lexer *lx, Constructor *c) {
 static void tableexp(Lexer *lx, ExpInfo *t) {
     FunctionState *fs = lx->fs;
     int line = lx->line;
-    int pc = csC_emitIS(fs, OP_NEWTABLE, 0);
+    int pc = csC_emitISS(fs, OP_NEWTABLE, 0, 0);
     Constructor c;
-    c.u.t.nh = 0;
-    c.u.t.t = t;
+    c.u.t.nh = c.u.t.tostore = 0;
     expectnext(lx, '{');
     initexp(t, EXP_FINEXPR, pc); /* finalize table expression */
     csC_reserveslots(fs, 1); /* space for table */
     do { /* while have table fields */
         if (check(lx, '}')) break; /* delimiter; no more field */
+        closetabfields(fs, &c, TABFIELDS_PER_FLUSH); /* flush full batch */
         tabfield(lx, &c);
     } while (match(lx, ',') || match(lx, ';'));
     expectmatch(lx, '}', '{', line);
+    closetabfields(fs, &c, 1); /* store remaining fields */
     csC_settablesize(fs, pc, c.u.t.nh);
 }
 
@@ -1195,8 +1372,10 @@ static Binopr subexpr(Lexer *lx, ExpInfo *e, int limit) {
         csY_scan(lx); /* skip operator */
         subexpr(lx, e, UNARY_PRIORITY);
         csC_unary(lx->fs, e, uop, line);
-    } else
+    } else {
         simpleexp(lx, e);
+        csC_const2exp(lx->fs, e); /* propagate compile-time constant */
+    }
     op = getbinopr(lx->t.tk);
     while (op != OPR_NOBINOPR && priority[op].left > limit) {
         ExpInfo e2;
@@ -1251,15 +1430,19 @@ static void checkreadonly(Lexer *lx, ExpInfo *var) {
     FunctionState *fs = lx->fs;
     OString *varid = NULL;
     switch (var->et) {
+    case EXP_CONST: {
+        varid = lx->ps->actlocals.arr[var->u.info].s.name;
+        break;
+    }
     case EXP_UVAL: {
         UpValInfo *uv = &fs->p->upvals[var->u.info];
-        if (uv->kind == VARFINAL)
+        if (uv->kind == VARFINAL || uv->kind == VARCTC)
             varid = uv->name;
         break;
     }
     case EXP_LOCAL: {
         LVar *lv = getlocalvar(fs, var->u.info);
-        if (lv->s.kind == VARFINAL)
+        if (lv->s.kind == VARFINAL || lv->s.kind == VARCTC)
             varid = lv->s.name;
         break;
     }
@@ -1315,8 +1498,8 @@ struct LHS_assign {
 */
 static int assign(Lexer *lx, struct LHS_assign *lhs, int nvars) {
     int left = 0; /* number of values left in the stack after assignment */
-    expect_cond(lx, eisvar(&lhs->v), "expect variable");
     checkreadonly(lx, &lhs->v);
+    expect_cond(lx, eisvar(&lhs->v), "expect variable");
     if (match(lx, ',')) { /* more vars ? */
         struct LHS_assign var;
         var.prev = lhs; /* chain previous variable */
@@ -1384,7 +1567,7 @@ static int getlocalattribute(Lexer *lx) {
 static int newlocalvar(Lexer *lx, OString *name) {
     int limit = lx->fs->scope->nactlocals - 1;
     ExpInfo dummy;
-    if (c_unlikely(searchlocal(lx->fs, name, &dummy, limit) >= 0))
+    if (c_unlikely(searchlocal(lx->fs, name, &dummy, limit, 0) >= 0))
         csP_semerror(lx, csS_pushfstring(lx->C,
                      "redefinition of local variable '%s'", getstr(name)));
     return addlocal(lx, name);
@@ -1409,13 +1592,14 @@ static void localstm(Lexer *lx) {
     int nvars = 0;
     int kind, vidx;
     int nexps;
+    int pc;
     ExpInfo e;
     voidexp(&e);
     do {
         vidx = newlocalvar(lx, str_expectname(lx)); /* create new local... */
         kind = getlocalattribute(lx); /* get its attribute... */
         getlocalvar(fs, vidx)->s.kind = kind; /* ...and set it */
-        if (kind & VARTBC) { /* to-be-closed? */
+        if (kind == VARTBC) { /* to-be-closed? */
             if (toclose != -1) /* one already present? */
                 csP_semerror(fs->lx,
                         "multiple to-be-closed variables in a local list");
@@ -1423,11 +1607,20 @@ static void localstm(Lexer *lx) {
         }
         nvars++;
     } while (match(lx, ','));
+    pc = currPC;
     if (match(lx, '='))
         nexps = explist(lx, &e);
     else
         nexps = 0;
     cs_assert((nexps == 0) == (e.et == EXP_VOID));
+    if (nvars == 1 && nexps == 1 && kind != VARTBC && e.et == EXP_FINEXPR &&
+            e.u.info == pc && e.t == e.f && fs->p->code[pc] == OP_NEWTABLE)
+        getlocalvar(fs, vidx)->s.newpc = pc; /* table constructor */
+    if (nvars == nexps && kind == VARFINAL) { /* last one is 'final'? */
+        LVar *lvar = getlocalvar(fs, vidx);
+        if (csC_exp2const(fs, &e, &lvar->val)) /* constant initializer? */
+            lvar->s.kind = VARCTC; /* reads will use the value directly */
+    }
     adjustassign(lx, nvars, nexps, &e);
     adjustlocals(lx, nvars);
     checkclose(fs, toclose);
@@ -1619,20 +1812,15 @@ static void paramlist(Lexer *lx) {
 
 
 /* emit closure instruction */
-static void codeclosure(Lexer *lx, ExpInfo *e) {
-    FunctionState *fs = lx->fs->prev;
+static void codeclosure(FunctionState *fs, ExpInfo *e) {
     initexp(e, EXP_FINEXPR, csC_emitIL(fs, OP_CLOSURE, fs->np - 1));
     csC_reserveslots(fs, 1); /* space for closure */
 }
 
 
-/* funcbody ::= '(' paramlist ')' stmlist */
-static void funcbody(Lexer *lx, ExpInfo *v, int ismethod, int line) {
-    FunctionState newfs;
-    Scope scope;
-    newfs.p = addproto(lx);
-    newfs.p->defline = line;
-    open_func(lx, &newfs, &scope);
+/* body ::= '(' paramlist ')' '{' stmlist '}' */
+static void body(Lexer *lx, int ismethod, int line) {
+    FunctionState *fs = lx->fs;
     expectnext(lx, '(');
     if (ismethod) { /* is this method ? */
         addlocallit(lx, "self"); /* create 'self' */
@@ -1644,10 +1832,99 @@ static void funcbody(Lexer *lx, ExpInfo *v, int ismethod, int line) {
     line = lx->line; /* line where '{' is located */
     expectnext(lx, '{');
     decl_list(lx, '}'); /* function body */
-    newfs.p->deflastline = lx->line;
+    fs->p->deflastline = lx->line;
     expectmatch(lx, '}', '{', line);
-    codeclosure(lx, v);
-    close_func(lx);
+}
+
+
+/*
+** Check if 'name' as seen from 'fs' is a variable (local or upvalue)
+** that can be captured; globals and locals still in their own
+** initializer are not.
+*/
+static int iscapturable(FunctionState *fs, OString *name) {
+    for (; fs != NULL; fs = fs->prev) {
+        for (int i = fs->nactlocals - 1; 0 <= i; i--) {
+            LVar *lvar = getlocalvar(fs, i);
+            if (eqstr(name, lvar->s.name))
+                return (lvar->s.pidx != -1);
+        }
+        if (searchupvalue(fs, name) >= 0)
+            return 1;
+    }
+    return 0;
+}
+
+
+/* capture 'name' (if it is a variable) as upvalue of skipped function */
+static void lazyupvalue(FunctionState *fs, OString *name) {
+    if (searchupvalue(fs, name) < 0 && iscapturable(fs->prev, name)) {
+        ExpInfo e;
+        varaux(fs->prev, name, &e, 0, 0); /* (body can't see constants) */
+        cs_assert(e.et == EXP_LOCAL || e.et == EXP_UVAL);
+        addupvalue(fs, name, &e);
+    }
+}
+
+
+/*
+** Pre-parse function body: skip it recording only its source, while
+** every name in it that refers to a variable of the enclosing functions
+** becomes an upvalue (names that end up shadowed, or that are only
+** used as fields, are captured needlessly, which is harmless). The
+** body is compiled by 'csP_parselazy' when the closure is first created.
+*/
+static void lazybody(Lexer *lx, Proto *p) {
+    cs_State *C = lx->C;
+    Buffer *b = &lx->ps->capture;
+    FunctionState fs; /* just enough state to add upvalues */
+    int depth = 0;
+    fs.p = p;
+    fs.prev = lx->fs;
+    fs.lx = lx;
+    fs.nupvals = 0;
+    p->source = lx->src;
+    csG_objbarrier(C, p, p->source);
+    expect(lx, '(');
+    p->lazyline = lx->line;
+    csY_startcapture(lx, b, '(');
+    for (;;) {
+        csY_scan(lx);
+        switch (lx->t.tk) {
+            case TK_NAME: lazyupvalue(&fs, lx->t.lit.str); break;
+            case '{': depth++; break;
+            case '}': if (--depth == 0) goto done; break;
+            case TK_EOS: expecterror(lx, '}');
+            default: break;
+        }
+    }
+done:
+    csY_endcapture(lx, '}');
+    p->deflastline = lx->line;
+    csM_shrinkarray(C, p->upvals, p->sizeupvals, fs.nupvals, UpValInfo);
+    p->lazysrc = csS_newl(C, csR_buff(b), csR_bufflen(b));
+    csG_objbarrier(C, p, p->lazysrc);
+    csY_scan(lx); /* skip '}' */
+}
+
+
+/* funcbody ::= body */
+static void funcbody(Lexer *lx, ExpInfo *v, int ismethod, int line) {
+    Proto *p = addproto(lx);
+    p->defline = line;
+    if (lx->ps->lazy && !ismethod && lx->ps->cs == NULL &&
+                        lx->tahead.tk == TK_EOS) {
+        lazybody(lx, p);
+        codeclosure(lx->fs, v);
+    } else {
+        FunctionState newfs;
+        Scope scope;
+        newfs.p = p;
+        open_func(lx, &newfs, &scope);
+        body(lx, ismethod, line);
+        codeclosure(newfs.prev, v);
+        close_func(lx);
+    }
 }
 
 
@@ -1674,7 +1951,7 @@ static void fnstm(Lexer *lx, int linenum) {
     ExpInfo var, e;
     csY_scan(lx); /* skip 'fn' */
     stmname(lx, &var, &leftover);
-    funcbody(lx, &e, linenum, 0);
+    funcbody(lx, &e, 0, linenum);
     checkreadonly(lx, &var);
     csC_store(fs, &var);
     csC_pop(fs, leftover); /* remove leftover (if any) */
@@ -1706,9 +1983,13 @@ typedef struct {
     c_byte havenil; /* if switch has 'nil' case */
     c_byte havetrue; /* if switch has '1' case */
     c_byte havefalse; /* if switch has '0' case */
+    c_byte allint; /* true if all labels in jump table are integers */
     int firstli; /* first literal value in 'literals' */
     int jmp; /* jump to patch if 'sscase' expression is not 'CMATCH' */
-    enum { CNONE, CDFLT, CASE, CMATCH, CMISMATCH } c; /* cases */
+    int swtab; /* index of jump table in 'swtabs' (or -1) */
+    int ncases; /* number of labels in jump table */
+    cs_Integer lo, hi; /* range of integer labels in jump table */
+    enum { CNONE, CDFLT, CASE, CTAB, CMATCH, CMISMATCH } c; /* cases */
 } SwitchState;
 
 
@@ -1889,6 +2170,89 @@ static void removeliterals(Lexer *lx, int nliterals) {
 }
 
 
+/*
+** Check if case expression 'e' can be a label in the jump table,
+** that is, any constant other than 'nil' and NaN; if so, get its
+** value into 'k'.
+*/
+static int switchkey(FunctionState *fs, ExpInfo *e, TValue *k) {
+    if (!eisconstant(e) || e->et == EXP_NIL)
+        return 0;
+    csC_constexp2val(fs, e, k);
+    return !(ttisflt(k) && c_numisnan(fval(k)));
+}
+
+
+/* create jump table for 'ss' and code the dispatch instruction */
+static void newswitchtable(FunctionState *fs, SwitchState *ss) {
+    cs_State *C = fs->lx->C;
+    Proto *p = fs->p;
+    SwitchTable *st;
+    int osz = p->sizeswtabs;
+    csM_growarray(C, p->swtabs, p->sizeswtabs, fs->nswtabs, MAX_LARG,
+                  "switch statements", SwitchTable);
+    while (osz < p->sizeswtabs) { /* make new part valid for GC */
+        st = &p->swtabs[osz++];
+        st->t = NULL;
+        st->jmps = NULL;
+        st->sizejmps = 0;
+    }
+    ss->swtab = fs->nswtabs++;
+    st = &p->swtabs[ss->swtab];
+    st->lo = 0;
+    st->dflt = 0;
+    st->t = csH_new(C);
+    csG_objbarrier(C, p, st->t);
+    ss->allint = 1;
+    ss->ncases = 0;
+    csC_emitIL(fs, OP_SWITCH, ss->swtab);
+}
+
+
+/* add label 'k' to the jump table, targeting current 'pc' */
+static void addswitchcase(FunctionState *fs, SwitchState *ss, TValue *k) {
+    SwitchTable *st = &fs->p->swtabs[ss->swtab];
+    const TValue *slot = csH_get(st->t, k);
+    int target = csC_getlabel(fs);
+    if (isempty(slot)) { /* not a duplicate (such as 1.0 after 1)? */
+        cs_Integer i;
+        TValue v;
+        setival(&v, target);
+        csH_finishset(fs->lx->C, st->t, slot, k, &v);
+        if (ss->allint && csO_tointeger(k, &i, N2IEXACT)) {
+            if (ss->ncases == 0 || i < ss->lo) ss->lo = i;
+            if (ss->ncases == 0 || i > ss->hi) ss->hi = i;
+        } else
+            ss->allint = 0;
+        ss->ncases++;
+    }
+}
+
+
+/*
+** Finish the jump table; labels that are integers filling at least
+** half of their range are moved into the array part 'jmps'.
+*/
+static void closeswitchtable(FunctionState *fs, SwitchState *ss) {
+    SwitchTable *st = &fs->p->swtabs[ss->swtab];
+    if (ss->c == CTAB) /* no 'default' nor regular case? */
+        st->dflt = csC_getlabel(fs); /* mismatch jumps to the end */
+    if (ss->allint && ss->ncases > 0 &&
+            c_castS2U(ss->hi) - c_castS2U(ss->lo) <
+            c_castS2U(ss->ncases) * 2) {
+        int n = cast_int(ss->hi - ss->lo) + 1;
+        st->jmps = csM_newarray(fs->lx->C, n, int);
+        st->sizejmps = n;
+        st->lo = ss->lo;
+        for (int i = 0; i < n; i++) {
+            const TValue *slot = csH_getint(st->t, ss->lo + i);
+            st->jmps[i] = isempty(slot) ? st->dflt : cast_int(ival(slot));
+        }
+        st->t = NULL; /* (table is collected) */
+    }
+}
+
+
 /* 
 ** switchbody ::= 'case' ':' expr switchbody
 **              | 'default' ':' switchbody1
@@ -1914,11 +2278,17 @@ static void switchbody(Lexer *lx, SwitchState *ss, FuncContext *ctxbefore) {
             }
             if (match(lx, TK_CASE)) { /* 'case'? */
                 ExpInfo e; /* case expression */
-                int match;
+                TValue k; /* jump table label */
+                int match, lblpc;
+                int tabcase = (!ss->isconst &&
+                               (ss->c == CNONE || ss->c == CTAB));
                 voidexp(&e);
                 if (c_unlikely(ss->havedefault))
                     csP_semerror(lx, "'default' must be the last case");
                 storecontext(fs, &ctxcase); /* case might get optimized away */
+                if (ss->c == CTAB) /* previous case is in jump table? */
+                    ftjmp = csC_jmp(fs, OP_JMP); /* in case this one is not */
+                lblpc = currPC;
                 expr(lx, &e);           /* get the case expression... */
                 codepres_exp(fs, &e);   /* ...and put it on stack */
                 expectnext(lx, ':');
@@ -1932,8 +2302,17 @@ static void switchbody(Lexer *lx, SwitchState *ss, FuncContext *ctxbefore) {
                     /* compile-time mismatch or previous case is a match */
                     if (ss->c != CMATCH) ss->c = CMISMATCH;
                     loadcontext(fs, &ctxcase); /* remove case expression */
+                } else if (tabcase && switchkey(fs, &e, &k)) {
+                    loadcontext(fs, &ctxcase); /* remove case expression */
+                    ftjmp = NOJMP; /* (removed) */
+                    if (ss->c == CNONE) /* first case? */
+                        newswitchtable(fs, ss);
+                    addswitchcase(fs, ss, &k);
+                    ss->c = CTAB; /* case in jump table */
                 } else { /* otherwise already have matched case */
                     cs_assert(!ss->nomatch);
+                    if (ss->c == CTAB) /* end of jump table cases? */
+                        fs->p->swtabs[ss->swtab].dflt = lblpc;
                     ss->c = CASE; /* regular case */
                     csC_emitI(fs, OP_EQPRESERVE); /* EQ but preserves lhs */
                     ss->jmp = csC_test(fs, OP_TESTPOP, 0); /* test jump */
@@ -1947,6 +2326,8 @@ static void switchbody(Lexer *lx, SwitchState *ss, FuncContext *ctxbefore) {
                     fs->scope->haveswexp = 0; /* (no switch expression) */
                 } else if (ss->c == CASE) /* have test jump? */
                     csC_patchtohere(fs, ss->jmp); /* fix it */
+                else if (ss->c == CTAB) /* have jump table? */
+                    fs->p->swtabs[ss->swtab].dflt = csC_getlabel(fs);
                 ss->havedefault = 1; /* now have 'default' */
                 ss->c = CDFLT;
                 storecontext(fs, &ctxdefault); /* store 'default' context */
@@ -1976,6 +2357,8 @@ static void switchbody(Lexer *lx, SwitchState *ss, FuncContext *ctxbefore) {
         fs->scope->haveswexp = 0; /* (no switch expression) */
         loadcontext(fs, ctxbefore); /* remove the whole switch */
     }
+    if (ss->swtab >= 0) /* have jump table? */
+        closeswitchtable(fs, ss);
     removeliterals(lx, ss->firstli);
 }
 
@@ -1994,6 +2377,7 @@ static void switchstm(Lexer *lx) {
     ss.havedefault = ss.havenil = ss.havetrue = ss.havefalse = 0;
     ss.firstli = lx->ps->literals.len;
     ss.jmp = NOJMP;
+    ss.swtab = -1;
     ss.c = CNONE;
     enterscope(fs, &s, CFMS);
     storecontext(fs, &ctxbefore);
@@ -2546,6 +2930,32 @@ static void mainfunc(FunctionState *fs, Lexer *lx) {
 }
 
 
+/* compile function body skipped by 'lazybody' */
+void csP_parselazy(cs_State *C, BuffReader *br, Buffer *buff,
+                   ParserState *ps, Proto *p) {
+    Lexer lx;
+    FunctionState fs;
+    Scope s;
+    cs_assert(p->lazysrc != NULL && p->code == NULL);
+    lx.tab = csH_new(C);
+    settval2s(C, C->sp.p, lx.tab); /* anchor scanner table */
+    csT_incsp(C);
+    lx.ps = ps;
+    lx.buff = buff;
+    csY_setinput(C, &lx, br, p->source);
+    lx.line = lx.lastline = p->lazyline;
+    fs.p = p;
+    open_func(&lx, &fs, &s);
+    fs.nupvals = p->sizeupvals; /* upvalues were resolved by pre-parse */
+    csY_scan(&lx); /* scan for first token */
+    body(&lx, 0, p->lazyline);
+    expect(&lx, TK_EOS);
+    close_func(&lx);
+    p->lazysrc = NULL; /* compiled */
+    C->sp.p--; /* remove scanner table */
+}
+
+
 /* parse source code */
 CSClosure *csP_parse(cs_State *C, BuffReader *br, Buffer *buff,
                      ParserState *ps, const char *source) {
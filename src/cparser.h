@@ -53,6 +53,9 @@ typedef enum expt {
     /* registered constant value;
      * 'info' = index in 'constants'; */
     EXP_K,
+    /* compile-time constant variable;
+     * 'info' = absolute index in 'actlocals'; */
+    EXP_CONST,
     /* global variable;
      * 'str' = global name */
     EXP_GLOBAL,
@@ -114,6 +117,7 @@ typedef struct ExpInfo {
 #define VARREG      0   /* regular */
 #define VARFINAL    1   /* final (immutable) */
 #define VARTBC      2   /* to-be-closed */
+#define VARCTC      3   /* compile-time constant ('final' with constant value) */
 
 
 /* active local variable compiler information */
@@ -123,6 +127,7 @@ typedef union LVar {
         c_byte kind;
         int sidx; /* stack slot holding the value */
         int pidx; /* index of local variable in Proto's 'locals' array */
+        int newpc; /* pc of table constructor it holds, -1 if escaped */
         OString *name;
     } s;
     TValue val; /* constant value */
@@ -180,6 +185,8 @@ typedef struct ParserState {
         LiteralInfo *arr;
     } literals;
     struct ClassState *cs;
+    Buffer capture; /* source of function bodies skipped by pre-parse */
+    c_byte lazy; /* true if function bodies are compiled lazily */
 } ParserState;
 
 
@@ -188,7 +195,7 @@ typedef struct ParserState {
 ** (snapshot of state fields for optimizations).
 */
 typedef struct FuncContext {
-    int ninstpc;
+    int ninstr;
     int loopstart;
     int prevpc;
     int prevline;
@@ -220,15 +227,18 @@ typedef struct FunctionState {
     int loopstart;      /* innermost loop start offset */
     int prevpc;         /* previous instruction pc */
     int prevline;       /* previous instruction line */
+    int lasttarget;     /* 'pc' of last jump target */
     int sp;             /* first free compiler stack index */
     int nactlocals;     /* number of active local variables */
     int np;             /* number of elements in 'p' */
     int nk;             /* number of elements in 'k' */
     int pc;             /* number of elements in 'code' (equialent to 'ncode') */
     int nabslineinfo;   /* number of elements in 'abslineinfo' */
-    int ninstpc;        /* number of elements in 'instpc' */
+    int ninstr;         /* number of instructions (elements in 'lineinfo') */
     int nlocals;        /* number of elements in 'locals' */
     int nupvals;        /* number of elements in 'upvals' */
+    int nswtabs;        /* number of elements in 'swtabs' */
+    int ntmptabs;       /* number of temporary table sites */
     c_byte iwthabs;     /* instructions issued since last absolute line info */
     c_byte needclose;   /* true if needs to close upvalues before returning */
     c_byte lastwasret;  /* last statement is 'return' */
@@ -239,6 +249,8 @@ typedef struct FunctionState {
 CSI_FUNC c_noret csP_semerror(Lexer *lx, const char *err);
 CSI_FUNC CSClosure *csP_parse(cs_State *C, BuffReader *br, Buffer *buff,
                               ParserState *ps, const char *source);
+CSI_FUNC void csP_parselazy(cs_State *C, BuffReader *br, Buffer *buff,
+                            ParserState *ps, Proto *p);
 
 
 #endif
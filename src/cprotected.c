@@ -9,6 +9,7 @@
 
 
 #include <stdlib.h> /* for 'abort()' */
+#include <string.h>
 
 #include "cprotected.h"
 #include "cmem.h"
@@ -19,6 +20,9 @@
 #include "cstate.h"
 #include "cgc.h"
 #include "ctrace.h"
+#include "cdebug.h"
+#include "cstring.h"
+#include "cundump.h"
 
 
 /*
@@ -116,37 +120,127 @@ struct PParseData {
     Buffer buff;
     ParserState ps;
     const char *source;
+    const char *mode;
+    Proto *p; /* function to compile (for 'csPR_parselazy') */
 };
 
 
+static void initparsedata(struct PParseData *pd, BuffReader *br, int lazy) {
+    pd->br = br;
+    csR_buffinit(&pd->buff);
+    pd->ps.actlocals.len = pd->ps.actlocals.size = 0;
+    pd->ps.actlocals.arr = NULL;
+    pd->ps.patches.len = pd->ps.patches.size = 0; pd->ps.patches.arr = NULL;
+    pd->ps.literals.len = pd->ps.literals.size = 0; pd->ps.literals.arr = NULL;
+    pd->ps.cs = NULL;
+    csR_buffinit(&pd->ps.capture);
+    pd->ps.lazy = cast_byte(lazy);
+}
+
+
+static void freeparsedata(cs_State *C, struct PParseData *pd) {
+    csR_freebuffer(C, &pd->buff);
+    csR_freebuffer(C, &pd->ps.capture);
+    csM_freearray(C, pd->ps.actlocals.arr, pd->ps.actlocals.size);
+    for (int i = 0; i < pd->ps.patches.len; i++) {
+        PatchList *l = &pd->ps.patches.arr[i];
+        csM_freearray(C, l->arr, l->size);
+    }
+    csM_freearray(C, pd->ps.patches.arr, pd->ps.patches.size);
+    csM_freearray(C, pd->ps.literals.arr, pd->ps.literals.size);
+}
+
+
+static void checkmode(cs_State *C, const char *mode, const char *x) {
+    if (mode && strchr(mode, x[0]) == NULL && (strchr(mode, 'b') != NULL ||
+                                               strchr(mode, 't') != NULL)) {
+        csS_pushfstring(C,
+            "attempt to load a %s chunk (mode is '%s')", x, mode);
+        csPR_throw(C, CS_ERRSYNTAX);
+    }
+}
+
+
 /* auxiliary function to call 'csP_pparse' in protected mode */
 static void parsepaux(cs_State *C, void *userdata) {
     struct PParseData *ppd = cast(struct PParseData *, userdata);
-    CSClosure *cl = csP_parse(C, ppd->br, &ppd->buff, &ppd->ps, ppd->source);
+    CSClosure *cl;
+    int c = brgetc(ppd->br); /* read first character */
+    if (c == CS_SIGNATURE[0]) { /* precompiled chunk? */
+        checkmode(C, ppd->mode, "binary");
+        cl = csU_undump(C, ppd->br, ppd->source);
+    } else {
+        checkmode(C, ppd->mode, "text");
+        if (c != CSEOF) brungetc(ppd->br);
+        cl = csP_parse(C, ppd->br, &ppd->buff, &ppd->ps, ppd->source);
+    }
     csF_initupvals(C, cl);
 }
 
 
-/* call 'csP_parse' in protected mode */
-int csPR_parse(cs_State *C, BuffReader *br, const char *name) {
+/*
+** Call 'csP_parse' (or 'csU_undump' for precompiled chunks) in
+** protected mode. 'mode' (can be NULL) is a string of options: 'b'
+** and 't' restrict the chunk to binary or text (both when neither
+** is present); with 'l' function bodies are only pre-parsed (see
+** 'lazybody').
+*/
+int csPR_parse(cs_State *C, BuffReader *br, const char *name,
+               const char *mode) {
     struct PParseData pd;
     int status;
-    pd.br = br;
-    csR_buffinit(&pd.buff);
-    pd.ps.actlocals.len = pd.ps.actlocals.size = 0; pd.ps.actlocals.arr = NULL;
-    pd.ps.patches.len = pd.ps.patches.size = 0; pd.ps.patches.arr = NULL;
-    pd.ps.literals.len = pd.ps.literals.size = 0; pd.ps.literals.arr = NULL;
-    pd.ps.cs = NULL;
+    incnnyc(C); /* cannot yield during parsing */
+    initparsedata(&pd, br, (mode != NULL && strchr(mode, 'l') != NULL));
     pd.source = name;
+    pd.mode = mode;
     status = csPR_call(C, parsepaux, &pd, savestack(C, C->sp.p), C->errfunc);
-    csR_freebuffer(C, &pd.buff);
-    csM_freearray(C, pd.ps.actlocals.arr, pd.ps.actlocals.size);
-    for (int i = 0; i < pd.ps.patches.len; i++) {
-        PatchList *l = &pd.ps.patches.arr[i];
-        csM_freearray(C, l->arr, l->size);
-    }
-    csM_freearray(C, pd.ps.patches.arr, pd.ps.patches.size);
-    csM_freearray(C, pd.ps.literals.arr, pd.ps.literals.size);
+    freeparsedata(C, &pd);
     decnnyc(C);
     return status;
 }
+
+
+static const char *lazyreader(cs_State *C, void *ud, size_t *sz) {
+    OString **ps = cast(OString **, ud);
+    OString *s = *ps;
+    UNUSED(C);
+    if (s == NULL) return NULL;
+    *ps = NULL; /* whole source is read at once */
+    *sz = getstrlen(s);
+    return getstr(s);
+}
+
+
+static void parselazypaux(cs_State *C, void *userdata) {
+    struct PParseData *ppd = cast(struct PParseData *, userdata);
+    csP_parselazy(C, ppd->br, &ppd->buff, &ppd->ps, ppd->p);
+}
+
+
+/*
+** Compile the body of 'p' that was skipped by pre-parse. Errors are
+** raised as runtime errors at the point where the closure is created;
+** the partly compiled body is dropped, so a later attempt starts over.
+*/
+void csPR_parselazy(cs_State *C, Proto *p) {
+    struct PParseData pd;
+    BuffReader br;
+    OString *src = p->lazysrc;
+    int status;
+    csR_init(C, &br, lazyreader, &src);
+    incnnyc(C);
+    initparsedata(&pd, &br, 1);
+    pd.source = NULL;
+    pd.mode = NULL;
+    pd.p = p;
+    status = csPR_call(C, parselazypaux, &pd, savestack(C, C->sp.p),
+                          C->errfunc);
+    freeparsedata(C, &pd);
+    decnnyc(C);
+    if (c_unlikely(status != CS_OK)) {
+        csF_resetlazy(C, p);
+        if (status == CS_ERRSYNTAX)
+            csD_errormsg(C); /* error object is on top */
+        csPR_throw(C, status);
+    }
+}
@@ -9,6 +9,7 @@
 
 
 #include "creader.h"
+#include "cobject.h"
 
 
 /* type for functions with error handler */
@@ -20,6 +21,8 @@ CSI_FUNC int csPR_close(cs_State *C, ptrdiff_t level, int status);
 CSI_FUNC int csPR_rawcall(cs_State *C, ProtectedFn fn, void *ud);
 CSI_FUNC int csPR_call(cs_State *C, ProtectedFn fn, void *ud, ptrdiff_t top,
                        ptrdiff_t errfunc);
-CSI_FUNC int csPR_parse(cs_State *C, BuffReader *br, const char *name); 
+CSI_FUNC int csPR_parse(cs_State *C, BuffReader *br, const char *name,
+                        const char *mode);
+CSI_FUNC void csPR_parselazy(cs_State *C, Proto *p);
 
 #endif
@@ -8,6 +8,8 @@
 #define CS_CORE
 
 
+#include <string.h>
+
 #include "creader.h"
 #include "climits.h"
 
@@ -35,8 +37,10 @@ int csR_fill(BuffReader *br) {
     cs_unlock(C);
     const char *buff = br->reader(C, br->userdata, &size);
     cs_lock(C);
-    if (buff == NULL || size == 0)
+    if (buff == NULL || size == 0) {
+        br->n = 0; /* undo decrement from 'brgetc' */
         return CSEOF;
+    }
     br->buff = buff;
     br->n = size - 1;
     return *br->buff++;
@@ -62,3 +66,27 @@ size_t csR_readn(BuffReader *br, size_t n) {
     }
     return 0;
 }
+
+
+/* 
+** Copy 'n' bytes into 'b' returning count of bytes that could not
+** be read or 0 if all bytes were read. 
+*/
+size_t csR_read(BuffReader *br, void *b, size_t n) {
+    char *dst = cast(char *, b);
+    while (n) {
+        if (br->n == 0) {
+            if (csR_fill(br) == CSEOF)
+                return n;
+            br->n++; /* 'csR_fill' decremented it */
+            br->buff--; /* restore that character */
+        }
+        size_t min = (br->n <= n ? br->n : n);
+        memcpy(dst, br->buff, min);
+        br->n -= min;
+        br->buff += min;
+        dst += min;
+        n -= min;
+    }
+    return 0;
+}
@@ -20,6 +20,9 @@
 #define brgetc(br) \
 	((br)->n-- > 0 ? cast(c_byte, *(br)->buff++) : csR_fill(br))
 
+/* give back the last char returned by 'brgetc' (must not be CSEOF) */
+#define brungetc(br)    ((br)->n++, (br)->buff--)
+
 
 typedef struct {
     size_t n; /* unread bytes */
@@ -34,6 +37,7 @@ CSI_FUNC void csR_init(cs_State* C, BuffReader* br, cs_Reader freader,
                        void* userdata);
 CSI_FUNC int csR_fill(BuffReader* br);
 CSI_FUNC size_t csR_readn(BuffReader* br, size_t n);
+CSI_FUNC size_t csR_read(BuffReader* br, void *b, size_t n);
 
 
 
@@ -24,6 +24,9 @@
 #define CS_RELEASE      CS_VERSION "." CS_VERSION_RELEASE
 #define CS_COPYRIGHT    CS_RELEASE " Copyright (C) 2024-2025 Jure Bagić"
 
+/* mark for precompiled code ('<esc>CScript') */
+#define CS_SIGNATURE    "\x1b" "CScript"
+
 /* For use in binary */
 #define LUA_COPYRIGHT   "Copyright (C) 1994-2020 Lua.org, PUC-Rio"
 
@@ -95,6 +98,9 @@ typedef void *(*cs_Alloc)(void *ptr, size_t osz, size_t nsz, void *ud);
 /* Function that reads blocks when loading CScript chunks */
 typedef const char *(*cs_Reader)(cs_State *C, void *data, size_t *szread);
 
+/* Function that writes blocks when dumping CScript chunks */
+typedef int (*cs_Writer)(cs_State *C, const void *p, size_t sz, void *ud);
+
 /* Type for warning functions */
 typedef void (*cs_WarnFunction)(void *ud, const char *msg, int tocont);
 
@@ -230,12 +236,14 @@ CS_API void        cs_push_nil(cs_State *C);
 CS_API void        cs_push_number(cs_State *C, cs_Number n); 
 CS_API void        cs_push_integer(cs_State *C, cs_Integer n); 
 CS_API const char *cs_push_lstring(cs_State *C, const char *str, size_t len); 
+CS_API char       *cs_push_newlstring(cs_State *C, size_t len);
 CS_API const char *cs_push_string(cs_State *C, const char *str); 
 CS_API const char *cs_push_fstring(cs_State *C, const char *fmt, ...); 
 CS_API const char *cs_push_vfstring(cs_State *C, const char *fmt, va_list argp); 
 CS_API void        cs_push_cclosure(cs_State *C, cs_CFunction fn, int upvals); 
 CS_API void        cs_push_bool(cs_State *C, int b); 
 CS_API void        cs_push_lightuserdata(cs_State *C, void *p); 
+CS_API void        cs_push_next(cs_State *C);
 CS_API void        cs_push_array(cs_State *C, int sz);
 CS_API void        cs_push_table(cs_State *C, int sz);
 CS_API int         cs_push_thread(cs_State *C); 
@@ -251,6 +259,10 @@ CS_API int   cs_get(cs_State *C, int index);
 CS_API int   cs_get_raw(cs_State *C, int index); 
 CS_API int   cs_get_index(cs_State *C, int index, cs_Integer i);
 CS_API int   cs_get_nilindex(cs_State *C, int index, int begin, int end);
+CS_API int   cs_get_array_numbers(cs_State *C, int index, cs_Number *v, int n);
+CS_API int   cs_get_array_integers(cs_State *C, int index, cs_Integer *v,
+                                   int n);
+CS_API int   cs_remove_index(cs_State *C, int index, cs_Integer i);
 CS_API int   cs_get_field(cs_State *C, int index); 
 CS_API int   cs_get_fieldstr(cs_State *C, int index, const char *field); 
 CS_API int   cs_get_fieldptr(cs_State *C, int index, const void *field); 
@@ -270,11 +282,18 @@ CS_API void  cs_set_global(cs_State *C, const char *name);
 CS_API void  cs_set(cs_State *C, int index); 
 CS_API void  cs_set_raw(cs_State *C, int index); 
 CS_API void  cs_set_index(cs_State *C, int index, cs_Integer i);
+CS_API void  cs_set_array_numbers(cs_State *C, int index, const cs_Number *v,
+                                  int n);
+CS_API void  cs_set_array_integers(cs_State *C, int index,
+                                   const cs_Integer *v, int n);
+CS_API void  cs_insert_index(cs_State *C, int index, cs_Integer i);
 CS_API void  cs_set_field(cs_State *C, int index); 
+CS_API void  cs_set_fields(cs_State *C, int index, int n);
 CS_API void  cs_set_fieldstr(cs_State *C, int index, const char *field); 
 CS_API void  cs_set_fieldptr(cs_State *C, int index, const void *field); 
 CS_API void  cs_set_fieldint(cs_State *C, int index, cs_Integer field); 
 CS_API void  cs_set_fieldflt(cs_State *C, int index, cs_Number field); 
+CS_API void  cs_set_mode(cs_State *C, int index, const char *mode);
 CS_API void  cs_set_uservmt(cs_State *C, int index, const cs_VMT *vmt); 
 CS_API int   cs_set_uservalue(cs_State *C, int index, int n); 
 CS_API void  cs_set_usermm(cs_State *C, int index, cs_MM mm); 
@@ -298,7 +317,8 @@ CS_API int cs_error(cs_State *C);
 CS_API void cs_call(cs_State *C, int nargs, int nresults); 
 CS_API int  cs_pcall(cs_State *C, int nargs, int nresults, int msgh); 
 CS_API int  cs_load(cs_State *C, cs_Reader reader, void *userdata,
-                    const char *chunkname); 
+                    const char *chunkname, const char *mode); 
+CS_API int  cs_dump(cs_State *C, cs_Writer writer, void *data, int strip); 
 
 /* -----------------------------------------------------------------------
 ** Garbage collector
@@ -328,6 +348,7 @@ CS_API int              cs_hasvmt(cs_State *C, int index);
 CS_API int              cs_hasmetamethod(cs_State *C, int index, cs_MM mm); 
 CS_API cs_Unsigned      cs_len(cs_State *C, int index); 
 CS_API int              cs_next(cs_State *C, int index); 
+CS_API int              cs_sortarray(cs_State *C, int index);
 CS_API void             cs_concat(cs_State *C, int n); 
 CS_API size_t           cs_stringtonumber(cs_State *C, const char *s, int *f); 
 CS_API cs_Alloc         cs_getallocf(cs_State *C, void **ud); 
@@ -354,7 +375,7 @@ CS_API int              cs_getfreereg(cs_State *C);
 #define cs_is_hashtable(C, n)       (cs_type(C, (n)) == CS_TTABLE)
 #define cs_is_class(C, n)           (cs_type(C, (n)) == CS_TCLASS)
 #define cs_is_instance(C, n)        (cs_type(C, (n)) == CS_TINSTANCE)
-#define cs_is_lightuserdata(C, n)   (cs_type(C, (n)) == CS_TLUDATA)
+#define cs_is_lightuserdata(C, n)   (cs_type(C, (n)) == CS_TLIGHTUSERDATA)
 #define cs_is_nil(C, n)             (cs_type(C, (n)) == CS_TNIL)
 #define cs_is_bool(C, n)            (cs_type(C, (n)) == CS_TBOOL)
 #define cs_is_thread(C, n)          (cs_type(C, (n)) == CS_TTHREAD)
@@ -386,6 +407,8 @@ CS_API const char *cs_setlocal (cs_State *C, const cs_Debug *ar, int n);
 CS_API const char *cs_getupvalue(cs_State *C, int index, int n); 
 CS_API const char *cs_setupvalue(cs_State *C, int index, int n); 
 
+CS_API void cs_stripdebug(cs_State *C, int index);
+
 struct cs_Debug {
     /* (>) pop the function on top of the stack and load it into 'cf' */
     const char *name;       /* (n) */
@@ -15,6 +15,10 @@
 static const cs_Entry loadedlibs[] = {
     {CS_GNAME, csopen_basic},
     {CS_LOADLIBNAME, csopen_package},
+    {CS_STRLIBNAME, csopen_string},
+    {CS_TABLIBNAME, csopen_table},
+    {CS_IOLIBNAME, csopen_io},
+    {CS_MATHLIBNAME, csopen_math},
     {NULL, NULL}
 };
 
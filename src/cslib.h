@@ -20,6 +20,18 @@ CSMOD_API int csopen_basic(cs_State *C);
 #define CS_LOADLIBNAME  "package"
 CSMOD_API int csopen_package(cs_State *C);
 
+#define CS_STRLIBNAME   "string"
+CSMOD_API int csopen_string(cs_State *C);
+
+#define CS_TABLIBNAME   "table"
+CSMOD_API int csopen_table(cs_State *C);
+
+#define CS_IOLIBNAME    "io"
+CSMOD_API int csopen_io(cs_State *C);
+
+#define CS_MATHLIBNAME  "math"
+CSMOD_API int csopen_math(cs_State *C);
+
 
 /* open all previous libraries */
 CSLIB_API void csL_openlibs(cs_State *C);
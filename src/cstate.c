@@ -197,6 +197,9 @@ CS_API cs_State *cs_newstate(cs_Alloc falloc, void *ud) {
     incnnyc(C);
     gs->objects = obj2gco(C);
     gs->totalbytes = sizeof(XSG);
+    gs->poolbytes = 0;
+    for (size_t i = 0; i < CSI_POOLMAX / sizeof(void *); i++)
+        gs->pools[i] = NULL;
     gs->seed = csi_makeseed(C); /* initial seed for hashing */
     gs->strtab.hash = NULL;
     gs->strtab.nuse = gs->strtab.size = 0;
@@ -211,7 +214,7 @@ CS_API cs_State *cs_newstate(cs_Alloc falloc, void *ud) {
     gs->sweeppos = NULL;
     gs->fixed = gs->fin = gs->tobefin = NULL;
     gs->graylist = gs->grayagain = NULL;
-    gs->weak = NULL;
+    gs->weak = gs->ephemeron = gs->allweak = NULL;
     setnilval(&gs->c_registry);
     gs->falloc = falloc;
     gs->ud_alloc = ud;
@@ -219,6 +222,7 @@ CS_API cs_State *cs_newstate(cs_Alloc falloc, void *ud) {
     setival(&gs->nil, 0); /* signals that state is not yet fully initialized */
     gs->mainthread = C;
     gs->thwouv = NULL;
+    for (int i = 0; i < UVCACHE_N; i++) gs->uvcache[i] = NULL;
     gs->fwarn = NULL; gs->ud_warn = NULL;
     for (int i = 0; i < CS_NUM_TYPES; i++) gs->vmt[i] = NULL;
     cs_assert(gs->totalbytes == sizeof(XSG) && gs->gcdebt == 0);
@@ -383,9 +387,11 @@ int csT_reallocstack(cs_State *C, int size, int raiseerr) {
             csPR_throw(C, CS_ERRMEM);
         return 0;
     }
-    rel2sptr(C);
     C->stack.p = newstack;
+    rel2sptr(C);
     C->stackend.p = newstack + size;
+    /* cached open upvalues are keyed by their old stack slots */
+    for (int i = 0; i < UVCACHE_N; i++) gs->uvcache[i] = NULL;
     for (int i = osz + EXTRA_STACK; i < size + EXTRA_STACK; i++)
         setnilval(s2v(newstack + i));
     return 1;
@@ -401,7 +407,7 @@ int csT_growstack(cs_State *C, int n, int raiseerr) {
             csPR_throw(C, CS_ERRERROR);
         return 0;
     }
-    if (c_unlikely(n > CSI_MAXSTACK)) {
+    if (c_likely(n < CSI_MAXSTACK)) { /* avoids arithmetic overflows */
         int nsize = size * 2;
         int needed = cast_int((C)->sp.p - (C)->stack.p) + n;
         if (nsize > CSI_MAXSTACK)
@@ -132,6 +132,7 @@ typedef struct CallFrame {
     struct CallFrame *prev, *next; /* call link */
     const Instruction *pc; /* (only for Cript function) */
     int nvarargs; /* number of varargs (only for Cript function) */
+    Table *tmptabs[MAXTMPTABS]; /* temporary tables (only for Cript function) */
     int nresults; /* number of expected results from this function */
     c_byte status; /* call status */
 } CallFrame;
@@ -159,6 +160,8 @@ typedef struct GState {
     void *ud_alloc; /* userdata for 'falloc' */
     c_smem totalbytes; /* number of bytes allocated - gcgcdebt */
     c_smem gcdebt; /* number of bbytes not yet compensated by collector */
+    c_mem poolbytes; /* bytes kept in 'pools' */
+    void *pools[CSI_POOLMAX / sizeof(void *)]; /* free objects by size */
     c_mem gcestimate; /* gcestimate of non-garbage memory in use */
     StringTable strtab; /* interned strings (weak refs) */
     TValue c_registry; /* global registry (array) */
@@ -177,10 +180,13 @@ typedef struct GState {
     GCObject *fin; /* list of objects that have finalizer */
     GCObject *graylist; /* list of gray objects */
     GCObject *grayagain; /* list of objects to be traversed atomically */
-    GCObject *weak; /* list of all weak hashtables (key & value) */
+    GCObject *weak; /* list of tables with weak values */
+    GCObject *ephemeron; /* list of ephemeron tables (weak keys) */
+    GCObject *allweak; /* list of tables with weak keys and values */
     GCObject *tobefin; /* list of objects to be finalized (pending) */
     GCObject *fixed; /* list of fixed objects (not to be collected) */
     struct cs_State *thwouv; /* list of threads with open upvalues */
+    UpVal *uvcache[UVCACHE_N]; /* cache of open upvalues (by stack slot) */
     cs_CFunction fpanic; /* panic handler (runs in unprotected calls) */
     struct cs_State *mainthread; /* thread that also created global state */
     OString *memerror; /* preallocated message for memory errors */
@@ -200,8 +200,8 @@ static OString *internshrstr(cs_State *C, const char *str, size_t l) {
         list = &tab->hash[hashmod(h, tab->size)];
     }
     s = newstrobj(C, l, CS_VSHRSTR, h);
+    s->shrlen = cast_byte(l); /* (before 'getshrstr' checks it) */
     memcpy(getshrstr(s), str, l*sizeof(char));
-    s->shrlen = cast_byte(l);
     s->u.next = *list;
     *list = s;
     tab->nuse++;
@@ -262,7 +262,7 @@ int csS_cmp(const OString *s1, const OString *s2) {
             size_t lseg1 = strlen(p1); /* index of first '\0' in 'p1' */
             size_t lseg2 = strlen(p2); /* index of first '\0' in 'p2' */
             if (lseg2 == lreal2) /* 'p2' finished? */
-                return !(lseg1 == lreal2);
+                return !(lseg1 == lreal1);
             else if (lseg1 == lreal1) /* 'p1' finished? */
                 return -1; /* 'p1' is less than 'p2' ('p2' is not finihsed) */
             /* both strings longher than the segments; compare after '\0' */
@@ -0,0 +1,1392 @@
+/*
+** cstrlib.c
+** Standard library for string operations
+** See Copyright Notice in cscript.h
+*/
+
+
+#define CS_LIB
+
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cscript.h"
+
+#include "cauxlib.h"
+#include "cslib.h"
+
+
+
+/*
+** Some sizes are better limited to fit in 'int', but must also fit in
+** 'size_t'. (We assume that 'cs_Integer' cannot be smaller than 'int'.)
+*/
+#define MAX_SIZET	((size_t)(~(size_t)0))
+
+#define MAXSIZE  \
+	(sizeof(size_t) < sizeof(int) ? MAX_SIZET : (size_t)(INT_MAX))
+
+
+/*
+** Translate relative initial string position (negative means back
+** from the end): clip result to [0, len]. Positions are 0-based
+** as are array indices.
+*/
+static size_t posrelat(cs_Integer pos, size_t len) {
+    if (pos >= 0)
+        return ((size_t)pos > len) ? len : (size_t)pos;
+    else if (-(size_t)pos > len)
+        return 0;
+    else
+        return len + (size_t)pos;
+}
+
+
+/*
+** Get (inclusive) end position of substring; negative position
+** is relative to the end of the string (-1 is the last character).
+** Result is clipped to [-1, len - 1], where -1 means empty range.
+*/
+static cs_Integer getendpos(cs_State *C, int arg, cs_Integer def,
+                            size_t len) {
+    cs_Integer pos = csL_opt_integer(C, arg, def);
+    if (pos >= (cs_Integer)len)
+        return (cs_Integer)len - 1;
+    else if (pos >= 0)
+        return pos;
+    else if (pos < -(cs_Integer)len)
+        return -1;
+    else
+        return (cs_Integer)len + pos;
+}
+
+
+static int s_len(cs_State *C) {
+    size_t l;
+    csL_check_lstring(C, 0, &l);
+    cs_push_integer(C, (cs_Integer)l);
+    return 1;
+}
+
+
+static int s_sub(cs_State *C) {
+    size_t l;
+    const char *s = csL_check_lstring(C, 0, &l);
+    size_t start = posrelat(csL_check_integer(C, 1), l);
+    cs_Integer end = getendpos(C, 2, -1, l);
+    if ((cs_Integer)start <= end)
+        cs_push_lstring(C, s + start, (size_t)end - start + 1);
+    else
+        cs_push_literal(C, "");
+    return 1;
+}
+
+
+static int s_reverse(cs_State *C) {
+    size_t l;
+    csL_Buffer B;
+    const char *s = csL_check_lstring(C, 0, &l);
+    char *p = csL_buff_initsz(C, &B, l);
+    for (size_t i = 0; i < l; i++)
+        p[i] = s[l - i - 1];
+    csL_buffadd(&B, l);
+    csL_buff_end(&B);
+    return 1;
+}
+
+
+static int s_lower(cs_State *C) {
+    size_t l;
+    csL_Buffer B;
+    const char *s = csL_check_lstring(C, 0, &l);
+    char *p = csL_buff_initsz(C, &B, l);
+    for (size_t i = 0; i < l; i++)
+        p[i] = (char)tolower((unsigned char)s[i]);
+    csL_buffadd(&B, l);
+    csL_buff_end(&B);
+    return 1;
+}
+
+
+static int s_upper(cs_State *C) {
+    size_t l;
+    csL_Buffer B;
+    const char *s = csL_check_lstring(C, 0, &l);
+    char *p = csL_buff_initsz(C, &B, l);
+    for (size_t i = 0; i < l; i++)
+        p[i] = (char)toupper((unsigned char)s[i]);
+    csL_buffadd(&B, l);
+    csL_buff_end(&B);
+    return 1;
+}
+
+
+static int s_rep(cs_State *C) {
+    size_t l, lsep;
+    const char *s = csL_check_lstring(C, 0, &l);
+    cs_Integer n = csL_check_integer(C, 1);
+    const char *sep = csL_opt_lstring(C, 2, "", &lsep);
+    if (n <= 0) {
+        cs_push_literal(C, "");
+    } else if (c_unlikely(l + lsep < l || l + lsep > MAXSIZE / n)) {
+        csL_error(C, "resulting string too large");
+    } else {
+        csL_Buffer B;
+        size_t totallen = (size_t)n * l + (size_t)(n - 1) * lsep;
+        char *p = csL_buff_initsz(C, &B, totallen);
+        while (n-- > 1) { /* first n-1 copies (followed by separator) */
+            memcpy(p, s, l * sizeof(char)); p += l;
+            if (lsep > 0) { /* empty 'memcpy' is not that cheap */
+                memcpy(p, sep, lsep * sizeof(char));
+                p += lsep;
+            }
+        }
+        memcpy(p, s, l * sizeof(char)); /* last copy (not followed by sep) */
+        csL_buffadd(&B, totallen);
+        csL_buff_end(&B);
+    }
+    return 1;
+}
+
+
+static int s_byte(cs_State *C) {
+    size_t l;
+    const char *s = csL_check_lstring(C, 0, &l);
+    cs_Integer pi = csL_opt_integer(C, 1, 0);
+    size_t start = posrelat(pi, l);
+    cs_Integer end = getendpos(C, 2, (pi < 0 ? pi : (cs_Integer)start), l);
+    int n;
+    if ((cs_Integer)start > end)
+        return 0; /* empty interval; return no values */
+    if (c_unlikely((size_t)(end - start) >= (size_t)INT_MAX))
+        return csL_error(C, "string slice too long");
+    n = (int)(end - start) + 1;
+    csL_check_stack(C, n, "string slice too long");
+    for (int i = 0; i < n; i++)
+        cs_push_integer(C, (unsigned char)s[start + i]);
+    return n;
+}
+
+
+static int s_char(cs_State *C) {
+    int n = cs_nvalues(C); /* number of arguments */
+    csL_Buffer B;
+    char *p = csL_buff_initsz(C, &B, n);
+    for (int i = 0; i < n; i++) {
+        cs_Unsigned c = (cs_Unsigned)csL_check_integer(C, i);
+        csL_check_arg(C, c <= (cs_Unsigned)UCHAR_MAX, i, "value out of range");
+        p[i] = (char)(unsigned char)c;
+    }
+    csL_buffadd(&B, n);
+    csL_buff_end(&B);
+    return 1;
+}
+
+
+/* state for 'writer' used by 'dump' */
+struct str_Writer {
+    int init; /* true iff buffer has been initialized */
+    csL_Buffer B;
+};
+
+
+static int writer(cs_State *C, const void *b, size_t size, void *ud) {
+    struct str_Writer *state = (struct str_Writer *)ud;
+    if (!state->init) {
+        state->init = 1;
+        csL_buff_init(C, &state->B);
+    }
+    csL_buff_push_lstring(&state->B, (const char *)b, size);
+    return 0;
+}
+
+
+/* 'dump(f, strip)' returns 'f' as a binary chunk 'load' accepts */
+static int s_dump(cs_State *C) {
+    struct str_Writer state;
+    int strip = cs_to_bool(C, 1);
+    csL_check_type(C, 0, CS_TFUNCTION);
+    cs_setntop(C, 1); /* ensure function is on the top of the stack */
+    state.init = 0;
+    if (c_unlikely(cs_dump(C, writer, &state, strip) != 0))
+        return csL_error(C, "unable to dump given function");
+    csL_buff_end(&state.B);
+    return 1;
+}
+
+
+
+/* {======================================================================
+** Search
+** ======================================================================= */
+
+/*
+** Find first occurrence of 'p' (of length 'lp') in 's' (of length 'ls').
+** The candidate positions are located with 'memchr' on the first byte
+** of the pattern (which most C libraries implement using vector
+** instructions), only then the rest of the pattern is compared.
+** Single byte patterns are handled by a single 'memchr' call.
+*/
+static const char *memfind(const char *s, size_t ls, const char *p,
+                           size_t lp) {
+    if (lp == 0) return s; /* empty strings are everywhere */
+    else if (lp > ls) return NULL; /* avoids a negative 'ls' */
+    else if (lp == 1) return memchr(s, *p, ls);
+    else {
+        const char *init;
+        lp--; /* 1st char will be checked by 'memchr' */
+        ls -= lp; /* 's' cannot be found after that */
+        while (ls > 0 && (init = memchr(s, *p, ls)) != NULL) {
+            init++; /* 1st char is already checked */
+            if (memcmp(init, p + 1, lp) == 0)
+                return init - 1;
+            else { /* correct 'ls' and 's' to try again */
+                ls -= init - s;
+                s = init;
+            }
+        }
+        return NULL; /* not found */
+    }
+}
+
+
+/* find last occurrence of 'p' in 's' */
+static const char *memrfind(const char *s, size_t ls, const char *p,
+                            size_t lp) {
+    if (lp > ls) return NULL;
+    else if (lp == 0) return s + ls;
+    else {
+        size_t i = ls - lp + 1;
+        while (i-- > 0) {
+            if (s[i] == *p && memcmp(s + i + 1, p + 1, lp - 1) == 0)
+                return s + i;
+        }
+        return NULL; /* not found */
+    }
+}
+
+
+/* 'rfind(s, p)' same as 'find' but searches for the last occurrence */
+static int s_rfind(cs_State *C) {
+    size_t ls, lp;
+    const char *s = csL_check_lstring(C, 0, &ls);
+    const char *p = csL_check_lstring(C, 1, &lp);
+    const char *f = memrfind(s, ls, p, lp);
+    if (f) {
+        cs_push_integer(C, (cs_Integer)(f - s));
+        cs_push_integer(C, (cs_Integer)(f - s + lp) - 1);
+        return 2;
+    }
+    csL_push_fail(C);
+    return 1;
+}
+
+
+static int s_startswith(cs_State *C) {
+    size_t ls, lp;
+    const char *s = csL_check_lstring(C, 0, &ls);
+    const char *p = csL_check_lstring(C, 1, &lp);
+    cs_push_bool(C, (lp <= ls && memcmp(s, p, lp) == 0));
+    return 1;
+}
+
+
+static int s_endswith(cs_State *C) {
+    size_t ls, lp;
+    const char *s = csL_check_lstring(C, 0, &ls);
+    const char *p = csL_check_lstring(C, 1, &lp);
+    cs_push_bool(C, (lp <= ls && memcmp(s + ls - lp, p, lp) == 0));
+    return 1;
+}
+
+
+/* space characters for 'split' and 'trim' */
+#define SPACECHARS      " \f\n\r\t\v"
+
+#define isspacechar(c)  ((c) != '\0' && strchr(SPACECHARS, (c)) != NULL)
+
+
+/* 'split' without a separator; splits on runs of whitespace */
+static int splitspace(cs_State *C, const char *s, size_t ls, cs_Integer max) {
+    const char *e = s + ls;
+    cs_Integer n = 0;
+    for (;;) {
+        const char *start;
+        while (s < e && isspacechar(*s)) s++; /* skip whitespace */
+        if (s == e) break; /* done */
+        start = s;
+        if (n == max) /* last piece? */
+            s = e; /* take the rest of the string */
+        else
+            while (s < e && !isspacechar(*s)) s++;
+        cs_push_lstring(C, start, s - start);
+        cs_set_index(C, -2, n++);
+    }
+    return 1;
+}
+
+
+/*
+** 'split(s [, sep [, max]])' splits the string 's' into an array of
+** substrings separated by 'sep'. If 'sep' is absent, then any run of
+** whitespace acts as a separator and empty pieces are discarded.
+** At most 'max' splits are performed (the last piece contains the
+** remainder of the string).
+*/
+static int s_split(cs_State *C) {
+    size_t ls, lsep;
+    const char *s = csL_check_lstring(C, 0, &ls);
+    const char *sep = csL_opt_lstring(C, 1, NULL, &lsep);
+    cs_Integer max = csL_opt_integer(C, 2, -1);
+    cs_Integer n = 0;
+    cs_push_array(C, 0);
+    if (sep == NULL)
+        return splitspace(C, s, ls, max);
+    csL_check_arg(C, lsep > 0, 1, "empty separator");
+    for (;;) {
+        const char *f = (n != max) ? memfind(s, ls, sep, lsep) : NULL;
+        if (f == NULL) { /* no more separators? */
+            cs_push_lstring(C, s, ls); /* push last piece */
+            cs_set_index(C, -2, n);
+            break;
+        }
+        cs_push_lstring(C, s, f - s);
+        cs_set_index(C, -2, n++);
+        ls -= (f - s) + lsep;
+        s = f + lsep;
+    }
+    return 1;
+}
+
+
+/* 'trim(s)' removes leading and trailing whitespace */
+static int s_trim(cs_State *C) {
+    size_t l;
+    const char *s = csL_check_lstring(C, 0, &l);
+    const char *e = s + l;
+    while (s < e && isspacechar(*s)) s++;
+    while (e > s && isspacechar(e[-1])) e--;
+    cs_push_lstring(C, s, e - s);
+    return 1;
+}
+
+/* }====================================================================== */
+
+
+
+/* {======================================================================
+** Pattern matching
+** ======================================================================= */
+
+/*
+** Patterns use the Lua pattern syntax. Instead of interpreting the
+** pattern text on every match, a pattern is compiled once into an
+** array of 'PatItem's, with character classes and sets expanded into
+** 256-bit maps, so matching a single character is just a bit test.
+** Compiled patterns are kept in a small direct-mapped cache keyed by
+** the address of the pattern string object (see 'getpattern').
+*/
+
+#if !defined(CS_MAXCAPTURES)
+#define CS_MAXCAPTURES      32
+#endif
+
+
+/* maximum recursion depth for 'domatch' */
+#if !defined(MAXCCALLS)
+#define MAXCCALLS       200
+#endif
+
+
+/* number of compiled patterns in cache (must be power of 2) */
+#if !defined(PATCACHESIZE)
+#define PATCACHESIZE    32
+#endif
+
+
+#define L_ESC           '%'
+#define SPECIALS        "^$*+?.([%-"
+
+
+#define CAP_UNFINISHED  (-1)
+#define CAP_POSITION    (-2)
+
+
+#define uchar(c)        ((unsigned char)(c))
+
+
+/* kinds of pattern items */
+enum PatKind {
+    PK_CHAR,        /* single character */
+    PK_SET,         /* character class or set */
+    PK_OPEN,        /* start of capture */
+    PK_POSCAP,      /* position capture '()' */
+    PK_CLOSE,       /* end of capture */
+    PK_BALANCE,     /* '%bxy' */
+    PK_FRONTIER,    /* '%f[set]' */
+    PK_BACKREF,     /* '%1'-'%9' */
+    PK_END          /* '$' at the end of pattern */
+};
+
+
+typedef struct PatItem {
+    unsigned char kind; /* 'PatKind' */
+    unsigned char rep; /* repetition ('*', '+', '-', '?' or 0) */
+    unsigned char c1, c2; /* character, '%b' delimiters or capture index */
+    unsigned char set[(UCHAR_MAX + 1) / 8]; /* set of characters */
+} PatItem;
+
+
+typedef struct Pattern {
+    int anchor; /* pattern starts with '^' */
+    int nitems; /* number of elements in 'items' */
+    PatItem items[]; /* compiled pattern */
+} Pattern;
+
+
+#define addtoset(set,c)     ((set)[uchar(c) >> 3] |= (1u << (uchar(c) & 7)))
+#define inset(set,c)        ((set)[uchar(c) >> 3] & (1u << (uchar(c) & 7)))
+
+
+static int matchclass(int c, int cl) {
+    int res;
+    switch (tolower(cl)) {
+        case 'a': res = isalpha(c); break;
+        case 'c': res = iscntrl(c); break;
+        case 'd': res = isdigit(c); break;
+        case 'g': res = isgraph(c); break;
+        case 'l': res = islower(c); break;
+        case 'p': res = ispunct(c); break;
+        case 's': res = isspace(c); break;
+        case 'u': res = isupper(c); break;
+        case 'w': res = isalnum(c); break;
+        case 'x': res = isxdigit(c); break;
+        default: return (cl == c);
+    }
+    if (isupper(cl)) res = !res;
+    return res;
+}
+
+
+/* add all characters of class 'cl' into 'set' */
+static void addclass(unsigned char *set, int cl) {
+    for (int c = 0; c <= UCHAR_MAX; c++)
+        if (matchclass(c, cl))
+            addtoset(set, c);
+}
+
+
+/* compile set '[...]', 'p' points to the first character after '[' */
+static const char *compileset(cs_State *C, const char *p, const char *pend,
+                              unsigned char *set) {
+    int neg = 0;
+    memset(set, 0, (UCHAR_MAX + 1) / 8);
+    if (p < pend && *p == '^') {
+        neg = 1;
+        p++; /* skip the '^' */
+    }
+    for (;;) { /* first character is always part of the set */
+        int c;
+        if (c_unlikely(p >= pend))
+            csL_error(C, "malformed pattern (missing ']')");
+        c = uchar(*p++);
+        if (c == L_ESC) {
+            if (c_unlikely(p >= pend))
+                csL_error(C, "malformed pattern (missing ']')");
+            addclass(set, uchar(*p++));
+        } else if (p + 1 < pend && *p == '-' && p[1] != ']') {
+            int e = uchar(p[1]);
+            for (; c <= e; c++)
+                addtoset(set, c);
+            p += 2; /* skip '-' and the end of range */
+        } else
+            addtoset(set, c);
+        if (p < pend && *p == ']')
+            break;
+    }
+    if (neg) {
+        for (int i = 0; i < (UCHAR_MAX + 1) / 8; i++)
+            set[i] = ~set[i];
+    }
+    return p + 1; /* skip ']' */
+}
+
+
+/* compile single character class */
+static const char *compileclass(cs_State *C, const char *p, const char *pend,
+                                PatItem *it) {
+    switch (*p) {
+        case L_ESC: {
+            if (c_unlikely(p + 1 >= pend))
+                csL_error(C, "malformed pattern (ends with '%%')");
+            if (isalpha(uchar(p[1]))) { /* class? */
+                it->kind = PK_SET;
+                memset(it->set, 0, sizeof(it->set));
+                addclass(it->set, uchar(p[1]));
+            } else { /* escaped character */
+                it->kind = PK_CHAR;
+                it->c1 = uchar(p[1]);
+            }
+            return p + 2;
+        }
+        case '[': {
+            it->kind = PK_SET;
+            return compileset(C, p + 1, pend, it->set);
+        }
+        case '.': {
+            it->kind = PK_SET;
+            memset(it->set, 0xFF, sizeof(it->set));
+            return p + 1;
+        }
+        default: {
+            it->kind = PK_CHAR;
+            it->c1 = uchar(*p);
+            return p + 1;
+        }
+    }
+}
+
+
+/*
+** Compile pattern 'p' of length 'lp' and leave the compiled pattern
+** as userdata on top of the stack. Each character in 'p' produces at
+** most one item, so 'lp' items are always enough.
+*/
+static Pattern *compile(cs_State *C, const char *p, size_t lp) {
+    const char *pend = p + lp;
+    char capstate[CS_MAXCAPTURES]; /* 1 if capture is closed */
+    int level = 0;
+    Pattern *pat = cs_newuserdata(C, sizeof(Pattern) + lp*sizeof(PatItem), 0);
+    pat->nitems = 0;
+    pat->anchor = (p < pend && *p == '^');
+    p += pat->anchor; /* skip anchor (if any) */
+    while (p < pend) {
+        PatItem *it = &pat->items[pat->nitems++];
+        it->rep = 0;
+        switch (*p) {
+            case '(': {
+                if (c_unlikely(level >= CS_MAXCAPTURES))
+                    csL_error(C, "too many captures");
+                if (p + 1 < pend && p[1] == ')') { /* position capture? */
+                    it->kind = PK_POSCAP;
+                    capstate[level++] = 1;
+                    p += 2;
+                } else {
+                    it->kind = PK_OPEN;
+                    capstate[level++] = 0;
+                    p++;
+                }
+                continue;
+            }
+            case ')': {
+                int l = level - 1;
+                for (; l >= 0 && capstate[l]; l--) ; /* find open capture */
+                if (c_unlikely(l < 0))
+                    csL_error(C, "invalid pattern capture");
+                capstate[l] = 1;
+                it->kind = PK_CLOSE;
+                it->c1 = (unsigned char)l;
+                p++;
+                continue;
+            }
+            case '$': {
+                if (p + 1 == pend) { /* is it the end of pattern? */
+                    it->kind = PK_END;
+                    p++;
+                    continue;
+                }
+                break; /* else a literal '$' */
+            }
+            case L_ESC: {
+                if (p + 1 >= pend)
+                    break; /* error raised by 'compileclass' */
+                switch (p[1]) {
+                    case 'b': {
+                        if (c_unlikely(pend - p < 4))
+                            csL_error(C, "malformed pattern "
+                                         "(missing arguments to '%%b')");
+                        it->kind = PK_BALANCE;
+                        it->c1 = uchar(p[2]);
+                        it->c2 = uchar(p[3]);
+                        p += 4;
+                        continue;
+                    }
+                    case 'f': {
+                        p += 2;
+                        if (c_unlikely(p >= pend || *p != '['))
+                            csL_error(C, "missing '[' after '%%f' in pattern");
+                        it->kind = PK_FRONTIER;
+                        p = compileset(C, p + 1, pend, it->set);
+                        continue;
+                    }
+                    case '0': case '1': case '2': case '3':
+                    case '4': case '5': case '6': case '7':
+                    case '8': case '9': {
+                        int l = p[1] - '1';
+                        if (c_unlikely(l < 0 || l >= level || !capstate[l]))
+                            csL_error(C, "invalid capture index %%%d in "
+                                         "pattern", l + 1);
+                        it->kind = PK_BACKREF;
+                        it->c1 = (unsigned char)l;
+                        p += 2;
+                        continue;
+                    }
+                    default: break; /* class or escaped character */
+                }
+                break;
+            }
+            default: break;
+        }
+        p = compileclass(C, p, pend, it);
+        if (p < pend && (*p == '*' || *p == '+' || *p == '-' || *p == '?'))
+            it->rep = uchar(*p++);
+    }
+    while (level-- > 0) {
+        if (c_unlikely(!capstate[level]))
+            csL_error(C, "unfinished capture");
+    }
+    return pat;
+}
+
+
+typedef struct PatCache {
+    const void *key[PATCACHESIZE]; /* pattern string objects */
+    Pattern *p[PATCACHESIZE]; /* compiled patterns */
+} PatCache;
+
+
+/*
+** Push the compiled pattern for the pattern string at index 'arg'
+** and return it. Cache entries are found by the address of the string
+** object; short strings are internalized, so equal short patterns
+** always hit the same entry. For entry 'i' the cache userdata holds
+** the pattern string in its user value '2*i + 1' (so the address
+** can't be reused by another string while cached) and the compiled
+** pattern in user value '2*i + 2'. Evicted patterns are collected
+** once no 'gmatch' iterator refers to them.
+*/
+static Pattern *getpattern(cs_State *C, int arg) {
+    PatCache *pc = (PatCache *)cs_to_userdata(C, cs_upvalueindex(0));
+    const void *key = cs_to_pointer(C, arg);
+    int i = (int)(((size_t)key >> 4) & (PATCACHESIZE - 1));
+    if (pc->key[i] == key) { /* cache hit? */
+        cs_get_uservalue(C, cs_upvalueindex(0), 2*i + 2);
+        return pc->p[i];
+    } else { /* compile and cache it */
+        size_t lp;
+        const char *p = cs_to_lstring(C, arg, &lp);
+        Pattern *pat = compile(C, p, lp);
+        cs_push(C, arg);
+        cs_set_uservalue(C, cs_upvalueindex(0), 2*i + 1);
+        cs_push(C, -1);
+        cs_set_uservalue(C, cs_upvalueindex(0), 2*i + 2);
+        pc->key[i] = key;
+        pc->p[i] = pat;
+        return pat;
+    }
+}
+
+
+static void createpatcache(cs_State *C) {
+    PatCache *pc;
+    csL_check_stack(C, 2*PATCACHESIZE, "too many user values");
+    for (int i = 0; i < 2*PATCACHESIZE; i++)
+        cs_push_nil(C);
+    pc = cs_newuserdata(C, sizeof(*pc), 2*PATCACHESIZE);
+    memset(pc, 0, sizeof(*pc));
+}
+
+
+typedef struct MatchState {
+    const char *src_init; /* init of source string */
+    const char *src_end; /* end ('\0') of source string */
+    const Pattern *p; /* compiled pattern */
+    cs_State *C;
+    int matchdepth; /* control for recursive depth (to avoid C stack overflow) */
+    int level; /* total number of captures (finished or unfinished) */
+    struct {
+        const char *init;
+        ptrdiff_t len;
+    } capture[CS_MAXCAPTURES];
+} MatchState;
+
+
+static const char *domatch(MatchState *ms, const char *s, int pi);
+
+
+static int singlematch(const MatchState *ms, const char *s,
+                          const PatItem *it) {
+    if (s >= ms->src_end)
+        return 0;
+    else if (it->kind == PK_CHAR)
+        return (uchar(*s) == it->c1);
+    else
+        return (inset(it->set, *s) != 0);
+}
+
+
+static const char *matchbalance(MatchState *ms, const char *s,
+                                const PatItem *it) {
+    if (s >= ms->src_end || uchar(*s) != it->c1)
+        return NULL;
+    else {
+        int cont = 1;
+        while (++s < ms->src_end) {
+            if (uchar(*s) == it->c2) {
+                if (--cont == 0) return s + 1;
+            } else if (uchar(*s) == it->c1)
+                cont++;
+        }
+    }
+    return NULL; /* string ends out of balance */
+}
+
+
+static const char *maxexpand(MatchState *ms, const char *s, int pi) {
+    const PatItem *it = &ms->p->items[pi];
+    ptrdiff_t i = 0; /* counts maximum expand for item */
+    while (singlematch(ms, s + i, it))
+        i++;
+    /* keeps trying to match with the maximum repetitions */
+    while (i >= 0) {
+        const char *res = domatch(ms, (s + i), pi + 1);
+        if (res) return res;
+        i--; /* else didn't match; reduce 1 repetition to try again */
+    }
+    return NULL;
+}
+
+
+static const char *minexpand(MatchState *ms, const char *s, int pi) {
+    const PatItem *it = &ms->p->items[pi];
+    for (;;) {
+        const char *res = domatch(ms, s, pi + 1);
+        if (res != NULL)
+            return res;
+        else if (singlematch(ms, s, it))
+            s++; /* try with one more repetition */
+        else
+            return NULL;
+    }
+}
+
+
+static const char *startcapture(MatchState *ms, const char *s, int pi,
+                                int what) {
+    const char *res;
+    cs_assert(ms->level < CS_MAXCAPTURES);
+    ms->capture[ms->level].init = s;
+    ms->capture[ms->level].len = what;
+    ms->level++;
+    if ((res = domatch(ms, s, pi)) == NULL) /* match failed? */
+        ms->level--; /* undo capture */
+    return res;
+}
+
+
+static const char *endcapture(MatchState *ms, const char *s, int pi,
+                              int l) {
+    const char *res;
+    cs_assert(ms->capture[l].len == CAP_UNFINISHED);
+    ms->capture[l].len = s - ms->capture[l].init; /* close capture */
+    if ((res = domatch(ms, s, pi)) == NULL) /* match failed? */
+        ms->capture[l].len = CAP_UNFINISHED; /* undo capture */
+    return res;
+}
+
+
+static const char *matchcapture(MatchState *ms, const char *s, int l) {
+    ptrdiff_t len = ms->capture[l].len;
+    if (len >= 0 && (size_t)(ms->src_end - s) >= (size_t)len &&
+            memcmp(ms->capture[l].init, s, len) == 0)
+        return s + len;
+    else
+        return NULL;
+}
+
+
+static const char *domatch(MatchState *ms, const char *s, int pi) {
+    const PatItem *items = ms->p->items;
+    int n = ms->p->nitems;
+    if (c_unlikely(ms->matchdepth-- == 0))
+        csL_error(ms->C, "pattern too complex");
+    while (pi < n) {
+        const PatItem *it = &items[pi];
+        switch (it->kind) {
+            case PK_OPEN: {
+                s = startcapture(ms, s, pi + 1, CAP_UNFINISHED);
+                goto done;
+            }
+            case PK_POSCAP: {
+                s = startcapture(ms, s, pi + 1, CAP_POSITION);
+                goto done;
+            }
+            case PK_CLOSE: {
+                s = endcapture(ms, s, pi + 1, it->c1);
+                goto done;
+            }
+            case PK_END: { /* always the last item */
+                if (s != ms->src_end) s = NULL;
+                goto done;
+            }
+            case PK_BALANCE: {
+                if ((s = matchbalance(ms, s, it)) == NULL)
+                    goto done;
+                pi++;
+                break;
+            }
+            case PK_FRONTIER: {
+                int prev = (s == ms->src_init) ? '\0' : uchar(*(s - 1));
+                int curr = (s < ms->src_end) ? uchar(*s) : '\0';
+                if (inset(it->set, prev) || !inset(it->set, curr)) {
+                    s = NULL;
+                    goto done;
+                }
+                pi++;
+                break;
+            }
+            case PK_BACKREF: {
+                if ((s = matchcapture(ms, s, it->c1)) == NULL)
+                    goto done;
+                pi++;
+                break;
+            }
+            default: { /* PK_CHAR or PK_SET */
+                int m = singlematch(ms, s, it);
+                switch (it->rep) {
+                    case '?': {
+                        const char *res;
+                        if (m && (res = domatch(ms, s + 1, pi + 1)) != NULL) {
+                            s = res;
+                            goto done;
+                        }
+                        pi++; /* else skip the item */
+                        break;
+                    }
+                    case '+': { /* 1 or more repetitions */
+                        s = (m ? maxexpand(ms, s + 1, pi) : NULL);
+                        goto done;
+                    }
+                    case '*': { /* 0 or more repetitions */
+                        s = maxexpand(ms, s, pi);
+                        goto done;
+                    }
+                    case '-': { /* 0 or more repetitions (minimum) */
+                        s = minexpand(ms, s, pi);
+                        goto done;
+                    }
+                    default: { /* no repetition */
+                        if (!m) {
+                            s = NULL;
+                            goto done;
+                        }
+                        s++; pi++;
+                        break;
+                    }
+                }
+                break;
+            }
+        }
+    }
+done:
+    ms->matchdepth++;
+    return s;
+}
+
+
+/*
+** Get capture 'i' (or the whole match 's'-'e' if there are no
+** captures). Position captures are pushed as integers (0-based).
+*/
+static ptrdiff_t getonecapture(MatchState *ms, int i, const char *s,
+                               const char *e, const char **cap) {
+    if (i >= ms->level) {
+        if (c_unlikely(i != 0))
+            csL_error(ms->C, "invalid capture index %%%d", i + 1);
+        *cap = s;
+        return e - s;
+    } else {
+        ptrdiff_t capl = ms->capture[i].len;
+        *cap = ms->capture[i].init;
+        cs_assert(capl != CAP_UNFINISHED);
+        if (capl == CAP_POSITION)
+            cs_push_integer(ms->C, (ms->capture[i].init - ms->src_init));
+        return capl;
+    }
+}
+
+
+static void pushonecapture(MatchState *ms, int i, const char *s,
+                           const char *e) {
+    const char *cap;
+    ptrdiff_t l = getonecapture(ms, i, s, e, &cap);
+    if (l != CAP_POSITION)
+        cs_push_lstring(ms->C, cap, l);
+    /* else position was already pushed */
+}
+
+
+static int pushcaptures(MatchState *ms, const char *s, const char *e) {
+    int nlevels = (ms->level == 0 && s) ? 1 : ms->level;
+    csL_check_stack(ms->C, nlevels, "too many captures");
+    for (int i = 0; i < nlevels; i++)
+        pushonecapture(ms, i, s, e);
+    return nlevels; /* number of strings pushed */
+}
+
+
+/* check whether pattern has no special characters */
+static int nospecials(const char *p, size_t l) {
+    size_t upto = 0;
+    do {
+        const char *spec = strpbrk(p + upto, SPECIALS);
+        if (spec != NULL)
+            return 0; /* pattern has a special character */
+        upto += strlen(p + upto) + 1; /* may have more after '\0' */
+    } while (upto <= l);
+    return 1; /* no special chars found */
+}
+
+
+static void prepstate(MatchState *ms, cs_State *C, const char *s, size_t ls,
+                      const Pattern *p) {
+    ms->C = C;
+    ms->matchdepth = MAXCCALLS;
+    ms->src_init = s;
+    ms->src_end = s + ls;
+    ms->p = p;
+}
+
+
+static void reprepstate(MatchState *ms) {
+    ms->level = 0;
+    cs_assert(ms->matchdepth == MAXCCALLS);
+}
+
+
+static int findaux(cs_State *C, int find) {
+    size_t ls, lp;
+    const char *s = csL_check_lstring(C, 0, &ls);
+    const char *p = csL_check_lstring(C, 1, &lp);
+    size_t init = posrelat(csL_opt_integer(C, 2, 0), ls);
+    /* explicit request or no special characters? */
+    if (find && (cs_to_bool(C, 3) || nospecials(p, lp))) {
+        /* do a plain search */
+        const char *f = memfind(s + init, ls - init, p, lp);
+        if (f) {
+            cs_push_integer(C, (cs_Integer)(f - s));
+            cs_push_integer(C, (cs_Integer)(f - s + lp) - 1);
+            return 2;
+        }
+    } else {
+        MatchState ms;
+        const char *s1 = s + init;
+        const Pattern *pat = getpattern(C, 1);
+        prepstate(&ms, C, s, ls, pat);
+        do {
+            const char *res;
+            reprepstate(&ms);
+            if ((res = domatch(&ms, s1, 0)) != NULL) {
+                if (find) {
+                    cs_push_integer(C, (cs_Integer)(s1 - s)); /* start */
+                    cs_push_integer(C, (cs_Integer)(res - s) - 1); /* end */
+                    return pushcaptures(&ms, NULL, 0) + 2;
+                } else
+                    return pushcaptures(&ms, s1, res);
+            }
+        } while (s1++ < ms.src_end && !pat->anchor);
+    }
+    csL_push_fail(C); /* not found */
+    return 1;
+}
+
+
+/*
+** 'find(s, p [, init [, plain]])' returns start and end (inclusive)
+** position of the first match of 'p' in 's' starting at 'init'
+** followed by any captures, or nil. Patterns without special
+** characters (or if 'plain' is true) are searched for as plain
+** substrings.
+*/
+static int s_find(cs_State *C) {
+    return findaux(C, 1);
+}
+
+
+/* 'match(s, p [, init])' returns the captures of the first match */
+static int s_match(cs_State *C) {
+    return findaux(C, 0);
+}
+
+
+/* state for 'gmatch' */
+typedef struct GMatchState {
+    const char *src; /* current position */
+    const char *lastmatch; /* end of last match */
+    MatchState ms; /* match state */
+} GMatchState;
+
+
+static int gmatchaux(cs_State *C) {
+    GMatchState *gm = (GMatchState *)cs_to_userdata(C, cs_upvalueindex(3));
+    const char *src;
+    gm->ms.C = C;
+    for (src = gm->src; src <= gm->ms.src_end; src++) {
+        const char *e;
+        reprepstate(&gm->ms);
+        if ((e = domatch(&gm->ms, src, 0)) != NULL && e != gm->lastmatch) {
+            gm->src = gm->lastmatch = e;
+            return pushcaptures(&gm->ms, src, e);
+        }
+        if (gm->ms.p->anchor) /* anchored pattern? */
+            break; /* matches only at the current position */
+    }
+    gm->src = gm->ms.src_end + 1; /* no more matches */
+    return 0; /* not found */
+}
+
+
+/*
+** 'gmatch(s, p [, init])' returns an iterator over matches of 'p'.
+** An anchored pattern only matches where the previous match ended.
+*/
+static int s_gmatch(cs_State *C) {
+    size_t ls, lp;
+    const char *s = csL_check_lstring(C, 0, &ls);
+    size_t init = posrelat(csL_opt_integer(C, 2, 0), ls);
+    const Pattern *pat;
+    GMatchState *gm;
+    csL_check_lstring(C, 1, &lp);
+    cs_setntop(C, 2); /* keep strings on closure to avoid being collected */
+    pat = getpattern(C, 1); /* keep compiled pattern too */
+    gm = (GMatchState *)cs_newuserdata(C, sizeof(GMatchState), 0);
+    prepstate(&gm->ms, C, s, ls, pat);
+    gm->src = s + init;
+    gm->lastmatch = NULL;
+    cs_push_cclosure(C, gmatchaux, 4);
+    return 1;
+}
+
+
+static void add_s(MatchState *ms, csL_Buffer *b, const char *s,
+                  const char *e) {
+    size_t l;
+    cs_State *C = ms->C;
+    const char *news = cs_to_lstring(C, 2, &l);
+    const char *p;
+    while ((p = (const char *)memchr(news, L_ESC, l)) != NULL) {
+        csL_buff_push_lstring(b, news, p - news);
+        p++; /* skip ESC */
+        if (*p == L_ESC) /* '%%' */
+            csL_buff_push(b, *p);
+        else if (*p == '0') /* '%0' */
+            csL_buff_push_lstring(b, s, e - s);
+        else if (isdigit(uchar(*p))) { /* '%n' */
+            const char *cap;
+            ptrdiff_t resl = getonecapture(ms, *p - '1', s, e, &cap);
+            if (resl == CAP_POSITION) { /* position capture? */
+                csL_to_lstring(C, -1, NULL); /* convert it to string */
+                cs_remove(C, -2); /* remove the integer */
+                csL_buff_push_stack(b); /* add position to the result */
+            } else
+                csL_buff_push_lstring(b, cap, resl);
+        } else
+            csL_error(C, "invalid use of '%c' in replacement string", L_ESC);
+        l -= p + 1 - news;
+        news = p + 1;
+    }
+    csL_buff_push_lstring(b, news, l);
+}
+
+
+/*
+** Add the replacement value for the match 's'-'e' into buffer 'b'.
+** Returns 1 if the original string was changed (function and table
+** values that are false or nil keep the original match).
+*/
+static int add_value(MatchState *ms, csL_Buffer *b, const char *s,
+                     const char *e, int tr) {
+    cs_State *C = ms->C;
+    switch (tr) {
+        case CS_TFUNCTION: { /* call the function */
+            int n;
+            cs_push(C, 2); /* push the function */
+            n = pushcaptures(ms, s, e); /* all captures as arguments */
+            cs_call(C, n, 1); /* call it */
+            break;
+        }
+        case CS_TTABLE: { /* index the table */
+            pushonecapture(ms, 0, s, e); /* first capture is the key */
+            cs_get_field(C, 2);
+            break;
+        }
+        default: { /* CS_TSTRING */
+            add_s(ms, b, s, e);
+            return 1; /* something changed */
+        }
+    }
+    if (!cs_to_bool(C, -1)) { /* nil or false? */
+        cs_pop(C, 1); /* remove value */
+        csL_buff_push_lstring(b, s, e - s); /* keep original text */
+        return 0; /* no changes */
+    } else if (c_unlikely(!cs_is_string(C, -1))) {
+        return csL_error(C, "invalid replacement value (a %s)",
+                            csL_typename(C, -1));
+    } else {
+        csL_buff_push_stack(b); /* add result to accumulator */
+        return 1; /* something changed */
+    }
+}
+
+
+/*
+** 'gsub(s, p, repl [, n])' replaces (up to 'n') matches of 'p' in 's'
+** by 'repl' (a string, table or function) and returns the new string
+** and the number of matches.
+*/
+static int s_gsub(cs_State *C) {
+    size_t srcl, lp;
+    const char *src = csL_check_lstring(C, 0, &srcl);
+    const char *lastmatch = NULL;
+    int tr = cs_type(C, 2);
+    cs_Integer maxn = csL_opt_integer(C, 3, (cs_Integer)srcl + 1);
+    cs_Integer n = 0;
+    int changed = 0;
+    const Pattern *pat;
+    MatchState ms;
+    csL_Buffer b;
+    csL_check_lstring(C, 1, &lp);
+    csL_expect_arg(C, tr == CS_TSTRING || tr == CS_TFUNCTION ||
+                      tr == CS_TTABLE, 2, "string/function/table");
+    pat = getpattern(C, 1);
+    csL_buff_init(C, &b);
+    prepstate(&ms, C, src, srcl, pat);
+    while (n < maxn) {
+        const char *e;
+        reprepstate(&ms);
+        if ((e = domatch(&ms, src, 0)) != NULL && e != lastmatch) { /* match? */
+            n++;
+            changed = add_value(&ms, &b, src, e, tr) | changed;
+            src = lastmatch = e;
+        } else if (src < ms.src_end) /* otherwise, skip one character */
+            csL_buff_push(&b, *src++);
+        else break; /* end of subject */
+        if (pat->anchor) break;
+    }
+    if (!changed) { /* no changes? */
+        cs_push(C, 0); /* return original string */
+    } else { /* something changed */
+        csL_buff_push_lstring(&b, src, ms.src_end - src);
+        csL_buff_end(&b); /* create and return new string */
+    }
+    cs_push_integer(C, n); /* number of substitutions */
+    return 2;
+}
+
+/* }====================================================================== */
+
+
+
+/* {======================================================================
+** Format
+** ======================================================================= */
+
+/* valid flags in a format specification */
+#define L_FMTFLAGSF     "-+ #0"
+
+/*
+** Maximum size of each formatted item. This maximum size is produced
+** by format('%.99f', -maxfloat), and is equal to 99 + 3 ('-', '.',
+** and '\0') + number of decimal digits to represent maxfloat (which
+** is maximum exponent + 1). (99+3+1, adding some extra, 110)
+*/
+#define MAX_ITEMF       (110 + cs_floatatt(MAX_10_EXP))
+
+/*
+** All formats except '%f' do not need that large limit. The other
+** float formats use exponents, so that they fit in the 99 limit for
+** significant digits; 's' for large strings adds items directly to
+** the buffer; all integer formats also fit in the 99 limit. The
+** worst case are floats: they may need 99 significant digits, plus
+** '0x', '-', '.', 'e+XXXX', and '\0'. Adding some extra, 120.
+*/
+#define MAX_ITEM        120
+
+/* maximum size of each format specification (such as "%-099.99d") */
+#define MAX_FORMAT      32
+
+
+/* skip at most two digits */
+static const char *get2digits(const char *s) {
+    if (isdigit((unsigned char)*s)) {
+        s++;
+        if (isdigit((unsigned char)*s)) s++; /* (2 digits at most) */
+    }
+    return s;
+}
+
+
+/*
+** Copy conversion specification pointed to by 'strfrmt' into 'form'
+** (prefixed with '%') and return pointer to its conversion specifier.
+** Width and precision have at most two digits each, which bounds the
+** size of every item (see 'MAX_ITEM').
+*/
+static const char *getformat(cs_State *C, const char *strfrmt,
+                             char *form) {
+    const char *spec = strfrmt + strspn(strfrmt, L_FMTFLAGSF);
+    size_t len;
+    if (*spec != '0') { /* a width cannot start with '0' */
+        spec = get2digits(spec); /* skip width */
+        if (*spec == '.')
+            spec = get2digits(spec + 1); /* skip precision */
+    }
+    len = (size_t)(spec - strfrmt) + 1; /* add specifier */
+    if (c_unlikely(!isalpha((unsigned char)*spec) || len >= MAX_FORMAT - 10))
+        csL_error(C, "invalid conversion specification to 'format'");
+    *(form++) = '%';
+    memcpy(form, strfrmt, len * sizeof(char));
+    *(form + len) = '\0';
+    return strfrmt + len - 1;
+}
+
+
+/* add length modifier into format 'form' */
+static void addlenmod(char *form, const char *lenmod) {
+    size_t l = strlen(form);
+    size_t lm = strlen(lenmod);
+    char spec = form[l - 1];
+    strcpy(form + l - 1, lenmod);
+    form[l + lm - 1] = spec;
+    form[l + lm] = '\0';
+}
+
+
+static int s_format(cs_State *C) {
+    int top = cs_gettop(C);
+    int arg = 0;
+    size_t sfl;
+    const char *strfrmt = csL_check_lstring(C, arg, &sfl);
+    const char *strfrmt_end = strfrmt + sfl;
+    csL_Buffer B;
+    csL_buff_init(C, &B);
+    while (strfrmt < strfrmt_end) {
+        if (*strfrmt != '%') {
+            csL_buff_push(&B, *strfrmt++);
+        } else if (*++strfrmt == '%') {
+            csL_buff_push(&B, *strfrmt++); /* %% */
+        } else { /* format item */
+            char form[MAX_FORMAT];
+            int maxitem = MAX_ITEM;
+            char *buff = csL_buff_ensure(&B, maxitem);
+            int nb = 0;
+            if (++arg > top)
+                return csL_error_arg(C, arg, "no value");
+            strfrmt = getformat(C, strfrmt, form);
+            switch (*strfrmt++) {
+                case 'c': {
+                    nb = c_snprintf(buff, maxitem, form,
+                                    (int)csL_check_integer(C, arg));
+                    break;
+                }
+                case 'd': case 'i':
+                case 'o': case 'u': case 'x': case 'X': {
+                    cs_Integer n = csL_check_integer(C, arg);
+                    addlenmod(form, CS_INTEGER_FMTLEN);
+                    nb = c_snprintf(buff, maxitem, form, (CS_INTEGER)n);
+                    break;
+                }
+                case 'a': case 'A': {
+                    addlenmod(form, CS_FLOAT_FMTLEN);
+                    nb = cs_number2strx(C, buff, maxitem, form,
+                                        csL_check_number(C, arg));
+                    break;
+                }
+                case 'f': case 'F': {
+                    maxitem = MAX_ITEMF; /* extra space for '%f' */
+                    buff = csL_buff_ensure(&B, maxitem);
+                }
+                /* FALLTHRU */
+                case 'e': case 'E': case 'g': case 'G': {
+                    cs_Number n = csL_check_number(C, arg);
+                    addlenmod(form, CS_FLOAT_FMTLEN);
+                    nb = c_snprintf(buff, maxitem, form, (CS_NUMBER)n);
+                    break;
+                }
+                case 's': {
+                    size_t l;
+                    const char *s = csL_to_lstring(C, arg, &l);
+                    if (form[2] == '\0') { /* no modifiers? */
+                        csL_buff_push_stack(&B); /* keep entire string */
+                    } else {
+                        csL_check_arg(C, l == strlen(s), arg,
+                                      "string contains zeros");
+                        if (!strchr(form, '.') && l >= 100) {
+                            /* no precision and string is too long to be
+                               formatted */
+                            csL_buff_push_stack(&B); /* keep entire string */
+                        } else { /* format the string into 'buff' */
+                            nb = c_snprintf(buff, maxitem, form, s);
+                            cs_pop(C, 1); /* remove result from
+                                             'csL_to_lstring' */
+                        }
+                    }
+                    break;
+                }
+                default: { /* also treat cases 'pnLlh' */
+                    return csL_error(C, "invalid conversion '%s' to 'format'",
+                                        form);
+                }
+            }
+            if (c_unlikely(nb < 0 || nb >= maxitem))
+                return csL_error(C, "invalid conversion '%s' to 'format'",
+                                    form);
+            csL_buffadd(&B, nb);
+        }
+    }
+    csL_buff_end(&B);
+    return 1;
+}
+
+/* }====================================================================== */
+
+
+static const cs_Entry strlib[] = {
+    {"len", s_len},
+    {"sub", s_sub},
+    {"reverse", s_reverse},
+    {"lower", s_lower},
+    {"upper", s_upper},
+    {"rep", s_rep},
+    {"byte", s_byte},
+    {"char", s_char},
+    {"dump", s_dump},
+    {"rfind", s_rfind},
+    {"startswith", s_startswith},
+    {"endswith", s_endswith},
+    {"split", s_split},
+    {"trim", s_trim},
+    {"format", s_format},
+    {NULL, NULL}
+};
+
+
+/* functions using the pattern cache (as their upvalue) */
+static const cs_Entry patlib[] = {
+    {"find", s_find},
+    {"match", s_match},
+    {"gmatch", s_gmatch},
+    {"gsub", s_gsub},
+    {NULL, NULL}
+};
+
+
+CSMOD_API int csopen_string(cs_State *C) {
+    csL_newlib(C, strlib);
+    createpatcache(C);
+    csL_setfuncs(C, patlib, 1);
+    return 1;
+}
@@ -38,13 +38,134 @@
 #define MINHSIZE        twoto(MINHTBITS)
 
 
+#if CSI_SWISSTABLE
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+** Open addressing with control bytes ("Swiss tables"). Node 'i' has the
+** control byte 'ctrl[i]', which is either CTRL_EMPTY or the low 7 bits
+** of the hash of its key ('h2'). Nodes are split into groups of
+** GROUPSIZE, the control bytes of a whole group are compared against
+** 'h2' at once (with SSE2 when available), and only the nodes whose
+** byte matches have their keys compared. Groups are probed starting at
+** the group selected by the remaining hash bits ('h1'), with triangular
+** steps that visit every group, until a group with an empty node.
+** Keys are never removed (as with chained tables, a removed field only
+** empties its value), so no tombstones are needed; a rehash drops the
+** empty entries. The array is kept at most 7/8 full so that every
+** probe sequence ends.
+*/
+
+#define GROUPSIZE       16
+
+#define CTRL_EMPTY      0x80
+
+#define h1(h)           ((h) >> 7)
+#define h2(h)           cast_byte((h) & 0x7F)
+
+#define ngroups(ht)     cast_uint(htsize(ht) / GROUPSIZE)
+
+/* maximum number of keys in a hash array of 'size' nodes */
+#define maxload(size)   ((size) - ((size) >> 3))
+
+/* bit 'i' is set for each node 'i' of a group that matches */
+typedef uint GroupMask;
+
+#if defined(__GNUC__)
+#define firstbit(m)     cast_uint(__builtin_ctz(m))
+#else
+static uint firstbit(GroupMask m) {
+    uint i = 0;
+    while (!(m & 1u)) { m >>= 1; i++; }
+    return i;
+}
+#endif
+
+
+static inline GroupMask groupmatch(const c_byte *ctrl, c_byte b) {
+#if defined(__SSE2__)
+    __m128i g = _mm_loadu_si128(cast(const __m128i *, ctrl));
+    __m128i m = _mm_cmpeq_epi8(g, _mm_set1_epi8(cast(char, b)));
+    return cast_uint(_mm_movemask_epi8(m));
+#else
+    GroupMask m = 0;
+    for (int i = 0; i < GROUPSIZE; i++)
+        m |= cast_uint(ctrl[i] == b) << i;
+    return m;
+#endif
+}
+
+
+/*
+** Probe 'ht' for hash 'h' returning the value of the first node 'n'
+** with a matching control byte for which 'eq' holds, or 'absentkey'.
+*/
+#define swisslookup(ht,h,n,eq) { \
+    uint mask_ = ngroups(ht) - 1; \
+    uint g_ = h1(h) & mask_; \
+    for (uint i_ = 1; ; g_ = (g_ + i_++) & mask_) { \
+        const c_byte *ctrl_ = (ht)->ctrl + g_ * GROUPSIZE; \
+        GroupMask m_; \
+        for (m_ = groupmatch(ctrl_, h2(h)); m_ != 0; m_ &= m_ - 1) { \
+            Node *n = htnode(ht, g_ * GROUPSIZE + firstbit(m_)); \
+            if (eq) return nodeval(n); \
+        } \
+        if (groupmatch(ctrl_, CTRL_EMPTY) != 0) \
+            return &absentkey; \
+    }}
+
+
+/* finalizer of MurmurHash3, spreads 'h' over all the bits */
+static inline uint mixhash(uint h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+
+/* fold 'x' into an 'uint' (shift twice in case it is not wider) */
+#define foldbits(x)     cast_uint((x) ^ ((x) >> 31 >> 1))
+
+#define hashnum(h)      mixhash(h)
+#define hashint(i)      mixhash(foldbits(c_castS2U(i)))
+#define hashstr(s)      mixhash((s)->hash)
+#define hashpointer(p)  mixhash(foldbits(cast(uintptr_t, p)))
+
+/* extra bytes per node: cached hash and control byte */
+#define NODEEXTRA       (sizeof(uint) + 1)
+
+#else
+
+/* chained tables use the low bits of the hash as the main position */
+#define hashnum(h)      (h)
+#define hashint(i)      cast_uint(c_castS2U(i))
+#define hashstr(s)      ((s)->hash)
+#define hashpointer(p)  pointer2uint(p)
+
 /* get hashtable 'node' slot from hash 'h' */
 #define hashpow2(ht,h)      htnode(ht, hashmod(h, htsize(ht)))
 
+/* extra bytes per node: cached hash */
+#define NODEEXTRA       sizeof(uint)
+
+#endif
+
 
-#define hashstr(ht,s)       hashpow2(ht, (s)->hash)
-#define hashboolean(ht,b)   hashpow2(ht, b)
-#define hashpointer(ht,p)   hashpow2(ht, pointer2uint(p))
+/* cached hash of the key in node 'n' */
+#define nodehash(ht,n)      ((ht)->hashes[(n) - htnode(ht, 0)])
+
+
+/*
+** Size in bytes of a hash array with 'size' nodes; the cached hashes
+** (and control bytes) follow the nodes in the same block.
+*/
+#define hasharraysize(size)     (cast(c_mem, size) * (sizeof(Node) + NODEEXTRA))
 
 
 
@@ -65,17 +186,31 @@ static uint hashflt(cs_Number n) {
 }
 
 
-static Node *hashint(const Table *ht, cs_Integer i) {
-    cs_Unsigned ui = c_castS2U(i);
-    if (ui <= cast_uint(MAXINT))
-        return hashpow2(ht, cast_int(ui));
-    else
-        return hashpow2(ht, ui);
+/*
+** Hash of key 'k'; it is computed once when the key is inserted and
+** cached in 'hashes', so that moving and rehashing nodes does not need
+** to touch the key objects again.
+*/
+static uint hashkey(const TValue *k) {
+    switch (ttypetag(k)) {
+        case CS_VTRUE: return hashnum(1);
+        case CS_VFALSE: return hashnum(0);
+        case CS_VSHRSTR: return hashstr(strval(k));
+        case CS_VLNGSTR: return hashnum(csS_hashlngstr(strval(k)));
+        case CS_VNUMINT: return hashint(ival(k));
+        case CS_VNUMFLT: return hashnum(hashflt(fval(k)));
+        case CS_VLIGHTUSERDATA: return hashpointer(pval(k));
+        case CS_VLCF: return hashpointer(lcfval(k));
+        default: return hashpointer(gcoval(k));
+    }
 }
 
 
-static inline void inithash(Node *n, int limit) {
+static inline void inithash(Table *ht) {
+    Node *n = htnode(ht, 0);
+    int limit = htsize(ht);
     cs_assert(!(limit & (limit - 1)) && limit >= 4);
+    memset(ht->hashes, 0, sizeof(uint) * cast_sizet(limit));
     for (int i = 0; i < limit; i += 4) { /* unroll */
         nodenext(n) = 0; setnilkey(n); setemptyval(nodeval(n)); n++;
         nodenext(n) = 0; setnilkey(n); setemptyval(nodeval(n)); n++;
@@ -85,6 +220,49 @@ static inline void inithash(Node *n, int limit) {
 }
 
 
+#if CSI_SWISSTABLE
+
+/* make every node of 'ht' empty */
+static void clearhash(Table *ht) {
+    inithash(ht);
+    memset(ht->ctrl, CTRL_EMPTY, cast_sizet(htsize(ht)));
+    ht->growthleft = maxload(htsize(ht));
+}
+
+
+/* allocate hash array with room for 'size' keys */
+static void newhasharray(cs_State *cr, Table *ht, uint size) {
+    int nbits;
+    size += size / 7; /* keep the array at most 7/8 full */
+    if (size < GROUPSIZE)
+        size = GROUPSIZE;
+    nbits = csO_ceillog2(size);
+    if (c_unlikely(nbits > MAXHBITS || (1u << nbits) > MAXHSIZE))
+        csD_runerror(cr, "hashtable overflow");
+    size = twoto(nbits);
+    ht->node = csM_newarray(cr, hasharraysize(size), c_byte);
+    ht->hashes = cast(uint *, htnode(ht, size));
+    ht->ctrl = cast(c_byte *, ht->hashes + size);
+    ht->size = nbits;
+    clearhash(ht);
+}
+
+
+c_sinline void htpreinit(Table *ht) {
+    ht->size = 0;
+    ht->node = NULL;
+    ht->hashes = NULL;
+    ht->oldnode = NULL;
+    ht->oldpos = 0;
+    ht->oldsize = 0;
+    ht->mode = 0;
+    ht->ctrl = NULL;
+    ht->growthleft = 0;
+    ht->gclist = NULL;
+}
+
+#else
+
 /* allocate hash array */
 static void newhasharray(cs_State *cr, Table *ht, uint size) {
     int nbits;
@@ -94,9 +272,10 @@ static void newhasharray(cs_State *cr, Table *ht, uint size) {
     if (c_unlikely(nbits > MAXHBITS || (1u << nbits) > MAXHSIZE))
         csD_runerror(cr, "hashtable overflow");
     size = twoto(nbits);
-    ht->node = csM_newarray(cr, size, Node);
-    inithash(htnode(ht, 0), size);
+    ht->node = csM_newarray(cr, hasharraysize(size), c_byte);
+    ht->hashes = cast(uint *, htnode(ht, size));
     ht->size = nbits;
+    inithash(ht);
     ht->lastfree = htnode(ht, size);
 }
 
@@ -104,9 +283,16 @@ static void newhasharray(cs_State *cr, Table *ht, uint size) {
 c_sinline void htpreinit(Table *ht) {
     ht->size = 0;
     ht->node = ht->lastfree = NULL;
+    ht->hashes = NULL;
+    ht->oldnode = NULL;
+    ht->oldpos = 0;
+    ht->oldsize = 0;
+    ht->mode = 0;
     ht->gclist = NULL;
 }
 
+#endif
+
 
 /* create new hashtable of specific size */
 Table *csH_newsz(cs_State *C, int size) {
@@ -127,62 +313,81 @@ Table *csH_new(cs_State *C) {
 
 
 static inline void freehash(cs_State *C, Table *ht) {
-    csM_freearray(C, ht->node, htsize(ht));
+    csM_freemem(C, ht->node, hasharraysize(htsize(ht)));
+}
+
+
+/*
+** Set 'v' as a view of the hash array that 'ht' is moving from, so
+** that it can be searched and freed like any other hash array.
+*/
+static void oldview(const Table *ht, Table *v) {
+    int size = twoto(ht->oldsize);
+    cs_assert(ht->oldnode != NULL);
+    v->size = ht->oldsize;
+    v->node = ht->oldnode;
+    v->hashes = cast(uint *, ht->oldnode + size);
+#if CSI_SWISSTABLE
+    v->ctrl = cast(c_byte *, v->hashes + size);
+#endif
+}
+
+
+/* free the old hash array of 'ht' */
+static void freeold(cs_State *C, Table *ht) {
+    Table old;
+    oldview(ht, &old);
+    freehash(C, &old);
+    ht->oldnode = NULL;
+    ht->oldpos = 0;
 }
 
 
 void csH_free(cs_State *C, Table *ht) {
+    if (ht->oldnode != NULL)
+        freeold(C, ht);
     freehash(C, ht);
-    csM_free(C, ht);
+    csM_freeobj(C, ht, sizeof(*ht));
 }
 
 
-/*
-** Find the main position (slot) for key 'k' inside
-** the hash array.
-*/
-static Node *mainposition(const Table *ht, const TValue *k) {
-    switch (ttypetag(k)) {
-        case CS_VTRUE: return hashboolean(ht, 1);
-        case CS_VFALSE: return hashboolean(ht, 0);
-        case CS_VSHRSTR: {
-            OString *s = strval(k);
-            return hashstr(ht, s);
-        }
-        case CS_VLNGSTR: {
-            OString *s = strval(k);
-            return hashpow2(ht, csS_hashlngstr(s));
-        }
-        case CS_VNUMINT: {
-            cs_Integer i = ival(k);
-            return hashint(ht, i);
-        }
-        case CS_VNUMFLT: {
-            cs_Number n = fval(k);
-            return hashpow2(ht, hashflt(n));
-        }
-        case CS_VLIGHTUSERDATA: {
-            void *p = pval(k);
-            return hashpointer(ht, p);
-        }
-        case CS_VLCF: {
-            cs_CFunction lcf = lcfval(k);
-            return hashpointer(ht, lcf);
-        }
-        default: {
-            GCObject *o = gcoval(k);
-            return hashpointer(ht, o);
-        }
+#if CSI_SWISSTABLE
+
+/* index of the first empty node in the probe sequence of hash 'h' */
+static uint findempty(const Table *ht, uint h) {
+    uint mask = ngroups(ht) - 1;
+    uint g = h1(h) & mask;
+    for (uint i = 1; ; g = (g + i++) & mask) {
+        GroupMask m = groupmatch(ht->ctrl + g * GROUPSIZE, CTRL_EMPTY);
+        if (m != 0)
+            return g * GROUPSIZE + firstbit(m);
     }
 }
 
 
-static inline Node *mainposfromnode(Table *ht, Node *mp) {
-    TValue key;
-    getnodekey(cast(cs_State *, NULL), &key, mp);
-    return mainposition(ht, &key);
+static void exchangehashes(Table *ht1, Table *ht2) {
+    Node *node = ht1->node;
+    uint *hashes = ht1->hashes;
+    c_byte *ctrl = ht1->ctrl;
+    int growthleft = ht1->growthleft;
+    c_byte sz = ht1->size;
+    ht1->size = ht2->size;
+    ht1->node = ht2->node;
+    ht1->hashes = ht2->hashes;
+    ht1->ctrl = ht2->ctrl;
+    ht1->growthleft = ht2->growthleft;
+    ht2->size = sz;
+    ht2->node = node;
+    ht2->hashes = hashes;
+    ht2->ctrl = ctrl;
+    ht2->growthleft = growthleft;
 }
 
+#else
+
+/* main position of a node whose key is in node 'n' */
+#define mainposfromnode(ht,n)   hashpow2(ht, nodehash(ht, n))
+
 
 /* get next free hash array position or NULL */
 static Node *getfreepos(Table *ht) {
@@ -197,87 +402,150 @@ static Node *getfreepos(Table *ht) {
 
 static void exchangehashes(Table *ht1, Table *ht2) {
     Node *node = ht1->node;
+    uint *hashes = ht1->hashes;
     Node *lastfree = ht1->lastfree;
     c_byte sz = ht1->size;
     ht1->size = ht2->size;
     ht1->node = ht2->node;
+    ht1->hashes = ht2->hashes;
     ht1->lastfree = ht2->lastfree;
     ht2->size = sz;
     ht2->node = node;
+    ht2->hashes = hashes;
     ht2->lastfree = lastfree;
 }
 
+#endif
+
+
+static void insertkey(cs_State *C, Table *ht, const TValue *key,
+                      const TValue *val, uint h);
+
 
 /* 
-** Insert all the elements from 'src' hashtable to 'dest'
-** hashtable.
+** Insert all the elements from 'src' hashtable starting at node 'i'
+** to 'dest' hashtable. Keys are known to be distinct and their hashes
+** are cached, so they are inserted without looking them up.
 */
-static void insertfrom(cs_State *C, Table *src, Table *dest) {
+static void insertfrom(cs_State *C, Table *src, int i, Table *dest) {
     int size = htsize(src);
-    for (int i = 0; i < size; i++) {
+    for (; i < size; i++) {
         Node *oldn = htnode(src, i);
         if (!isempty(nodeval(oldn))) {
             TValue key;
             getnodekey(C, &key, oldn);
-            csH_set(C, dest, &key, nodeval(oldn));
+            insertkey(C, dest, &key, nodeval(oldn), src->hashes[i]);
         }
     }
 }
 
 
-/* resize hashtable to new size */
+/*
+** Remove all entries from 'ht' keeping its hash array (for tables
+** that are reused, see 'OP_NEWTABLE').
+*/
+void csH_reset(cs_State *C, Table *ht) {
+    if (ht->oldnode != NULL)
+        freeold(C, ht);
+#if CSI_SWISSTABLE
+    clearhash(ht);
+#else
+    inithash(ht);
+    ht->lastfree = htnodelast(ht);
+#endif
+}
+
+
+/*
+** Resize hashtable to new size; nodes that were still in its old hash
+** array (see 'rehash') are moved too.
+*/
 void csH_resize(cs_State *C, Table *ht, uint newsize) {
-    Table newht;
+    Table newht, old;
+    int oldpos = ht->oldpos;
+    int hasold = (ht->oldnode != NULL);
     if (c_unlikely(newsize < MINHSIZE))
         newsize = MINHSIZE;
     newhasharray(C, &newht, newsize);
+    if (hasold) {
+        oldview(ht, &old);
+        ht->oldnode = NULL; /* its nodes are moved right now */
+        ht->oldpos = 0;
+    }
     exchangehashes(ht, &newht);
-    insertfrom(C, &newht, ht);
+    insertfrom(C, &newht, 0, ht);
     freehash(C, &newht);
+    if (hasold) {
+        insertfrom(C, &old, oldpos, ht);
+        freehash(C, &old);
+    }
 }
 
 
-/* rehash hashtable keys */
-static void rehash(cs_State *C, Table *ht) {
-    int arrsize = htsize(ht);
+/* number of non-empty nodes in 'ht' starting at node 'i' */
+static int numusednodes(const Table *ht, int i) {
     int usednodes = 0;
-    for (int i = 0; i < arrsize; i++) {
-        const Node *n = htnode(ht, i);
-        usednodes += !isempty(nodeval(n));
+    for (; i < htsize(ht); i++)
+        usednodes += !isempty(nodeval(htnode(ht, i)));
+    return usednodes;
+}
+
+
+/*
+** Rehash hashtable keys. Large hash arrays are not rehashed at once:
+** the current one becomes the old hash array of 'ht', from which
+** 'migrate' moves the nodes a few at a time into the new one, while
+** lookups search both. If the new array fills up before all the nodes
+** are moved, the remaining ones are rehashed together with it.
+*/
+static void rehash(cs_State *C, Table *ht) {
+    int usednodes = numusednodes(ht, 0);
+    if (ht->oldnode != NULL) { /* still moving nodes? */
+        Table old;
+        oldview(ht, &old);
+        usednodes += numusednodes(&old, ht->oldpos);
     }
     usednodes++; /* for one extra key */
-    csH_resize(C, ht, usednodes);
+    if (CSI_REHASHSTEP > 0 && ht->oldnode == NULL &&
+            htsize(ht) >= CSI_REHASHMIN) {
+        Table newht;
+        newhasharray(C, &newht, cast_uint(usednodes));
+        exchangehashes(ht, &newht);
+        ht->oldnode = newht.node; /* nodes are moved later */
+        ht->oldsize = newht.size;
+        ht->oldpos = 0;
+    } else
+        csH_resize(C, ht, cast_uint(usednodes));
 }
 
 
-/* insert new key */
-void csH_newkey(cs_State *C, Table *ht, const TValue *key,
-                const TValue *val) {
+/*
+** Insert 'key' (with hash 'h'), which must not be present in 'ht',
+** growing the table if needed.
+*/
+static void insertkey(cs_State *C, Table *ht, const TValue *key,
+                      const TValue *val, uint h) {
     Node *mp;
-    TValue aux;
-    if (c_unlikely(ttisnil(key))) {
-        csD_runerror(C, "index is nil");
-    } else if (ttisflt(key)) {
-        cs_Number f = fval(key);
-        cs_Integer k;
-        if (csO_n2i(f, &k, N2IEXACT)) { /* does key fit in an integer? */
-            setival(&aux, k);
-            key = &aux; /* insert it as an integer */
-        }
-        else if (c_unlikely(c_numisnan(f))) /* float is NaN? */
-            csD_runerror(C, "index is NaN");
-        /* else */
-    } /* fall through */
-    if (ttisnil(val))
-        return;  /* do not insert nil values */
-    mp = mainposition(ht, key); /* get main position for 'key' */
+#if CSI_SWISSTABLE
+    uint i;
+    if (ht->growthleft == 0) { /* no room for another key? */
+        rehash(C, ht); /* grow table */
+        insertkey(C, ht, key, val, h); /* insert key */
+        return; /* done */
+    }
+    i = findempty(ht, h);
+    ht->ctrl[i] = h2(h);
+    ht->growthleft--;
+    mp = htnode(ht, i);
+#else
+    mp = hashpow2(ht, h); /* get main position for 'key' */
     if (!isempty(nodeval(mp))) { /* mainposition already taken ? */
         Node *othern;
         Node *f = getfreepos(ht); /* get next free position */
         if (f == NULL) { /* no free position ? */
             rehash(C, ht); /* grow table */
-            csH_set(C, ht, key, val); /* insert key */
-            return; /* done, key must be a new key */
+            insertkey(C, ht, key, val, h); /* insert key */
+            return; /* done */
         }
         othern = mainposfromnode(ht, mp);
         if (othern != mp) { /* is colliding node out of its main position? */
@@ -286,6 +554,7 @@ void csH_newkey(cs_State *C, Table *ht, const TValue *key,
                 othern += nodenext(othern);
             nodenext(othern) = f - othern; /* rechain to point to 'f' */
             *f = *mp; /* copy colliding node into free pos. (mp->next also goes) */
+            nodehash(ht, f) = nodehash(ht, mp); /* and its hash */
             if (nodenext(mp) != 0) {
                 nodenext(f) += mp - f; /* correct 'next' */
                 nodenext(mp) = 0; /* now 'mp' is free */
@@ -301,13 +570,71 @@ void csH_newkey(cs_State *C, Table *ht, const TValue *key,
             mp = f;
         }
     }
+#endif
     setnodekey(C, mp, key); /* set key */
+    nodehash(ht, mp) = h;
     csG_barrierback(C, obj2gco(ht), key); /* set 'ht' as gray */
     cs_assert(isempty(nodeval(mp))); /* value slot must be empty */
     setobj(C, nodeval(mp), val); /* set value */
 }
 
 
+/*
+** Move up to 'n' nodes from the old hash array of 'ht' into its current
+** one, freeing the old array once all nodes were moved.
+*/
+static void migrate(cs_State *C, Table *ht, int n) {
+    int size = twoto(ht->oldsize);
+    const uint *hashes = cast(const uint *, ht->oldnode + size);
+    while (n-- > 0 && ht->oldpos < size) {
+        int i = ht->oldpos++;
+        Node *old = &ht->oldnode[i];
+        if (!isempty(nodeval(old))) {
+            TValue key, val; /* copies; inserting may free the old array */
+            getnodekey(C, &key, old);
+            setobj(C, &val, nodeval(old));
+            insertkey(C, ht, &key, &val, hashes[i]);
+            if (ht->oldnode == NULL) /* rehashed everything? */
+                return; /* done */
+        }
+    }
+    if (ht->oldpos == size) /* moved all nodes? */
+        freeold(C, ht);
+}
+
+
+/* finish moving the nodes of the old hash array of 'ht', if any */
+void csH_finishrehash(cs_State *C, Table *ht) {
+    if (ht->oldnode != NULL)
+        migrate(C, ht, MAXINT);
+}
+
+
+/* insert new key */
+void csH_newkey(cs_State *C, Table *ht, const TValue *key,
+                const TValue *val) {
+    TValue aux;
+    if (c_unlikely(ttisnil(key))) {
+        csD_runerror(C, "index is nil");
+    } else if (ttisflt(key)) {
+        cs_Number f = fval(key);
+        cs_Integer k;
+        if (csO_n2i(f, &k, N2IEXACT)) { /* does key fit in an integer? */
+            setival(&aux, k);
+            key = &aux; /* insert it as an integer */
+        }
+        else if (c_unlikely(c_numisnan(f))) /* float is NaN? */
+            csD_runerror(C, "index is NaN");
+        /* else */
+    } /* fall through */
+    if (ttisnil(val))
+        return;  /* do not insert nil values */
+    if (c_unlikely(ht->oldnode != NULL)) /* rehash in progress? */
+        migrate(C, ht, CSI_REHASHSTEP);
+    insertkey(C, ht, key, val, hashkey(key));
+}
+
+
 /* 
 ** Raw equality without calling vmt methods.
 ** 'deadok' means that 'dead' keys  are allowed to be compared with the
@@ -317,8 +644,8 @@ void csH_newkey(cs_State *C, Table *ht, const TValue *key,
 ** pointer identity. 'csH_next' function calls this with 'deadok' set in
 ** order  to traverse the table and find all the valid values inside the
 ** table, because dead key nodes still have valid 'next' field.
-** Note: as of current version CScript does not expose or implement
-** weak tables in its API.
+** Dead keys are also left behind by entries removed from weak tables
+** (see 'cs_set_mode').
 */
 static int eqkey(const TValue *k, const Node *n, int deadok) {
     if ((rawtt(k) != keytt(n)) && /* not the same variant? */
@@ -347,10 +674,18 @@ static int eqkey(const TValue *k, const Node *n, int deadok) {
 }
 
 
+/*
+** Generic lookup; cached hashes are compared first, so that keys with
+** a different hash (long strings in particular) are not touched.
+*/
 static const TValue *getgeneric(Table *ht, const TValue *key, int deadok) {
-    Node *n = mainposition(ht, key);
+    uint h = hashkey(key);
+#if CSI_SWISSTABLE
+    swisslookup(ht, h, n, nodehash(ht, n) == h && eqkey(key, n, deadok));
+#else
+    Node *n = hashpow2(ht, h);
     for (;;) {
-        if (eqkey(key, n, deadok)) {
+        if (nodehash(ht, n) == h && eqkey(key, n, deadok)) {
             return nodeval(n);
         } else {
             int next = nodenext(n);
@@ -359,44 +694,136 @@ static const TValue *getgeneric(Table *ht, const TValue *key, int deadok) {
             n += next;
         }
     }
+#endif
+}
+
+
+/*
+** Slot of 'key' in the old hash array of 'ht' (see 'rehash'); keys in
+** nodes that were already moved do not count, a key that is not in the
+** current hash array anymore was removed after it was moved.
+*/
+static const TValue *getold(Table *ht, const TValue *key, int deadok) {
+    Table old;
+    const TValue *slot;
+    oldview(ht, &old);
+    slot = getgeneric(&old, key, deadok);
+    if (!isabstkey(slot) && cast(Node *, slot) - old.node < ht->oldpos)
+        return &absentkey; /* key was moved */
+    return slot;
 }
 
 
-/* auxliary function to 'csH_next' */
-static uint getindex(cs_State *C, Table *ht, const TValue *k) {
+/* like 'getgeneric', but also searching the old hash array of 'ht' */
+static const TValue *getgenericall(Table *ht, const TValue *key) {
+    const TValue *slot = getgeneric(ht, key, 0);
+    if (c_unlikely(ht->oldnode != NULL) && isabstkey(slot))
+        slot = getold(ht, key, 0);
+    return slot;
+}
+
+
+/* number of nodes in the old hash array of 'ht' (0 if none) */
+#define oldnodes(ht) \
+        ((ht)->oldnode != NULL ? cast_uint(twoto((ht)->oldsize)) : 0u)
+
+
+/*
+** Auxliary function to 'csH_nextat'; 'hint' is the node index following
+** the previous key as returned by the last call (0 if unknown), it is
+** used as long as that node still holds the key, so that iterating
+** does not need to look up each key again. Traversals visit the nodes
+** left in the old hash array of 'ht' (its first 'nold' indices) before
+** the nodes of the current one.
+*/
+static uint getindex(cs_State *C, Table *ht, const TValue *k, uint hint,
+                     uint nold) {
     const TValue *slot;
     if (ttisnil(k)) return 0; /* first iteration */
+    if (nold < hint && hint <= nold + cast_uint(htsize(ht))) {
+        if (eqkey(k, htnode(ht, hint - nold - 1), 1)) /* cursor valid? */
+            return hint;
+    } else if (cast_uint(ht->oldpos) < hint && hint <= nold) {
+        if (eqkey(k, &ht->oldnode[hint - 1], 1)) /* cursor valid? */
+            return hint;
+    }
     slot = getgeneric(ht, k, 1);
-    if (c_unlikely(isabstkey(slot)))
-        csD_runerror(C, "invalid key passed to 'next'");
-    uint i = cast(Node *, slot) - htnode(ht, 0); /* key index in hash table */
-    return i + 1; /* return next slot index */
+    if (!isabstkey(slot)) { /* key in current hash array? */
+        uint i = cast(Node *, slot) - htnode(ht, 0);
+        return nold + i + 1; /* return next slot index */
+    }
+    if (nold > 0 && !isabstkey(slot = getold(ht, k, 1)))
+        return cast_uint(cast(Node *, slot) - ht->oldnode) + 1;
+    csD_runerror(C, "invalid key passed to 'next'");
 }
 
 
 /*
-** Find next table entry after 'key' entry.
+** Find next table entry after 'key' entry, starting the search at node
+** '*cursor' if that is where 'key' was found (see 'getindex').
 ** If table had next entry then top of the stack will contain
-** key of that entry and its value (in that order).
+** key of that entry and its value (in that order), and '*cursor' is
+** updated to the node following it.
 */
-int csH_next(cs_State *C, Table *ht, SPtr key) {
-    uint i = getindex(C, ht, s2v(key));
-    for (; cast_int(i) < htsize(ht); i++) {
-        Node *slot = htnode(ht, i);
-        if (!isempty(nodeval(slot))) {
-            getnodekey(C, s2v(key), slot);
-            setobj2s(C, key + 1, nodeval(slot));
-            return 1;
+int csH_nextat(cs_State *C, Table *ht, SPtr key, uint *cursor) {
+    uint nold = oldnodes(ht);
+    uint i = getindex(C, ht, s2v(key), *cursor, nold);
+    Node *slot;
+    if (i < nold) { /* still in the old hash array? */
+        if (i < cast_uint(ht->oldpos))
+            i = ht->oldpos; /* skip moved nodes */
+        for (; i < nold; i++) {
+            slot = &ht->oldnode[i];
+            if (!isempty(nodeval(slot)))
+                goto found;
         }
     }
+    for (; cast_int(i - nold) < htsize(ht); i++) {
+        slot = htnode(ht, i - nold);
+        if (!isempty(nodeval(slot)))
+            goto found;
+    }
     return 0;
+found:
+    getnodekey(C, s2v(key), slot);
+    setobj2s(C, key + 1, nodeval(slot));
+    *cursor = i + 1;
+    return 1;
 }
 
 
-/* insert all the 'keys' from src to dest */
-void csH_copykeys(cs_State *C, Table *dest, Table *src) {
+/* find next table entry after 'key' entry (without a cursor) */
+int csH_next(cs_State *C, Table *ht, SPtr key) {
+    uint cursor = 0;
+    return csH_nextat(C, ht, key, &cursor);
+}
+
+
+/*
+** Insert the 'n' key-value pairs starting at stack slot 'first' (key
+** below its value) into 'ht'; a table too small for 'n' keys is resized
+** once up front instead of rehashing while the keys are inserted.
+*/
+void csH_setpairs(cs_State *C, Table *ht, SPtr first, int n) {
+#if CSI_SWISSTABLE
+    if (n > ht->growthleft) /* table is too small for the new keys? */
+        csH_resize(C, ht, cast_uint(csH_len(ht) + n));
+#else
+    int len = csH_len(ht);
+    if (len + n > htsize(ht)) /* not enough free nodes for the new keys? */
+        csH_resize(C, ht, cast_uint(len + n));
+#endif
+    for (; n > 0; n--, first += 2) {
+        csH_set(C, ht, s2v(first), s2v(first + 1));
+        csG_barrierback(C, obj2gco(ht), s2v(first + 1));
+    }
+}
+
+
+/* insert the keys of 'src' starting at node 'i' into 'dest' */
+static void copynodes(cs_State *C, Table *dest, Table *src, int i) {
     TValue k;
-    for (int i = 0; i < htsize(src); i++) {
+    for (; i < htsize(src); i++) {
         Node *n = htnode(src, i);
         if (!isempty(nodeval(n))) {
             getnodekey(C, &k, n);
@@ -406,8 +833,23 @@ void csH_copykeys(cs_State *C, Table *dest, Table *src) {
 }
 
 
-const TValue *csH_getshortstr(Table *ht, OString *key) {
-    Node *n = hashstr(ht, key);
+/* insert all the 'keys' from src to dest */
+void csH_copykeys(cs_State *C, Table *dest, Table *src) {
+    if (src->oldnode != NULL) { /* 'src' is being rehashed? */
+        Table old;
+        oldview(src, &old);
+        copynodes(C, dest, &old, src->oldpos);
+    }
+    copynodes(C, dest, src, 0);
+}
+
+
+static const TValue *getshortstr(Table *ht, OString *key) {
+#if CSI_SWISSTABLE
+    uint h = hashstr(key);
+    swisslookup(ht, h, n, keyisshrstr(n) && eqshrstr(key, keystrval(n)));
+#else
+    Node *n = hashpow2(ht, hashstr(key));
     for (;;) {
         if (keyisshrstr(n) && eqshrstr(key, keystrval(n))) {
             return nodeval(n);
@@ -418,6 +860,18 @@ const TValue *csH_getshortstr(Table *ht, OString *key) {
             n += next;
         }
     }
+#endif
+}
+
+
+const TValue *csH_getshortstr(Table *ht, OString *key) {
+    const TValue *slot = getshortstr(ht, key);
+    if (c_unlikely(ht->oldnode != NULL) && isabstkey(slot)) {
+        TValue k;
+        setstrval(cast(cs_State *, NULL), &k, key);
+        slot = getold(ht, &k, 0);
+    }
+    return slot;
 }
 
 
@@ -427,13 +881,17 @@ const TValue *csH_getstr(Table *ht, OString *key) {
     } else {
         TValue k;
         setstrval(cast(cs_State *, NULL), &k, key);
-        return getgeneric(ht, &k, 0);
+        return getgenericall(ht, &k);
     }
 }
 
 
-const TValue *csH_getint(Table *ht, cs_Integer key) {
-    Node *n = hashint(ht, key);
+static const TValue *getint(Table *ht, cs_Integer key) {
+#if CSI_SWISSTABLE
+    uint h = hashint(key);
+    swisslookup(ht, h, n, keyisint(n) && keyival(n) == key);
+#else
+    Node *n = hashpow2(ht, hashint(key));
     for (;;) {
         if (keyisint(n) && keyival(n) == key) {
             return nodeval(n);
@@ -444,6 +902,18 @@ const TValue *csH_getint(Table *ht, cs_Integer key) {
             n += next;
         }
     }
+#endif
+}
+
+
+const TValue *csH_getint(Table *ht, cs_Integer key) {
+    const TValue *slot = getint(ht, key);
+    if (c_unlikely(ht->oldnode != NULL) && isabstkey(slot)) {
+        TValue k;
+        setival(&k, key);
+        slot = getold(ht, &k, 0);
+    }
+    return slot;
 }
 
 
@@ -459,7 +929,7 @@ const TValue *csH_get(Table *ht, const TValue *key) {
         } /* else fall through */
         default:  {
             cs_assert(!ttisnil(key));
-            return getgeneric(ht, key, 0);
+            return getgenericall(ht, key);
         }
     }
 }
@@ -490,5 +960,9 @@ int csH_len(const Table *ht) {
         len += !isempty(nodeval(n)); n++;
         len += !isempty(nodeval(n)); n++;
     }
+    if (ht->oldnode != NULL) { /* count nodes not moved yet */
+        for (int i = ht->oldpos; i < twoto(ht->oldsize); i++)
+            len += !isempty(nodeval(&ht->oldnode[i]));
+    }
     return len;
 }
@@ -29,12 +29,24 @@
 #define htsize(ht)	    (twoto((ht)->size))
 
 
+/* bits in table 'mode' (set by 'cs_set_mode') */
+#define WEAKKEYBIT	    0 /* keys do not keep their entries alive */
+#define WEAKVALBIT	    1 /* values do not keep their entries alive */
+
+#define isweakkey(ht)	    testbit((ht)->mode, WEAKKEYBIT)
+#define isweakval(ht)	    testbit((ht)->mode, WEAKVALBIT)
+
+
 
 CSI_FUNC Table *csH_newsz(cs_State *C, int size);
 CSI_FUNC Table *csH_new(cs_State *C);
 CSI_FUNC int csH_next(cs_State *C, Table *tab, SPtr key);
+CSI_FUNC int csH_nextat(cs_State *C, Table *tab, SPtr key, uint *cursor);
+CSI_FUNC void csH_setpairs(cs_State *C, Table *ht, SPtr first, int n);
 CSI_FUNC void csH_copykeys(cs_State *C, Table *stab, Table *dtab);
 CSI_FUNC void csH_resize(cs_State *C, Table *ht, uint newsize);
+CSI_FUNC void csH_reset(cs_State *C, Table *ht);
+CSI_FUNC void csH_finishrehash(cs_State *C, Table *ht);
 CSI_FUNC void csH_newkey(cs_State *C, Table *ht, const TValue *key,
                          const TValue *val);
 CSI_FUNC const TValue *csH_getshortstr(Table *ht, OString *key);
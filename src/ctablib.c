@@ -0,0 +1,390 @@
+/*
+** ctablib.c
+** Standard library for array manipulation
+** See Copyright Notice in cscript.h
+*/
+
+
+#define CS_LIB
+
+
+#include <limits.h>
+#include <string.h>
+
+#include "cscript.h"
+
+#include "cauxlib.h"
+#include "cslib.h"
+
+
+/*
+** Functions in this library operate on arrays, which are the sequence
+** type of CScript; all positions are 0-based.
+*/
+
+
+#define checkarray(C,arg)   csL_check_type(C, arg, CS_TARRAY)
+
+#define alen(C,arg)         ((cs_Integer)cs_len(C, arg))
+
+
+/*
+** insert(a, v)        -> append 'v'
+** insert(a, pos, v)   -> insert 'v' at 'pos' in [0, #a]
+*/
+static int t_insert(cs_State *C) {
+    cs_Integer pos;
+    cs_Integer e;
+    checkarray(C, 0);
+    e = alen(C, 0); /* first empty position */
+    switch (cs_gettop(C)) {
+        case 1: { /* called with only 2 arguments */
+            pos = e; /* insert new element at the end */
+            break;
+        }
+        case 2: {
+            pos = csL_check_integer(C, 1);
+            /* check whether 'pos' is in [0, e] */
+            csL_check_arg(C, (cs_Unsigned)pos <= (cs_Unsigned)e, 1,
+                             "position out of bounds");
+            break;
+        }
+        default: {
+            return csL_error(C, "wrong number of arguments to 'insert'");
+        }
+    }
+    cs_insert_index(C, 0, pos); /* shift up and set new element */
+    return 0;
+}
+
+
+/*
+** remove(a)       -> remove last element
+** remove(a, pos)  -> remove element at 'pos' in [0, #a - 1]
+*/
+static int t_remove(cs_State *C) {
+    cs_Integer size, pos;
+    checkarray(C, 0);
+    size = alen(C, 0);
+    pos = csL_opt_integer(C, 1, size - 1);
+    if (size == 0 && cs_is_noneornil(C, 1))
+        return 0; /* nothing to remove */
+    csL_check_arg(C, (cs_Unsigned)pos < (cs_Unsigned)size, 1,
+                     "position out of bounds");
+    cs_remove_index(C, 0, pos);
+    return 1;
+}
+
+
+/*
+** move(a1, f, e, t [, a2]) moves elements a1[f..e] into a2[t..]
+** (a2 defaults to a1) and returns the destination array.
+*/
+static int t_move(cs_State *C) {
+    cs_Integer f = csL_check_integer(C, 1);
+    cs_Integer e = csL_check_integer(C, 2);
+    cs_Integer t = csL_check_integer(C, 3);
+    int tt = !cs_is_noneornil(C, 4) ? 4 : 0; /* destination array */
+    checkarray(C, 0);
+    checkarray(C, tt);
+    if (e >= f) { /* otherwise, nothing to move */
+        cs_Integer n, i;
+        csL_check_arg(C, f >= 0, 1, "initial position must be non-negative");
+        csL_check_arg(C, t >= 0, 3, "destination position must be "
+                                    "non-negative");
+        csL_check_arg(C, e - f < CS_INTEGER_MAX - t, 3,
+                         "destination wrap around");
+        n = e - f + 1; /* number of elements to move */
+        if (t > e || t <= f || (tt != 0 && !cs_rawequal(C, 0, tt))) {
+            for (i = 0; i < n; i++) {
+                cs_get_index(C, 0, f + i);
+                cs_set_index(C, tt, t + i);
+            }
+        } else { /* overlapping and moving up, copy backwards */
+            for (i = n - 1; i >= 0; i--) {
+                cs_get_index(C, 0, f + i);
+                cs_set_index(C, tt, t + i);
+            }
+        }
+    }
+    cs_push(C, tt); /* return destination array */
+    return 1;
+}
+
+
+
+/* {======================================================================
+** Concat
+** ======================================================================= */
+
+static const char *getelem(cs_State *C, cs_Integer i, size_t *l) {
+    const char *s;
+    cs_get_index(C, 0, i);
+    if (cs_is_string(C, -1) || cs_is_number(C, -1))
+        s = csL_to_lstring(C, -1, l); /* (numbers get converted) */
+    else
+        return (csL_error(C, "invalid value (at index %I) in array for "
+                             "'concat'", i), NULL);
+    cs_remove(C, -2); /* remove original element */
+    return s;
+}
+
+
+/*
+** concat(a [, sep [, i [, j]]]) -> a[i]..sep..a[i+1]..sep.. ..a[j]
+** Lengths are computed in a first pass, so the result buffer is
+** allocated only once.
+*/
+static int t_concat(cs_State *C) {
+    size_t lsep, total = 0;
+    cs_Integer i, last;
+    const char *sep;
+    checkarray(C, 0);
+    sep = csL_opt_lstring(C, 1, "", &lsep);
+    i = csL_opt_integer(C, 2, 0);
+    last = csL_opt_integer(C, 3, alen(C, 0) - 1);
+    if (i > last) {
+        cs_push_literal(C, "");
+        return 1;
+    }
+    csL_check_arg(C, i >= 0, 2, "initial position must be non-negative");
+    for (cs_Integer k = i; k <= last; k++) { /* compute total length */
+        size_t l;
+        getelem(C, k, &l);
+        cs_pop(C, 1);
+        total += l;
+    }
+    total += (size_t)(last - i) * lsep; /* separators */
+    {
+        csL_Buffer B;
+        char *p = csL_buff_initsz(C, &B, total);
+        for (; i <= last; i++) {
+            size_t l;
+            const char *s = getelem(C, i, &l);
+            memcpy(p, s, l * sizeof(char)); p += l;
+            cs_pop(C, 1);
+            if (i != last && lsep > 0) {
+                memcpy(p, sep, lsep * sizeof(char));
+                p += lsep;
+            }
+        }
+        csL_buffadd(&B, total);
+        csL_buff_end(&B);
+    }
+    return 1;
+}
+
+/* }====================================================================== */
+
+
+/* unpack(a [, i [, j]]) -> a[i], a[i+1], ..., a[j] */
+static int t_unpack(cs_State *C) {
+    cs_Unsigned n;
+    cs_Integer i, e;
+    checkarray(C, 0);
+    i = csL_opt_integer(C, 1, 0);
+    e = csL_opt(C, csL_check_integer, 2, alen(C, 0) - 1);
+    if (i > e) return 0; /* empty range */
+    csL_check_arg(C, i >= 0, 1, "initial position must be non-negative");
+    n = (cs_Unsigned)e - i; /* number of elements minus 1 */
+    if (c_unlikely(n >= (unsigned int)INT_MAX ||
+                   !cs_checkstack(C, (int)(++n))))
+        return csL_error(C, "too many results to unpack");
+    for (; i < e; i++) /* push arg[i..e - 1] (to avoid overflows) */
+        cs_get_index(C, 0, i);
+    cs_get_index(C, 0, e); /* push last element */
+    return (int)n;
+}
+
+
+
+/* {======================================================================
+** Sort
+** Introsort: quicksort with median-of-three pivot that falls back to
+** heapsort after too many unbalanced partitions, and insertion sort for
+** small subarrays. Arrays of only numbers or only strings sorted with
+** the default order take the 'cs_sortarray' fast path, which sorts the
+** raw values in place; this generic version works through the API so
+** that the order function (and '__lt') can safely run arbitrary code.
+** ======================================================================= */
+
+/* subarrays smaller than this are sorted with insertion sort */
+#define SORTTHRESHOLD       16
+
+
+/* type for array indices */
+typedef unsigned int IdxT;
+
+
+#define geti(C,i)       cs_get_index(C, 0, i)
+#define seti(C,i)       cs_set_index(C, 0, i)
+
+
+/* swap a[i] and a[j] */
+static void swapidx(cs_State *C, IdxT i, IdxT j) {
+    geti(C, i);
+    geti(C, j);
+    seti(C, i);
+    seti(C, j);
+}
+
+
+/*
+** Return true iff value at stack index 'a' is less than the value at
+** index 'b' (according to the order of the sort).
+*/
+static int sort_comp(cs_State *C, int a, int b) {
+    if (cs_is_nil(C, 1)) /* no function? */
+        return cs_compare(C, a, b, CS_OPLT); /* a < b */
+    else { /* function */
+        int res;
+        cs_push(C, 1); /* push function */
+        cs_push(C, a - 1); /* -1 to compensate function */
+        cs_push(C, b - 2); /* -2 to compensate function and 'a' */
+        cs_call(C, 2, 1); /* call function */
+        res = cs_to_bool(C, -1); /* get result */
+        cs_pop(C, 1); /* pop result */
+        return res;
+    }
+}
+
+
+/* compare a[i] < a[j] */
+static int lessidx(cs_State *C, IdxT i, IdxT j) {
+    int res;
+    geti(C, i);
+    geti(C, j);
+    res = sort_comp(C, -2, -1);
+    cs_pop(C, 2);
+    return res;
+}
+
+
+static void insertionsort(cs_State *C, IdxT lo, IdxT up) {
+    for (IdxT i = lo + 1; i <= up; i++) {
+        for (IdxT j = i; j > lo && lessidx(C, j, j - 1); j--)
+            swapidx(C, j, j - 1);
+    }
+}
+
+
+/* sift down element at 'i' in the heap 'a[lo..up]' */
+static void siftdown(cs_State *C, IdxT lo, IdxT i, IdxT up) {
+    for (;;) {
+        IdxT child = lo + 2*(i - lo) + 1;
+        if (child > up) break;
+        if (child < up && lessidx(C, child, child + 1))
+            child++; /* larger child */
+        if (!lessidx(C, i, child)) break;
+        swapidx(C, i, child);
+        i = child;
+    }
+}
+
+
+static void heapsort(cs_State *C, IdxT lo, IdxT up) {
+    for (IdxT i = lo + (up - lo - 1)/2 + 1; i-- > lo; )
+        siftdown(C, lo, i, up);
+    for (IdxT i = up; i > lo; i--) {
+        swapidx(C, lo, i);
+        siftdown(C, lo, lo, i - 1);
+    }
+}
+
+
+/*
+** Partition around the median of 'a[lo]', 'a[mid]' and 'a[up]', kept
+** on the stack during the scans. Scans are bounded, so an inconsistent
+** order function cannot make them run out of the subarray.
+*/
+static IdxT partition(cs_State *C, IdxT lo, IdxT up) {
+    IdxT mid = lo + (up - lo)/2;
+    IdxT i = lo, j = up - 1;
+    if (lessidx(C, mid, lo)) swapidx(C, mid, lo);
+    if (lessidx(C, up, mid)) {
+        swapidx(C, up, mid);
+        if (lessidx(C, mid, lo)) swapidx(C, mid, lo);
+    }
+    swapidx(C, mid, up - 1); /* pivot in 'a[up - 1]' */
+    geti(C, up - 1); /* push pivot */
+    for (;;) {
+        int lt;
+        while (i < up - 1) { /* repeat ++i while a[i] < P */
+            geti(C, ++i);
+            lt = sort_comp(C, -1, -2);
+            cs_pop(C, 1);
+            if (!lt) break;
+        }
+        while (j > lo) { /* repeat --j while P < a[j] */
+            geti(C, --j);
+            lt = sort_comp(C, -2, -1);
+            cs_pop(C, 1);
+            if (!lt) break;
+        }
+        if (j <= i) break; /* scans crossed? */
+        swapidx(C, i, j);
+    }
+    cs_pop(C, 1); /* pop pivot */
+    swapidx(C, i, up - 1); /* put pivot in its final position */
+    return i;
+}
+
+
+static void introsort(cs_State *C, IdxT lo, IdxT up, int depth) {
+    while (up - lo >= SORTTHRESHOLD) {
+        IdxT p;
+        if (depth-- == 0) { /* too many bad partitions? */
+            heapsort(C, lo, up);
+            return;
+        }
+        p = partition(C, lo, up);
+        if (p - lo < up - p) { /* recurse into smaller half */
+            introsort(C, lo, p - 1, depth);
+            lo = p + 1;
+        } else {
+            introsort(C, p + 1, up, depth);
+            up = p - 1;
+        }
+    }
+    if (lo < up)
+        insertionsort(C, lo, up);
+}
+
+
+static int t_sort(cs_State *C) {
+    cs_Integer n;
+    checkarray(C, 0);
+    n = alen(C, 0);
+    if (n > 1) { /* non-trivial interval? */
+        int depth = 0;
+        csL_check_arg(C, n < INT_MAX, 0, "array too big");
+        if (!cs_is_noneornil(C, 1)) /* is there a 2nd argument? */
+            csL_check_type(C, 1, CS_TFUNCTION); /* must be a function */
+        else if (cs_sortarray(C, 0))
+            return 0; /* sorted by the fast path */
+        cs_setntop(C, 2); /* order function (or nil) at index 1 */
+        for (cs_Integer m = n; m > 1; m >>= 1)
+            depth += 2; /* 2*log2(n) */
+        introsort(C, 0, (IdxT)n - 1, depth);
+    }
+    return 0;
+}
+
+/* }====================================================================== */
+
+
+static const cs_Entry tablib[] = {
+    {"concat", t_concat},
+    {"insert", t_insert},
+    {"move", t_move},
+    {"remove", t_remove},
+    {"sort", t_sort},
+    {"unpack", t_unpack},
+    {NULL, NULL}
+};
+
+
+CSMOD_API int csopen_table(cs_State *C) {
+    csL_newlib(C, tablib);
+    return 1;
+}
@@ -323,6 +323,17 @@ static void unasmNewObject(const Proto *p, Instruction *pc) {
 }
 
 
+static void unasmNewTable(const Proto *p, Instruction *pc) {
+    int site = GETARG_S(pc, 1);
+    startline(p, pc);
+    traceOp(*pc);
+    traceSize(GETARG_S(pc, 0));
+    if (site > 0) /* temporary table? */
+        postab(printf("tmp=%d", site - 1));
+    endline();
+}
+
+
 static void unasmEQK(const Proto *p, Instruction *pc) {
     TValue aux;
     startline(p, pc);
@@ -432,7 +443,10 @@ static void unasmIndexedSet(const Proto *p, Instruction *pc) {
     startline(p, pc);
     traceOp(*pc);
     traceStackSlot(GETARG_L(pc, 0));
-    traceK(p, GETARG_L(pc, 1));
+    if (*pc == OP_SETINDEXINT) { /* integer index is immediate */
+        postab(printf("%d", GETARG_L(pc, 1)));
+    } else
+        traceK(p, GETARG_L(pc, 1));
     endline();
 }
 
@@ -510,6 +524,14 @@ static void unasmPop(const Proto *p, Instruction *pc) {
 }
 
 
+static void unasmSetFields(const Proto *p, Instruction *pc) {
+    startline(p, pc);
+    traceOp(*pc);
+    postab(printf("npairs=%d", GETARG_S(pc, 0)));
+    endline();
+}
+
+
 static void unasmJmp(const Proto *p, Instruction *pc) {
     startline(p, pc);
     traceOp(*pc);
@@ -527,6 +549,20 @@ static void unasmBreakJmp(const Proto *p, Instruction *pc) {
 }
 
 
+static void unasmSwitch(const Proto *p, Instruction *pc) {
+    const SwitchTable *st = &p->swtabs[GETARG_L(pc, 0)];
+    startline(p, pc);
+    traceOp(*pc);
+    postab(printf("SW@%d", GETARG_L(pc, 0)));
+    if (st->t == NULL)
+        postab(printf("range=[%lld,%lld]", cast(long long, st->lo),
+                      cast(long long, st->lo) + st->sizejmps - 1));
+    postab(printf("default=%d", st->dflt));
+    fflush(stdout);
+    endline();
+}
+
+
 static void unasmRet(const Proto *p, Instruction *pc) {
     startline(p, pc);
     traceOp(*pc);
@@ -558,6 +594,7 @@ void csTR_disassemble(cs_State *C, const Proto *p) {
             case OP_MOD: case OP_POW: case OP_BSHL: case OP_BSHR:
             case OP_BAND: case OP_BOR: case OP_BXOR:case OP_LT:
             case OP_LE: case OP_NOT: case OP_UNM: case OP_BNOT:
+            case OP_FLOOR: case OP_ABS:
             case OP_EQPRESERVE: case OP_GETINDEX: case OP_GETSUPIDX:
             case OP_INHERIT: {
                 unasm(p, pc);
@@ -592,10 +629,14 @@ void csTR_disassemble(cs_State *C, const Proto *p) {
                 unasmIMMint(p, pc);
                 break;
             }
-            case OP_NEWCLASS: case OP_NEWARRAY: case OP_NEWTABLE: {
+            case OP_NEWCLASS: case OP_NEWARRAY: {
                 unasmNewObject(p, pc);
                 break;
             }
+            case OP_NEWTABLE: {
+                unasmNewTable(p, pc);
+                break;
+            }
             case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI: {
                 unasmIMMord(p, pc);
                 break;
@@ -638,6 +679,8 @@ void csTR_disassemble(cs_State *C, const Proto *p) {
             case OP_CONSTI: unasmIMMint(p, pc); break;
             case OP_CONSTF: unasmIMMflt(p, pc); break;
             case OP_BJMP: unasmBreakJmp(p, pc); break;
+            case OP_SWITCH: unasmSwitch(p, pc); break;
+            case OP_SETFIELDS: unasmSetFields(p, pc); break;
             case OP_EQK: unasmEQK(p, pc); break;
             case OP_EQI: unasmEQI(p, pc); break;
             case OP_EQ: unasmS(p, pc); break;
@@ -0,0 +1,367 @@
+/*
+** cundump.c
+** Load precompiled CScript chunks
+** See Copyright Notice in cscript.h
+*/
+
+
+#define CS_CORE
+
+
+#include <limits.h>
+#include <string.h>
+
+#include "cdebug.h"
+#include "cfunction.h"
+#include "cgc.h"
+#include "cmem.h"
+#include "cobject.h"
+#include "cprotected.h"
+#include "cstate.h"
+#include "cstring.h"
+#include "ctable.h"
+#include "cundump.h"
+
+
+typedef struct LoadState {
+    cs_State *C;
+    BuffReader *br;
+    const char *name;
+} LoadState;
+
+
+static c_noret error(LoadState *S, const char *why) {
+    csS_pushfstring(S->C, "%s: bad binary format (%s)", S->name, why);
+    csPR_throw(S->C, CS_ERRSYNTAX);
+}
+
+
+/*
+** All high-level loads go through 'loadvector'; you can change it to
+** adapt to the endianness of the input.
+*/
+#define loadvector(S,b,n)	loadblock(S,b,(n)*sizeof((b)[0]))
+
+static void loadblock(LoadState *S, void *b, size_t size) {
+    if (csR_read(S->br, b, size) != 0)
+        error(S, "truncated chunk");
+}
+
+
+#define loadvar(S,x)		loadvector(S,&x,1)
+
+
+static c_byte loadbyte(LoadState *S) {
+    int b = brgetc(S->br);
+    if (b == CSEOF)
+        error(S, "truncated chunk");
+    return cast_byte(b);
+}
+
+
+static size_t loadunsigned(LoadState *S, size_t limit) {
+    size_t x = 0;
+    int b;
+    limit >>= 7;
+    do {
+        b = loadbyte(S);
+        if (x >= limit)
+            error(S, "integer overflow");
+        x = (x << 7) | (b & 0x7f);
+    } while ((b & 0x80) == 0);
+    return x;
+}
+
+
+static size_t loadsize(LoadState *S) {
+    return loadunsigned(S, ~(size_t)0);
+}
+
+
+static int loadint(LoadState *S) {
+    return cast_int(loadunsigned(S, INT_MAX));
+}
+
+
+static cs_Number loadnumber(LoadState *S) {
+    cs_Number x;
+    loadvar(S, x);
+    return x;
+}
+
+
+static cs_Integer loadinteger(LoadState *S) {
+    cs_Integer x;
+    loadvar(S, x);
+    return x;
+}
+
+
+/*
+** Load a nullable string into prototype 'p'.
+*/
+static OString *loadstringN(LoadState *S, Proto *p) {
+    cs_State *C = S->C;
+    OString *ts;
+    size_t size = loadsize(S);
+    if (size == 0) /* no string? */
+        return NULL;
+    else if (--size <= CSI_MAXSHORTLEN) { /* short string? */
+        char buff[CSI_MAXSHORTLEN];
+        loadvector(S, buff, size); /* load string into buffer */
+        ts = csS_newl(C, buff, size); /* create string */
+    } else { /* long string */
+        ts = csS_newlngstrobj(C, size); /* create string */
+        setstrval2s(C, C->sp.p, ts); /* anchor it ('loadvector' can GC) */
+        csT_incsp(C);
+        loadvector(S, getstr(ts), size); /* load directly in final place */
+        C->sp.p--; /* pop string */
+    }
+    csG_objbarrier(C, p, ts);
+    return ts;
+}
+
+
+static void loadfunction(LoadState *S, Proto *p, OString *psource);
+
+
+static void loadcode(LoadState *S, Proto *p) {
+    int n = loadint(S);
+    p->code = csM_newarray(S->C, n, Instruction);
+    p->sizecode = n;
+    loadvector(S, p->code, n);
+}
+
+
+static void loadvalue(LoadState *S, Proto *p, TValue *o) {
+    int t = loadbyte(S);
+    switch (t) {
+        case CS_VNIL: setnilval(o); break;
+        case CS_VFALSE: setbfval(o); break;
+        case CS_VTRUE: setbtval(o); break;
+        case CS_VNUMFLT: setfval(o, loadnumber(S)); break;
+        case CS_VNUMINT: setival(o, loadinteger(S)); break;
+        case CS_VSHRSTR: case CS_VLNGSTR: {
+            OString *ts = loadstringN(S, p);
+            if (ts == NULL)
+                error(S, "bad format for constant string");
+            setstrval(S->C, o, ts);
+            break;
+        }
+        default: error(S, "bad constant type");
+    }
+}
+
+
+static void loadconstants(LoadState *S, Proto *p) {
+    int n = loadint(S);
+    p->k = csM_newarray(S->C, n, TValue);
+    p->sizek = n;
+    for (int i = 0; i < n; i++)
+        setnilval(&p->k[i]);
+    for (int i = 0; i < n; i++)
+        loadvalue(S, p, &p->k[i]);
+}
+
+
+/* load labels of a jump table into its (anchored) table 't' */
+static void loadlabels(LoadState *S, Proto *p, Table *t) {
+    cs_State *C = S->C;
+    int n = loadint(S);
+    for (int i = 0; i < n; i++) {
+        TValue target;
+        loadvalue(S, p, s2v(C->sp.p)); /* label */
+        if (ttisnil(s2v(C->sp.p)))
+            error(S, "bad switch label");
+        csT_incsp(C); /* anchor it ('csH_set' can GC) */
+        setival(&target, loadint(S));
+        csH_set(C, t, s2v(C->sp.p - 1), &target);
+        C->sp.p--; /* pop label */
+    }
+}
+
+
+static void loadswitches(LoadState *S, Proto *p) {
+    int n = loadint(S);
+    p->swtabs = csM_newarray(S->C, n, SwitchTable);
+    p->sizeswtabs = n;
+    for (int i = 0; i < n; i++) { /* make array valid for GC */
+        p->swtabs[i].t = NULL;
+        p->swtabs[i].jmps = NULL;
+        p->swtabs[i].sizejmps = 0;
+    }
+    for (int i = 0; i < n; i++) {
+        SwitchTable *st = &p->swtabs[i];
+        st->dflt = loadint(S);
+        if (loadbyte(S)) { /* hash labels? */
+            st->lo = 0;
+            st->t = csH_new(S->C);
+            csG_objbarrier(S->C, p, st->t);
+            loadlabels(S, p, st->t);
+        } else { /* dense integer labels */
+            int size;
+            st->lo = loadinteger(S);
+            size = loadint(S);
+            st->jmps = csM_newarray(S->C, size, int);
+            st->sizejmps = size;
+            for (int j = 0; j < size; j++)
+                st->jmps[j] = loadint(S);
+        }
+    }
+}
+
+
+static void loadtmptabs(LoadState *S, Proto *p) {
+    int n = loadint(S);
+    p->tmptabs = csM_newarray(S->C, n, Table *);
+    p->sizetmptabs = n;
+    for (int i = 0; i < n; i++)
+        p->tmptabs[i] = NULL;
+}
+
+
+static void loadprotos(LoadState *S, Proto *p) {
+    int n = loadint(S);
+    p->p = csM_newarray(S->C, n, Proto *);
+    p->sizep = n;
+    for (int i = 0; i < n; i++)
+        p->p[i] = NULL;
+    for (int i = 0; i < n; i++) {
+        p->p[i] = csF_newproto(S->C);
+        csG_objbarrier(S->C, p, p->p[i]);
+        loadfunction(S, p->p[i], p->source);
+    }
+}
+
+
+/*
+** Load the upvalues for a function. The names must be filled first,
+** because the filling of the other fields can raise read errors and
+** the creation of the error message can call an emergency collection;
+** in that case all prototypes must be consistent for the GC.
+*/
+static void loadupvalues(LoadState *S, Proto *p) {
+    int n = loadint(S);
+    p->upvals = csM_newarray(S->C, n, UpValInfo);
+    p->sizeupvals = n;
+    for (int i = 0; i < n; i++) /* make array valid for GC */
+        p->upvals[i].name = NULL;
+    for (int i = 0; i < n; i++) { /* following calls can raise errors */
+        p->upvals[i].onstack = loadbyte(S);
+        p->upvals[i].idx = loadint(S);
+        p->upvals[i].kind = loadbyte(S);
+    }
+}
+
+
+static void loaddebug(LoadState *S, Proto *p) {
+    int n = loadint(S);
+    p->lineinfo = csM_newarray(S->C, n, c_sbyte);
+    p->sizelineinfo = n;
+    loadvector(S, p->lineinfo, n);
+    n = loadint(S);
+    p->abslineinfo = csM_newarray(S->C, n, AbsLineInfo);
+    p->sizeabslineinfo = n;
+    for (int i = 0; i < n; i++) {
+        p->abslineinfo[i].pc = loadint(S);
+        p->abslineinfo[i].idx = loadint(S);
+        p->abslineinfo[i].line = loadint(S);
+    }
+    n = loadint(S);
+    p->locals = csM_newarray(S->C, n, LVarInfo);
+    p->sizelocals = n;
+    for (int i = 0; i < n; i++)
+        p->locals[i].name = NULL;
+    for (int i = 0; i < n; i++) {
+        p->locals[i].name = loadstringN(S, p);
+        p->locals[i].startpc = loadint(S);
+        p->locals[i].endpc = loadint(S);
+    }
+    n = loadint(S);
+    if (n != 0) /* does it have debug information? */
+        n = p->sizeupvals; /* must be this many */
+    for (int i = 0; i < n; i++)
+        p->upvals[i].name = loadstringN(S, p);
+}
+
+
+static void loadfunction(LoadState *S, Proto *p, OString *psource) {
+    p->source = loadstringN(S, p);
+    if (p->source == NULL) /* no source in dump? */
+        p->source = psource; /* reuse parent's source */
+    p->defline = loadint(S);
+    p->deflastline = loadint(S);
+    p->arity = loadint(S);
+    p->isvararg = loadbyte(S);
+    p->maxstack = loadint(S);
+    loadcode(S, p);
+    loadconstants(S, p);
+    loadswitches(S, p);
+    loadtmptabs(S, p);
+    loadupvalues(S, p);
+    loadprotos(S, p);
+    p->lazysrc = loadstringN(S, p);
+    p->lazyline = loadint(S);
+    loaddebug(S, p);
+}
+
+
+static void checkliteral(LoadState *S, const char *s, const char *msg) {
+    char buff[sizeof(CS_SIGNATURE) + sizeof(CSC_DATA)]; /* larger than both */
+    size_t len = strlen(s);
+    loadvector(S, buff, len);
+    if (memcmp(s, buff, len) != 0)
+        error(S, msg);
+}
+
+
+static void fchecksize(LoadState *S, size_t size, const char *tname) {
+    if (loadbyte(S) != size)
+        error(S, csS_pushfstring(S->C, "%s size mismatch", tname));
+}
+
+
+#define checksize(S,t)	fchecksize(S,sizeof(t),#t)
+
+static void checkheader(LoadState *S) {
+    /* skip 1st char (already read and checked) */
+    checkliteral(S, &CS_SIGNATURE[1], "not a binary chunk");
+    if (loadbyte(S) != CSC_VERSION)
+        error(S, "version mismatch");
+    if (loadbyte(S) != CSC_FORMAT)
+        error(S, "format mismatch");
+    checkliteral(S, CSC_DATA, "corrupted chunk");
+    checksize(S, Instruction);
+    checksize(S, cs_Integer);
+    checksize(S, cs_Number);
+    if (loadinteger(S) != CSC_INT)
+        error(S, "integer format mismatch");
+    if (loadnumber(S) != CSC_NUM)
+        error(S, "float format mismatch");
+}
+
+
+/*
+** Load precompiled chunk (its first char was already read).
+*/
+CSClosure *csU_undump(cs_State *C, BuffReader *br, const char *name) {
+    LoadState S;
+    CSClosure *cl;
+    if (*name == '@' || *name == '=')
+        S.name = name + 1;
+    else if (*name == CS_SIGNATURE[0])
+        S.name = "binary string";
+    else
+        S.name = name;
+    S.C = C;
+    S.br = br;
+    checkheader(&S);
+    cl = csF_newCSClosure(C, loadbyte(&S));
+    setclCSval2s(C, C->sp.p, cl); /* anchor main function closure */
+    csT_incsp(C);
+    cl->p = csF_newproto(C);
+    csG_objbarrier(C, cl, cl->p);
+    loadfunction(&S, cl->p, NULL);
+    cs_assert(cl->nupvalues == cl->p->sizeupvals);
+    return cl;
+}
@@ -0,0 +1,39 @@
+/*
+** cundump.h
+** Load and save precompiled CScript chunks
+** See Copyright Notice in cscript.h
+*/
+
+#ifndef CUNDUMP_H
+#define CUNDUMP_H
+
+
+#include "cobject.h"
+#include "creader.h"
+
+
+/* data to catch conversion errors */
+#define CSC_DATA	"\x19\x93\r\n\x1a\n"
+
+#define CSC_INT		0x5678
+#define CSC_NUM		cast_num(370.5)
+
+/* binary format version */
+#define CSC_VERSION     (CS_VERSION_NUMBER / 100 * 16 + CS_VERSION_NUMBER % 100)
+
+/*
+** Binary format revision; bumped whenever opcodes are renumbered or the
+** layout of dumped functions changes (1: switch jump tables; 2:
+** temporary constructor tables; 3: OP_SETFIELDS).
+*/
+#define CSC_FORMAT      3
+
+
+/* load one chunk; from 'csU_undump' */
+CSI_FUNC CSClosure *csU_undump(cs_State *C, BuffReader *br, const char *name);
+
+/* dump one chunk; from 'cdump.c' */
+CSI_FUNC int csU_dump(cs_State *C, const Proto *p, cs_Writer w, void *data,
+                      int strip);
+
+#endif
@@ -27,6 +27,7 @@
 #include "cmeta.h"
 #include "cstring.h"
 #include "ctrace.h"
+#include "cprotected.h"
 
 
 /*
@@ -53,12 +54,39 @@ static int booleans[2] = { CS_VFALSE, CS_VTRUE };
 
 
 /*
-** Allocate new CSript closure, push it on stack and
-** initialize its upvalues.
+** Check whether cached closure of 'p' can be reused, that is, if
+** all of its upvalues are the ones a new closure would capture.
+** (A closed upvalue never points into the stack.)
+*/
+static CSClosure *getcached(Proto *p, UpVal **enc, SPtr base) {
+    CSClosure *cl = p->cache;
+    if (cl != NULL) { /* is there a cached closure? */
+        int nupvals = p->sizeupvals;
+        for (int i = 0; i < nupvals; i++) {
+            UpValInfo *uv = &p->upvals[i];
+            TValue *v = (uv->onstack) ? s2v(base + uv->idx)
+                                      : enc[uv->idx]->v.p;
+            if (cl->upvals[i]->v.p != v)
+                return NULL; /* wrong upvalue; cannot reuse closure */
+        }
+    }
+    return cl; /* return cached closure (or NULL if no cached closure) */
+}
+
+
+/*
+** Push CScript closure of 'p', reusing the cached one when possible;
+** otherwise allocate new closure, initialize its upvalues and cache it.
 */
 static void pushclosure(cs_State *C, Proto *p, UpVal **enc, SPtr base) {
     int nupvals = p->sizeupvals;
-    CSClosure *cl = csF_newCSClosure(C, nupvals);
+    CSClosure *cl = getcached(p, enc, base);
+    if (cl != NULL) { /* can reuse cached closure? */
+        setclCSval2s(C, C->sp.p, cl);
+        C->sp.p += 1;
+        return;
+    }
+    cl = csF_newCSClosure(C, nupvals);
     cl->p = p;
     setclCSval2s(C, C->sp.p, cl); /* anchor to stack */
     C->sp.p += 1;
@@ -70,6 +98,40 @@ static void pushclosure(cs_State *C, Proto *p, UpVal **enc, SPtr base) {
             cl->upvals[i] = enc[uv->idx];
         csG_objbarrier(C, cl, cl->upvals[i]);
     }
+    if (!isblack(p)) /* cache will not break GC invariant? */
+        p->cache = cl; /* save it on cache for reuse */
+}
+
+
+/*
+** Get the table of temporary site 'site' of frame 'cf' (a constructor
+** whose table never escapes the frame, see 'tmptablesite' in the
+** parser). The table made by the previous execution of the site in
+** this frame is dead by now, so it is cleared and reused; otherwise
+** take the table left in the cache of 'p' by a finished frame, or
+** create a new one.
+*/
+static Table *tmptable(cs_State *C, CallFrame *cf, Proto *p, int site) {
+    Table *t = cf->tmptabs[site];
+    if (t == NULL) { /* first execution of the site in this frame? */
+        t = p->tmptabs[site];
+        if (t == NULL) /* no free table? */
+            return (cf->tmptabs[site] = csH_new(C));
+        p->tmptabs[site] = NULL;
+        cf->tmptabs[site] = t;
+    }
+    csH_reset(C, t);
+    return t;
+}
+
+
+/* return temporary tables of finished frame 'cf' to the cache of 'p' */
+static void releasetmptabs(Proto *p, CallFrame *cf) {
+    if (!isblack(p)) { /* cache will not break GC invariant? */
+        for (int i = 0; i < p->sizetmptabs; i++)
+            if (cf->tmptabs[i] != NULL)
+                p->tmptabs[i] = cf->tmptabs[i];
+    }
 }
 
 
@@ -200,7 +262,7 @@ c_sinline int numlt(const TValue *v1, const TValue *v2) {
     cs_assert(ttisnum(v1) && ttisnum(v2));
     if (ttisint(v1)) {
         cs_Integer i1 = ival(v1);
-        if (ttisint(v2)) return (i1 <= ival(v2));
+        if (ttisint(v2)) return (i1 < ival(v2));
         else return intltnum(v1, v2);
     } else {
         cs_Number n1 = fval(v1);
@@ -553,6 +615,8 @@ retry:
             checkstackGCp(C, fsize, func);
             C->cf = cf = initcallframe(C, func, nres, 0, func + fsize + 1);
             cf->pc = p->code; /* set starting point */
+            for (int i = 0; i < p->sizetmptabs; i++)
+                cf->tmptabs[i] = NULL; /* no temporary tables yet */
             for (; nargs < nparams; nargs++) {
                 setnilval(s2v(C->sp.p)); /* set missing args as 'nil' */
                 C->sp.p += 1;
@@ -618,6 +682,32 @@ void csV_call(cs_State *C, SPtr func, int nresults) {
 }
 
 
+/*
+** Generic 'next' iterator (light C function). It is provided by the
+** core so that 'OP_FORCALL' can recognize it and iterate tables and
+** instances without calling it (see 'fornext').
+*/
+int csV_next(cs_State *C) {
+    SPtr func = C->cf->func.p;
+    const TValue *o = s2v(func + 1);
+    Table *ht;
+    if (C->sp.p - func < 2 || !(ttishtab(o) || ttisinstance(o)))
+        csD_runerror(C, "bad argument #0 to 'next' "
+                        "(instance or table expected)");
+    if (C->sp.p - func < 3) /* missing key? */
+        setnilval(s2v(func + 2));
+    C->sp.p = func + 3; /* key is on top (ignore extra arguments) */
+    ht = ttishtab(o) ? tval(o) : insval(o)->fields;
+    if (csH_next(C, ht, func + 2)) { /* found field? */
+        C->sp.p = func + 4;
+        return 2; /* key (index) + value */
+    } else {
+        setnilval(s2v(func + 2));
+        return 1;
+    }
+}
+
+
 #define isemptystr(v)   (ttisshrstring(v) && strval(v)->shrlen == 0)
 
 
@@ -875,6 +965,41 @@ void csV_concat(cs_State *C, int total) {
     setorderres(v, cond, 1); }
 
 
+/* generic loop over table or instance 'stk + FORINVSTATE' using 'next' */
+#define isfornext(stk) \
+        (ttislcf(s2v(stk)) && lcfval(s2v(stk)) == csV_next && \
+         (ttishtab(s2v((stk) + FORINVSTATE)) || \
+          ttisinstance(s2v((stk) + FORINVSTATE))) && \
+         (ttisnil(s2v((stk) + FORTBCVAR)) || ttisint(s2v((stk) + FORTBCVAR))))
+
+
+/*
+** Do one step of a generic loop iterating with 'next' without calling
+** it. The node cursor (see 'csH_nextat') is kept in the to-be-closed
+** variable slot, which is free when iterating with 'next'. Results are
+** placed as if the iterator was called with 'nres' results.
+*/
+static void fornext(cs_State *C, SPtr stk, int nres) {
+    const TValue *o = s2v(stk + FORINVSTATE);
+    Table *ht = ttishtab(o) ? tval(o) : insval(o)->fields;
+    TValue *cursor = s2v(stk + FORTBCVAR);
+    SPtr res = stk + NSTATEVARS;
+    uint i = ttisint(cursor) ? cast_uint(ival(cursor)) : 0;
+    int n;
+    setobjs2s(C, res, stk + FORCNTLVAR); /* previous key */
+    if (csH_nextat(C, ht, res, &i)) { /* found field? */
+        setival(cursor, i);
+        n = 2; /* key (index) + value */
+    } else {
+        setnilval(s2v(res));
+        n = 1;
+    }
+    for (; n < nres; n++) /* complete missing results */
+        setnilval(s2v(res + n));
+    C->sp.p = res + nres;
+}
+
+
 /* -----------------------------------------------------------------------
  * Interpreter loop
  * ----------------------------------------------------------------------- */
@@ -900,20 +1025,20 @@ void csV_concat(cs_State *C, int total) {
 
 
 /* 
-** Protect code that can raise errors.
+** Protect code that can raise errors or reallocate the stack.
 */
-#define Protect(exp)        (savepc(C), (exp))
+#define Protect(exp)        (savepc(C), (exp), updatebase(cf))
 
 /*
 ** Protect code that can raise errors or overwrite stack values.
 */
 #define ProtectTop(exp) \
     { ptrdiff_t oldtop = savestack(C, C->sp.p); savestate(C, cf); \
-        (exp); C->sp.p = restorestack(C, oldtop); }
+        (exp); C->sp.p = restorestack(C, oldtop); updatebase(cf); }
 
 
 /* correct global 'pc' before checking collector debt */
-#define checkGC(C)     csG_condGC(C, savepc(C), (void)0)
+#define checkGC(C)     csG_condGC(C, savepc(C), updatebase(cf))
 
 
 #if TRACE_EXEC
@@ -1046,6 +1171,8 @@ returning:
             vm_case(OP_CLOSURE) {
                 int findex = fetchl();
                 Proto *fn = cl->p->p[findex];
+                if (c_unlikely(fn->lazysrc != NULL)) /* not compiled? */
+                    Protect(csPR_parselazy(C, fn));
                 Protect(pushclosure(C, fn, cl->upvals, base));
                 checkGC(C);
                 vm_break;
@@ -1080,14 +1207,18 @@ returning:
             }
             vm_case(OP_NEWTABLE) {
                 int b = fetchs();
+                int site = fetchs();
                 Table *t;
                 if (b > 0) /* table has fields? */
                     b = 1 << (b - 1); /* size is 2^(b - 1) */
                 SP(1);
                 savepc(C); /* allocations might fail */
-                t = csH_new(C);
+                if (site == 0) /* regular table? */
+                    t = csH_newsz(C, b); /* (sized for all its fields) */
+                else /* otherwise table never escapes this frame */
+                    t = tmptable(C, cf, cl->p, site - 1);
                 settval2s(C, TOP(), t);
-                if (b != 0) /* table is not empty? */
+                if (b > htsize(t)) /* table too small? */
                     csH_resize(C, t, b); /* grow table to size 'b' */
                 checkGC(C);
                 vm_break;
@@ -1378,6 +1509,31 @@ returning:
                     Protect(csMM_tryunary(C, v, res, CS_MM_BNOT));
                 vm_break;
             }
+            vm_case(OP_FLOOR) {
+                TValue *v = peek(0);
+                if (ttisflt(v)) {
+                    cs_Number n = cs_floor(fval(v));
+                    cs_Integer i;
+                    if (csO_n2i(n, &i, N2IFLOOR)) {
+                        setival(v, i);
+                    } else { /* does not fit in an integer */
+                        setfval(v, n);
+                    }
+                } else if (c_unlikely(!ttisint(v)))
+                    Protect(csD_typeerror(C, v, "floor"));
+                vm_break;
+            }
+            vm_case(OP_ABS) {
+                TValue *v = peek(0);
+                if (ttisint(v)) {
+                    cs_Integer i = ival(v);
+                    if (i < 0) { setival(v, c_intop(-, 0, i)); }
+                } else if (ttisflt(v)) {
+                    setfval(v, cs_mathop(fabs)(fval(v)));
+                } else
+                    Protect(csD_typeerror(C, v, "get absolute value of"));
+                vm_break;
+            }
             /* } JMP_OPS { */
             vm_case(OP_JMP) {
                 int off = fetchl();
@@ -1395,6 +1551,24 @@ returning:
                 pc += off;
                 SP(-npop);
                 vm_break;
+            }
+            vm_case(OP_SWITCH) {
+                const SwitchTable *st = &cl->p->swtabs[fetchl()];
+                const TValue *v = peek(0);
+                int target = st->dflt;
+                if (st->t == NULL) { /* dense integer labels? */
+                    cs_Integer i;
+                    if (csO_tointeger(v, &i, N2IEXACT) &&
+                            c_castS2U(i) - c_castS2U(st->lo) <
+                            cast(cs_Unsigned, st->sizejmps))
+                        target = st->jmps[i - st->lo];
+                } else { /* otherwise hash lookup */
+                    const TValue *slot = csH_get(st->t, v);
+                    if (!isempty(slot))
+                        target = cast_int(ival(slot));
+                }
+                pc = cl->p->code + target;
+                vm_break;
             } /* } TEST_OPS { */
             vm_case(OP_TEST) {
                 TValue *v = peek(0);
@@ -1442,6 +1616,7 @@ returning:
                     cf = newcf;
                     goto startfunc;
                 } /* else call is already done (not a CScript closure) */
+                updatebase(cf); /* stack might have been reallocated */
                 vm_break;
             }
             vm_case(OP_CLOSE) {
@@ -1519,6 +1694,14 @@ returning:
                 C->sp.p = sa + 1; /* pop off elements */
                 vm_break;
             }
+            vm_case(OP_SETFIELDS) {
+                int n = fetchs(); /* number of key-value pairs */
+                SPtr first = C->sp.p - 2*n;
+                Table *t = tval(s2v(first - 1));
+                Protect(csH_setpairs(C, t, first, n));
+                C->sp.p = first; /* remove keys and values */
+                vm_break;
+            }
             vm_case(OP_SETPROPERTY) { /* NOTE: optimize? */
                 TValue *o = peek(fetchl());
                 TValue *prop = K(fetchl());
@@ -1648,9 +1831,13 @@ returning:
                  * invariant state 'stk + 2' is the control variable, and
                  * 'stk + 3' is the to-be-closed variable. Call uses stack
                  * after these values (starting at 'stk + 4'). */
-                memcpy(stk+NSTATEVARS, stk, FORTBCVAR*sizeof(*stk));
-                C->sp.p = stk+NSTATEVARS+FORTBCVAR; /* adjust stack pointer */
-                Protect(csV_call(C, stk+NSTATEVARS, nres)); /* call iter */
+                if (isfornext(stk)) { /* 'next' over table or instance? */
+                    Protect(fornext(C, stk, nres));
+                } else {
+                    memcpy(stk+NSTATEVARS, stk, FORTBCVAR*sizeof(*stk));
+                    C->sp.p = stk+NSTATEVARS+FORTBCVAR; /* adjust sp */
+                    Protect(csV_call(C, stk+NSTATEVARS, nres)); /* call */
+                }
                 updatebase(cf);
                 check_exp(*pc == OP_FORLOOP, cast_void(fetch())); /* skip */
                 goto l_forloop;
@@ -1678,6 +1865,8 @@ returning:
                     csF_close(C, base, CLOSEKTOP);
                     updatebase(cf);
                 }
+                if (cl->p->sizetmptabs > 0) /* have temporary tables? */
+                    releasetmptabs(cl->p, cf);
                 if (cl->p->isvararg) /* vararg function ? */
                     cf->func.p -= cf->nvarargs + cl->p->arity + 1;
                 C->sp.p = stk + nres;
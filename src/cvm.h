@@ -23,6 +23,7 @@
 
 
 CSI_FUNC void csV_call(cs_State *C, SPtr fn, int nreturns);
+CSI_FUNC int csV_next(cs_State *C);
 CSI_FUNC void csV_concat(cs_State *C, int n);
 CSI_FUNC cs_Integer csV_div(cs_State *C, cs_Integer x, cs_Integer y);
 CSI_FUNC cs_Integer csV_modint(cs_State *C, cs_Integer x, cs_Integer y);
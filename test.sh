@@ -1,7 +1,8 @@
 BIN=cscript
 TESTDIR=test
-TESTS=($(ls $TESTDIR))
-NTESTS=${#TESTS[@]}
+TESTS=($(cd $TESTDIR && ls *.cst))
+CTESTS=($(cd $TESTDIR && ls *.c))
+NTESTS=$((${#TESTS[@]} + ${#CTESTS[@]}))
 
 echo "Running $NTESTS tests:"
 
@@ -18,5 +19,17 @@ for t in "${TESTS[@]}"; do
     printf "\x1B[0m\n";
 done
 
+for t in "${CTESTS[@]}"; do
+    printf "$t...\t";
+    make -s $TESTDIR/${t%.c} &> /dev/null && ./$TESTDIR/${t%.c} &> /dev/null
+    if (( $? == 0 )); then
+        printf "\x1B[32mpassed";
+    else
+        ((failed++))
+        printf "\x1B[31mfailed";
+    fi
+    printf "\x1B[0m\n";
+done
+
 printf "Total \x1B[32mpassed\x1B[0m tests: %d\n" $((NTESTS - failed));
 printf "Total \x1B[31mfailed\x1B[0m tests: %d\n" $failed;
@@ -0,0 +1,135 @@
+/*
+** capi.c
+** Tests for the bulk C API functions
+** See Copyright Notice in cscript.h
+**
+** Covers 'cs_get_array_numbers', 'cs_get_array_integers',
+** 'cs_set_array_numbers', 'cs_set_array_integers' and 'cs_set_fields';
+** built and run by 'test.sh' (or 'make test/capi').
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cauxlib.h"
+
+
+#define check(c)    ((c) ? (void)0 : failed(#c, __LINE__))
+
+
+static void failed(const char *what, int line) {
+    fprintf(stderr, "capi.c:%d: check failed: %s\n", line, what);
+    exit(EXIT_FAILURE);
+}
+
+
+/* partial copies stop at the first element of the wrong kind */
+static void getpartial(cs_State *C) {
+    cs_Number nums[8];
+    cs_Integer ints[8];
+    cs_push_array(C, 0);
+    cs_push_integer(C, 1); cs_set_index(C, -2, 0);
+    cs_push_number(C, 2.0); cs_set_index(C, -2, 1);
+    cs_push_number(C, 2.5); cs_set_index(C, -2, 2);
+    cs_push_string(C, "x"); cs_set_index(C, -2, 3);
+    cs_push_integer(C, 5); cs_set_index(C, -2, 4);
+    check(cs_get_array_numbers(C, -1, nums, 5) == 3);
+    check(nums[0] == 1.0 && nums[1] == 2.0 && nums[2] == 2.5);
+    check(cs_get_array_integers(C, -1, ints, 5) == 2);
+    check(ints[0] == 1 && ints[1] == 2); /* (2.0 has an exact value) */
+    check(cs_get_array_numbers(C, -1, nums, 0) == 0);
+    cs_pop(C, 1);
+}
+
+
+/* counts larger than the array are clamped to its length */
+static void getclamped(cs_State *C) {
+    cs_Number nums[8] = {-1, -1, -1, -1, -1, -1, -1, -1};
+    cs_Integer ints[8];
+    cs_push_array(C, 0);
+    check(cs_get_array_numbers(C, -1, nums, 8) == 0);
+    check(nums[0] == -1); /* untouched */
+    cs_push_number(C, 0.5); cs_set_index(C, -2, 0);
+    cs_push_number(C, 1.5); cs_set_index(C, -2, 1);
+    check(cs_get_array_numbers(C, -1, nums, 8) == 2);
+    check(nums[0] == 0.5 && nums[1] == 1.5 && nums[2] == -1);
+    check(cs_get_array_integers(C, -1, ints, 8) == 0);
+    cs_pop(C, 1);
+}
+
+
+/* setting grows empty arrays and keeps elements past 'n' */
+static void setgrow(cs_State *C) {
+    cs_Number nums[100], back[100];
+    cs_Integer ints[3] = {7, -8, 9}, iback[4];
+    for (int i = 0; i < 100; i++)
+        nums[i] = i * 0.25;
+    cs_push_array(C, 0);
+    cs_set_array_numbers(C, -1, nums, 0); /* no-op */
+    check(cs_len(C, -1) == 0);
+    cs_set_array_numbers(C, -1, nums, 100);
+    check(cs_len(C, -1) == 100);
+    check(cs_get_array_numbers(C, -1, back, 100) == 100);
+    for (int i = 0; i < 100; i++)
+        check(back[i] == nums[i]);
+    cs_set_array_integers(C, -1, ints, 3); /* overwrite a prefix */
+    check(cs_len(C, -1) == 100);
+    check(cs_get_array_integers(C, -1, iback, 4) == 3);
+    check(iback[0] == 7 && iback[1] == -8 && iback[2] == 9);
+    check(cs_get_index(C, -1, 3) == CS_TNUMBER);
+    check(cs_to_number(C, -1) == 0.75 && !cs_is_integer(C, -1));
+    cs_pop(C, 2);
+    cs_push_array(C, 0);
+    cs_set_array_integers(C, -1, ints, 3);
+    check(cs_len(C, -1) == 3);
+    check(cs_get_index(C, -1, 2) == CS_TNUMBER && cs_is_integer(C, -1));
+    cs_pop(C, 2);
+}
+
+
+/* batches larger than the table force a resize */
+static void setfields(cs_State *C) {
+    int t = cs_nvalues(C); /* index of the new table */
+    cs_push_table(C, 2);
+    cs_push_literal(C, "old");
+    cs_set_fieldstr(C, -2, "k");
+    csL_check_stack(C, 2 * 100, "too many fields");
+    for (int i = 0; i < 99; i++) {
+        cs_push_integer(C, i);
+        cs_push_integer(C, i * 2);
+    }
+    cs_push_literal(C, "k"); /* overwrites the existing field */
+    cs_push_literal(C, "new");
+    cs_set_fields(C, t, 100);
+    check(cs_gettop(C) == t);
+    check(cs_len(C, -1) == 100);
+    for (int i = 0; i < 99; i++) {
+        check(cs_get_fieldint(C, -1, i) == CS_TNUMBER);
+        check(cs_to_integer(C, -1) == i * 2);
+        cs_pop(C, 1);
+    }
+    check(cs_get_fieldstr(C, -1, "k") == CS_TSTRING);
+    check(strcmp(cs_to_string(C, -1), "new") == 0);
+    cs_pop(C, 1);
+    cs_set_fields(C, -1, 0); /* empty batch */
+    check(cs_len(C, -1) == 100 && cs_gettop(C) == t);
+    cs_pop(C, 1);
+}
+
+
+int main(void) {
+    cs_State *C = csL_newstate();
+    if (C == NULL) {
+        fprintf(stderr, "capi: cannot create state\n");
+        return EXIT_FAILURE;
+    }
+    getpartial(C);
+    getclamped(C);
+    setgrow(C);
+    setfields(C);
+    check(cs_nvalues(C) == 0);
+    cs_close(C);
+    return EXIT_SUCCESS;
+}